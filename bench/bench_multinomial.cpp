@@ -0,0 +1,76 @@
+/******************************************************************************
+ * File:             bench_multinomial.cpp
+ *
+ * Author:           Floyd Everest <me@floydeverest.com>
+ * Created:          10/16/26
+ * Description:      A standalone microbenchmark comparing `rMultinomial`
+ *                   against conditional binomials drawn with
+ *                   `std::binomial_distribution`.
+ *
+ *                   Build and run from the repository root with:
+ *
+ *                     g++ -std=c++17 -O2 -Isrc bench/bench_multinomial.cpp \
+ *                       src/distributions.cpp -o bench/bench_multinomial
+ *                     ./bench/bench_multinomial
+ *****************************************************************************/
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "distributions.h"
+
+// The previous implementation of rMultinomial, for reference.
+void rMultinomialStd(unsigned N, const double *p, unsigned d, unsigned *out,
+                     std::mt19937 *engine) {
+  double norm = 0.0;
+  for (size_t i = 0; i < d; ++i) norm += p[i];
+  double sum_ps = 0.0;
+  unsigned n = N;
+  for (size_t i = 0; i < d; ++i) {
+    if (norm - (sum_ps + p[i]) == 0.0) {
+      out[i] = n;
+      for (size_t j = i + 1; j < d; ++j) out[j] = 0;
+      break;
+    }
+    std::binomial_distribution<unsigned> b(n, p[i] / (norm - sum_ps));
+    out[i] = b(*engine);
+    n -= out[i];
+    sum_ps += p[i];
+  }
+}
+
+// Returns the mean time in nanoseconds of f over `reps` calls.
+template <typename F>
+double timeIt(unsigned reps, F f) {
+  auto start = std::chrono::steady_clock::now();
+  for (unsigned i = 0; i < reps; ++i) f();
+  auto stop = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(stop - start).count() / reps;
+}
+
+int main() {
+  const unsigned d = 10;
+  std::mt19937 e(12345);
+  std::vector<double> p = rDirichlet(std::vector<double>(d, 1.), &e);
+  std::vector<unsigned> out(d);
+  // Guards against the sampling loops being optimised away.
+  unsigned long checksum = 0;
+
+  std::printf("%10s %12s %12s\n", "N", "std (ns)", "kernel (ns)");
+  for (unsigned N : {3u, 100u, 10000u, 50000u, 1000000u, 5000000u}) {
+    unsigned reps = N > 100000 ? 20000 : 100000;
+    double tStd = timeIt(reps, [&]() {
+      rMultinomialStd(N, p.data(), d, out.data(), &e);
+      checksum += out[0];
+    });
+    double tKernel = timeIt(reps, [&]() {
+      rMultinomial(N, p.data(), d, out.data(), &e);
+      checksum += out[0];
+    });
+    std::printf("%10u %12.1f %12.1f\n", N, tStd, tKernel);
+  }
+  std::printf("checksum: %lu\n", checksum);
+  return 0;
+}
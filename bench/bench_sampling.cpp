@@ -0,0 +1,139 @@
+/******************************************************************************
+ * File:             bench_sampling.cpp
+ *
+ * Author:           Floyd Everest <me@floydeverest.com>
+ * Created:          10/16/26
+ * Description:      A standalone benchmark for the posterior sampling loop
+ *                   which runs in each `samplePosterior` thread. It reports
+ *                   the time and the number of heap allocations per simulated
+ *                   election, both one election at a time and in blocks of
+ *                   lanes, and fails if the steady state allocates.
+ *
+ *                   Build and run from the repository root with:
+ *
+ *                     g++ -std=c++17 -O2 -Isrc bench/bench_sampling.cpp \
+ *                       src/irv_node.cpp src/irv_ballot.cpp \
+ *                       src/distributions.cpp -o bench/bench_sampling
+ *                     ./bench/bench_sampling
+ *****************************************************************************/
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <random>
+#include <vector>
+
+#include "dirichlet_tree.h"
+#include "irv_ballot.h"
+#include "irv_node.h"
+
+// Count every heap allocation made through the global operator new.
+static std::atomic<size_t> nAllocations{0};
+
+void *operator new(size_t size) {
+  ++nAllocations;
+  if (void *p = std::malloc(size)) return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+
+int main() {
+  const unsigned nCandidates = 10;
+  const unsigned nObservations = 2000;
+  const unsigned nBallots = 10000;
+  const unsigned nWarmup = 100;
+  const unsigned nElections = 2000;
+  const unsigned nLanes = 8;
+
+  IRVParameters params(nCandidates, 0, nCandidates, 1., false);
+  DirichletTree<IRVNode, IRVBallot, IRVParameters> tree(&params, "bench");
+
+  // Observe random partial ballots, so that the tree has both explicit and
+  // lazily sampled sub-trees.
+  std::mt19937 e(12345);
+  std::vector<unsigned> perm = params.defaultPath();
+  for (unsigned i = 0; i < nObservations; ++i) {
+    std::shuffle(perm.begin(), perm.end(), e);
+    unsigned length = 1 + e() % nCandidates;
+    tree.update({IRVBallot(perm.begin(), perm.begin() + length), 1});
+  }
+
+  IRVWorkspace ws(&params);
+  IRVTallyWorkspace tallyWs;
+  IRVBallotTable election{};
+  IRVBallotTrie observed(tree.getObserved().begin(), tree.getObserved().end());
+  std::vector<unsigned> result(nCandidates);
+  auto simulate = [&]() {
+    election.clear();
+    tree.posteriorSetUnobserved(nBallots, false, ws, &e, election);
+    socialChoiceIRV(observed, election, nCandidates, &e, tallyWs,
+                    result.data());
+  };
+
+  // Let the election buffer grow to its' steady-state capacity.
+  for (unsigned i = 0; i < nWarmup; ++i) simulate();
+
+  size_t allocationsBefore = nAllocations;
+  auto start = std::chrono::steady_clock::now();
+  for (unsigned i = 0; i < nElections; ++i) simulate();
+  auto end = std::chrono::steady_clock::now();
+  size_t allocations = nAllocations - allocationsBefore;
+
+  double usPerElection =
+      std::chrono::duration<double, std::micro>(end - start).count() /
+      nElections;
+  std::printf("candidates: %u, ballots: %u, elections: %u\n", nCandidates,
+              nBallots, nElections);
+  std::printf("time per election: %.2f us\n", usPerElection);
+  std::printf("allocations per election: %.3f\n",
+              static_cast<double>(allocations) / nElections);
+
+  // Simulate the same number of elections in blocks, each election with its'
+  // own Philox stream as in `samplePosterior`.
+  IRVLaneWorkspace laneWs(&params, nLanes);
+  std::vector<IRVBallotTable> elections(nLanes);
+  std::vector<Philox> engines(nLanes);
+  std::vector<Philox *> enginePtrs(nLanes);
+  std::vector<IRVBallotTable *> electionPtrs(nLanes);
+  std::vector<unsigned> counts(nLanes, nBallots - tree.getNObserved());
+  for (unsigned k = 0; k < nLanes; ++k) {
+    enginePtrs[k] = &engines[k];
+    electionPtrs[k] = &elections[k];
+  }
+  auto simulateBlock = [&](unsigned block) {
+    for (unsigned k = 0; k < nLanes; ++k) {
+      engines[k] = Philox(1, block * nLanes + k);
+      elections[k].clear();
+    }
+    tree.sampleLanes(nLanes, counts.data(), laneWs, enginePtrs.data(),
+                     electionPtrs.data());
+    for (unsigned k = 0; k < nLanes; ++k)
+      socialChoiceIRV(observed, elections[k], nCandidates, &engines[k],
+                      tallyWs, result.data());
+  };
+
+  for (unsigned i = 0; i < nWarmup / nLanes; ++i) simulateBlock(i);
+
+  size_t laneAllocationsBefore = nAllocations;
+  start = std::chrono::steady_clock::now();
+  for (unsigned i = 0; i < nElections / nLanes; ++i) simulateBlock(i);
+  end = std::chrono::steady_clock::now();
+  size_t laneAllocations = nAllocations - laneAllocationsBefore;
+
+  std::printf("time per election (%u lanes): %.2f us\n", nLanes,
+              std::chrono::duration<double, std::micro>(end - start).count() /
+                  nElections);
+  std::printf("allocations per election (%u lanes): %.3f\n", nLanes,
+              static_cast<double>(laneAllocations) / nElections);
+
+  // The election buffers may still grow on rare large draws, but the sampling
+  // recursion and the social choice function must never allocate.
+  bool allocates = allocations * 100 > nElections ||
+                   laneAllocations * 100 > nElections;
+  return allocates ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -18,7 +18,9 @@ Rcpp::List social_choice_irv(Rcpp::List bs, unsigned nWinners,
                              std::string seed) {
   Rcpp::List out{};
 
-  std::list<IRVBallotCount> scInput{};
+  IRVBallotTable scInput{};
+  // The position of each unique ballot in `scInput`.
+  std::unordered_map<IRVBallot, size_t> scIndex{};
 
   std::unordered_map<std::string, size_t> c2Index{};
   std::vector<std::string> cNames{};
@@ -32,34 +34,38 @@ Rcpp::List social_choice_irv(Rcpp::List bs, unsigned nWinners,
     }
   }
 
+  if (cNames.size() > IRVBallot::MAX_PREFERENCES)
+    Rcpp::stop("The IRV social choice function supports at most " +
+               std::to_string(IRVBallot::MAX_PREFERENCES) + " candidates.");
+
   Rcpp::CharacterVector bNames;
-  std::list<unsigned> bIndices;
-  bool newBallot = true;
+  IRVBallot b;
 
   for (auto i = 0; i < bs.size(); ++i) {
     if (bs[i] == R_NilValue)  // Skip empty ballots
       continue;
     bNames = bs[i];
-    bIndices = {};
+    if (bNames.size() > cNames.size())
+      Rcpp::stop("Invalid ballot found during social-choice evaluation.");
+    b = {};
     for (auto j = 0; j < bNames.size(); ++j) {
       cName = bNames[j];
       // If candidate has not yet been seen, raise an error.
       if (c2Index.count(cName) == 0)
         Rcpp::stop("Invalid candidate found during social-choice evaluation.");
-      bIndices.push_back(c2Index[cName]);
+      b.push_back(c2Index[cName]);
     }
 
     // Search for the same ballot already in the social choice input.
-    IRVBallot b(bIndices);
-    newBallot = true;
-    for (auto &bc : scInput) {
-      if (b == bc.first) {
-        bc.second = bc.second + 1;
-        newBallot = false;
-      }
+    auto it = scIndex.find(b);
+    if (it != scIndex.end()) {
+      scInput.addCount(it->second, 1);
+    } else {
+      // If it's not already there, add it to the back of the input with count
+      // 1.
+      scIndex.emplace(b, scInput.size());
+      scInput.add(b, 1);
     }
-    // If it's not already there, add it to the back of the list with count 1.
-    if (newBallot) scInput.emplace_back(std::move(b), 1);
   }
 
   if (nWinners < 1 || nWinners >= cNames.size())
@@ -13,6 +13,8 @@
 #include <R.h>
 #include <Rcpp.h>
 
+#include <unordered_map>
+
 #include "irv_ballot.h"
 
 /*! \brief The IRV social choice function.
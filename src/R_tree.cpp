@@ -13,7 +13,7 @@
 std::list<IRVBallotCount> RDirichletTree::parseBallotList(Rcpp::List bs) {
   Rcpp::CharacterVector namePrefs;
   std::string cName;
-  std::list<unsigned> indexPrefs;
+  IRVBallot indexPrefs;
   size_t cIndex;
 
   std::list<IRVBallotCount> out;
@@ -22,6 +22,9 @@ std::list<IRVBallotCount> RDirichletTree::parseBallotList(Rcpp::List bs) {
   // the "candidate index" for each seen candidate.
   for (auto i = 0; i < bs.size(); ++i) {
     namePrefs = bs[i];
+    if (namePrefs.size() > candidateVector.size())
+      Rcpp::stop(
+          "Ballot specifies more preferences than there are candidates!");
     indexPrefs = {};
     for (auto j = 0; j < namePrefs.size(); ++j) {
       cName = namePrefs[j];
@@ -35,7 +38,7 @@ std::list<IRVBallotCount> RDirichletTree::parseBallotList(Rcpp::List bs) {
 
       indexPrefs.push_back(cIndex);
     }
-    out.emplace_back(std::move(indexPrefs), 1);
+    out.emplace_back(indexPrefs, 1);
   }
 
   return out;
@@ -44,6 +47,9 @@ std::list<IRVBallotCount> RDirichletTree::parseBallotList(Rcpp::List bs) {
 RDirichletTree::RDirichletTree(Rcpp::CharacterVector candidates,
                                unsigned minDepth_, unsigned maxDepth_,
                                double a0_, bool vd_, std::string seed_) {
+  if (candidates.size() > IRVBallot::MAX_PREFERENCES)
+    Rcpp::stop("Dirichlet-trees support at most " +
+               std::to_string(IRVBallot::MAX_PREFERENCES) + " candidates.");
   // Parse the candidate strings.
   std::string cName;
   size_t cIndex = 0;
@@ -59,6 +65,16 @@ RDirichletTree::RDirichletTree(Rcpp::CharacterVector candidates,
   tree = new DirichletTree<IRVNode, IRVBallot, IRVParameters>(params, seed_);
 }
 
+RDirichletTree::RDirichletTree(
+    const RDirichletTree &other,
+    DirichletTree<IRVNode, IRVBallot, IRVParameters> *tree_)
+    : tree(tree_),
+      candidateVector(Rcpp::clone(other.candidateVector)),
+      candidateMap(other.candidateMap),
+      nObserved(other.nObserved),
+      observedDepths(other.observedDepths),
+      snapshot(other.snapshot) {}
+
 // Destructor.
 RDirichletTree::~RDirichletTree() {
   delete tree->getParameters();
@@ -78,9 +94,9 @@ unsigned RDirichletTree::getMaxDepth() {
 double RDirichletTree::getA0() { return tree->getParameters()->getA0(); }
 bool RDirichletTree::getVD() { return tree->getParameters()->getVD(); }
 Rcpp::CharacterVector RDirichletTree::getCandidates() {
-  Rcpp::CharacterVector out{};
-  for (const auto &[candidate, idx] : candidateMap) out.push_back(candidate);
-  return out;
+  // The names are returned in order of their candidate index, which matches
+  // the columns of the ranking matrices returned to R.
+  return Rcpp::clone(candidateVector);
 }
 
 // Setters
@@ -117,6 +133,7 @@ void RDirichletTree::setVD(bool vd_) { tree->getParameters()->setVD(vd_); }
 
 // Other methods
 void RDirichletTree::reset() {
+  snapshot.reset();
   tree->reset();
   nObserved = 0;
   observedDepths.clear();
@@ -128,6 +145,7 @@ void RDirichletTree::update(Rcpp::List ballots) {
   unsigned depth;
   // Parse the ballots.
   std::list<IRVBallotCount> bcs = parseBallotList(ballots);
+  thaw();
   for (IRVBallotCount &bc : bcs) {
     // If the tree is reducible to a Dirichlet distribution,
     // we need to check that the observed ballot length is >=
@@ -152,26 +170,182 @@ void RDirichletTree::update(Rcpp::List ballots) {
   }
 }
 
+Rcpp::List RDirichletTree::rankingList(const IRVBallotTable &table) {
+  // The matrix is allocated once and filled in a single pass.
+  unsigned nCandidates = getNCandidates();
+  Rcpp::IntegerMatrix rankings(table.size(), nCandidates);
+  std::fill(rankings.begin(), rankings.end(), NA_INTEGER);
+  Rcpp::IntegerVector frequencies(table.size());
+  for (size_t i = 0; i < table.size(); ++i) {
+    const uint8_t *b = table.ballot(i);
+    for (unsigned k = 0; k < table.length(i); ++k) rankings(i, b[k]) = k + 1;
+    frequencies[i] = table.count(i);
+  }
+  Rcpp::colnames(rankings) = candidateVector;
+  return Rcpp::List::create(Rcpp::Named("rankings") = rankings,
+                            Rcpp::Named("frequencies") = frequencies);
+}
+
+void RDirichletTree::thaw() {
+  if (!snapshot) return;
+  // The parameters of every node are determined by the observations, so
+  // replaying them as one batch rebuilds the saved tree.
+  const std::vector<IRVBallotCount> &observations = snapshot->getObservations();
+  tree->update(observations.begin(), observations.end());
+  snapshot.reset();
+}
+
+void RDirichletTree::updateBatch(const ObservationStore<IRVBallot> &batch,
+                                 unsigned nThreads) {
+  // Warn about short ballots once per batch, rather than once per ballot.
+  unsigned minDepth = tree->getParameters()->getMinDepth();
+  bool warned = false;
+  for (const auto &[b, count] : batch) {
+    unsigned depth = b.nPreferences();
+    if (depth < minDepth && depth > 0 && !warned) {
+      Rcpp::warning(
+          "Updating a Dirichlet-tree distribution with a ballot "
+          "specifying fewer than `minDepth` preferences. This introduces "
+          "undefined behaviour to the sampling methods, and the "
+          "resulting posterior can no longer reduce to a Dirichlet "
+          "distribution when using the `vd` option. Consider setting "
+          "`minDepth` to a value lower than the length of the smallest "
+          "ballot.");
+      warned = true;
+    }
+    nObserved += count;
+    observedDepths.insert(depth);
+  }
+
+  thaw();
+  tree->update(batch.begin(), batch.end(), nThreads);
+}
+
+void RDirichletTree::updateRankings(Rcpp::IntegerMatrix rankings,
+                                    Rcpp::IntegerVector counts,
+                                    unsigned nThreads) {
+  // The matrix is read in place, with one row per ballot and one column per
+  // candidate, holding the rank of the candidate on the ballot (or NA).
+  size_t nRows = rankings.nrow();
+  size_t nCols = rankings.ncol();
+  unsigned nCandidates = getNCandidates();
+  if (static_cast<size_t>(counts.size()) != nRows)
+    Rcpp::stop("`counts` must have one entry for each row of `rankings`.");
+
+  // Find the candidate index of each column.
+  std::vector<int> columnCandidate(nCols, -1);
+  std::vector<bool> seen(nCandidates, false);
+  Rcpp::CharacterVector columnNames = Rcpp::colnames(rankings);
+  if (static_cast<size_t>(columnNames.size()) != nCols)
+    Rcpp::stop("`rankings` must have a column name for each candidate.");
+  for (size_t j = 0; j < nCols; ++j) {
+    auto it = candidateMap.find(std::string(columnNames[j]));
+    if (it == candidateMap.end()) continue;
+    if (seen[it->second])
+      Rcpp::stop("Candidate appears more than once in `rankings`.");
+    seen[it->second] = true;
+    columnCandidate[j] = it->second;
+  }
+
+  // Convert each row to a ballot, and merge the repeated ballots.
+  ObservationStore<IRVBallot> batch(tree->getParameters()->exactOutcomeKeys());
+  const int *r = rankings.begin();
+  const unsigned NONE = IRVBallot::MAX_PREFERENCES;
+  unsigned byRank[IRVBallot::MAX_PREFERENCES];
+  for (size_t i = 0; i < nRows; ++i) {
+    if (counts[i] == NA_INTEGER || counts[i] < 0)
+      Rcpp::stop("`counts` must be non-negative integers.");
+    if (counts[i] == 0) continue;
+    std::fill(byRank, byRank + nCandidates, NONE);
+    unsigned maxRank = 0;
+    for (size_t j = 0; j < nCols; ++j) {
+      int rank = r[i + j * nRows];
+      if (rank == NA_INTEGER) continue;
+      if (rank <= 0) Rcpp::stop("`ballots` must only contain positive ranks.");
+      if (columnCandidate[j] < 0)
+        Rcpp::stop("Unknown candidate encountered in ballot!");
+      if (static_cast<unsigned>(rank) > nCandidates)
+        Rcpp::stop(
+            "Ballot specifies more preferences than there are candidates!");
+      if (byRank[rank - 1] != NONE)
+        Rcpp::stop("`ballots` must not feature ties between candidates.");
+      byRank[rank - 1] = columnCandidate[j];
+      maxRank = std::max<unsigned>(maxRank, rank);
+    }
+    // Gaps in the ranks are skipped, as for `prefio` orderings.
+    IRVBallot b;
+    for (unsigned k = 0; k < maxRank; ++k)
+      if (byRank[k] != NONE) b.push_back(byRank[k]);
+    batch.add(b, tree->getParameters()->outcomeKey(b), counts[i]);
+  }
+
+  updateBatch(batch, nThreads);
+}
+
+Rcpp::List RDirichletTree::updatePrefLib(std::string path,
+                                         unsigned nThreads) {
+  PrefLibReader reader(path);
+
+  // Find the candidate index of each alternative.
+  const std::vector<std::string> &names = reader.getAlternativeNames();
+  std::vector<int> alternativeCandidate(names.size(), -1);
+  for (size_t a = 0; a < names.size(); ++a) {
+    auto it = candidateMap.find(names[a]);
+    if (it != candidateMap.end()) alternativeCandidate[a] = it->second;
+  }
+
+  // Stream the orders into a batch of unique ballots.
+  ObservationStore<IRVBallot> batch(tree->getParameters()->exactOutcomeKeys());
+  batch.reserve(reader.getNUniqueOrders());
+  auto sink = [&](const unsigned *prefs, unsigned n, unsigned count) {
+    if (count == 0) return;
+    IRVBallot b;
+    for (unsigned i = 0; i < n; ++i) {
+      int c = alternativeCandidate[prefs[i]];
+      if (c < 0) Rcpp::stop("Unknown candidate encountered in ballot!");
+      b.push_back(c);
+    }
+    batch.add(b, tree->getParameters()->outcomeKey(b), count);
+  };
+  reader.readOrders(sink);
+  updateBatch(batch, nThreads);
+
+  // Return the unique ballots as a ranking matrix with their counts, so that
+  // the R object can record the observations.
+  IRVBallotTable observed{};
+  for (const auto &[b, count] : batch) observed.add(b, count);
+  return rankingList(observed);
+}
+
 Rcpp::List RDirichletTree::samplePredictive(unsigned nSamples,
                                             std::string seed) {
   tree->setSeed(seed);
 
-  Rcpp::List out;
-  Rcpp::CharacterVector rBallot;
+  // The sampler emits each distinct ballot once, so the table holds the
+  // aggregated sample.
+  IRVBallotTable sampled{};
+  IRVWorkspace ws(tree->getParameters());
+  sampleTree(nSamples, ws, tree->getEnginePtr(), sampled);
 
-  std::list<IRVBallotCount> samples = tree->sample(nSamples);
-  for (auto &[b, count] : samples) {
-    // Push count * b to the list.
-    for (unsigned i = 0; i < count; ++i) {
-      rBallot = Rcpp::CharacterVector::create();
-      for (auto cIndex : b.preferences) {
-        rBallot.push_back(candidateVector[cIndex]);
-      }
-      out.push_back(rBallot);
-    }
-  }
+  return rankingList(sampled);
+}
 
-  return out;
+void RDirichletTree::writePredictive(unsigned nSamples, std::string path,
+                                     std::string seed) {
+  tree->setSeed(seed);
+
+  std::vector<std::string> names(candidateVector.begin(),
+                                 candidateVector.end());
+  PrefLibWriter writer(path, names);
+
+  // Each distinct ballot is written as soon as it is sampled, so the memory
+  // used does not depend on the number of samples.
+  auto sink = [&writer](const unsigned *prefs, unsigned n, unsigned count) {
+    writer.writeOrder(prefs, n, count);
+  };
+  IRVWorkspace ws(tree->getParameters());
+  sampleTree(nSamples, ws, tree->getEnginePtr(), sink);
+  writer.close();
 }
 
 Rcpp::NumericVector RDirichletTree::samplePosterior(unsigned nElections,
@@ -185,73 +359,260 @@ Rcpp::NumericVector RDirichletTree::samplePosterior(unsigned nElections,
         "`nBallots` must be larger than the number of ballots "
         "observed to obtain the posterior.");
 
+  // The number of ballots to sample for each election.
+  unsigned nNew = replace ? nBallots : nBallots - nObserved;
+
+  // Very large elections are split at the top levels of the tree, and each
+  // sub-tree is sampled as a separate task with its' own Philox stream, so
+  // that a single election can be simulated on many threads. Whether an
+  // election is split depends only on its' size, so the results do not
+  // depend on the number of threads. Snapshots are not split, so the nodes
+  // are rebuilt first.
+  bool split = nNew >= SPLIT_SAMPLE_MIN;
+  if (split) thaw();
+
+  // Every election traverses the same tree, so it is compiled into a
+  // contiguous image first. The image is kept until the tree is next updated.
+  if (!snapshot) tree->freeze();
+
   tree->setSeed(seed);
 
   size_t nCandidates = getNCandidates();
 
-  // Generate PRNG seeds.
+  // Each election is simulated with its' own Philox stream, keyed by the seed
+  // and indexed by the election number. The results therefore do not depend
+  // on how the elections are split between threads. The draws are sequenced,
+  // so that every compiler derives the same key from the seed.
   std::mt19937 *treeGen = tree->getEnginePtr();
-  std::vector<unsigned> seeds{};
-  for (unsigned i = 0; i <= nThreads; ++i) {
-    seeds.push_back((*treeGen)());
-  }
-
-  // The number of elections to sample per batch.
-  unsigned batchSize, batchRemainder;
-  if (nElections <= 1) {
-    batchSize = 0;
-    batchRemainder = nElections;
-  } else {
-    batchSize = nElections / nThreads;
-    batchRemainder = nElections % nThreads;
+  uint64_t hi = (*treeGen)();
+  uint64_t key = hi << 32 | (*treeGen)();
+
+  // The elimination order of each simulated election, stored in consecutive
+  // rows of nCandidates elements.
+  std::vector<unsigned> results(static_cast<size_t>(nElections) * nCandidates);
+
+  // The observed ballots are common to every simulated election (unless every
+  // ballot is resampled), so they are stored once in a trie. Each thread
+  // caches their tallies by the set of eliminated candidates, so each election
+  // only samples and tallies its' new ballots.
+  IRVBallotTrie observed;
+  if (!replace && snapshot) {
+    observed = IRVBallotTrie(snapshot->getObservations().begin(),
+                             snapshot->getObservations().end());
+  } else if (!replace) {
+    observed = IRVBallotTrie(tree->getObserved().begin(),
+                             tree->getObserved().end());
   }
-
-  // The results vectors for each thread.
-  std::vector<std::vector<std::vector<unsigned>>> results(nThreads);
-
-  // Use multiple threads to compute the posterior in batches.
-  auto processBatch = [&](size_t thread_idx, size_t size) -> void {
-    // Seed a new PRNG, and warm it up.
-    std::mt19937 e(seeds[thread_idx]);
-    e.discard(e.state_size * 100);
-
-    // Prepare results vector
-    results[thread_idx].resize(size);
-    for (unsigned j = 0; j < size; ++j) {
-      // Check for interrupt.
-      RcppThread::checkUserInterrupt();
-      // Simulate election.
-      std::list<IRVBallotCount> election = tree->posteriorSet(nBallots, replace, &e);
-      // Evaluate social choice function.
-      results[thread_idx][j] =
-          socialChoiceIRV(election, nCandidates, &e);
+  // Elections which are not split are simulated in blocks of SAMPLE_LANES,
+  // which traverse the tree once per block rather than once per election.
+  // Each election keeps its' own stream, so the blocks do not change the
+  // results. Snapshots are sampled one election at a time.
+  unsigned lanes = split || snapshot || nNew == 0 ? 1 : SAMPLE_LANES;
+  std::vector<unsigned> laneCounts(lanes, nNew);
+
+  // The scratch memory for each thread. All of it is allocated up-front and
+  // reused for each election, so the sampling loop performs no heap
+  // allocations once the election buffers have grown to their steady-state
+  // size.
+  struct Scratch {
+    IRVWorkspace ws;
+    IRVLaneWorkspace laneWs;
+    IRVTallyWorkspace tallyWs;
+    // The simulated elections of a block are written straight into compact
+    // ballot tables by the sampler, which keep their capacity between blocks.
+    std::vector<IRVBallotTable> elections;
+    // The stream of each election in a block. The sampler takes pointers to
+    // the streams and tables of a block.
+    std::vector<Philox> engines;
+    std::vector<Philox *> enginePtrs;
+    std::vector<IRVBallotTable *> electionPtrs;
+    // The sub-trees of a split election.
+    IRVSplit split;
+    Scratch(IRVParameters *params, unsigned lanes)
+        : ws(params),
+          laneWs(params, lanes),
+          tallyWs(),
+          elections(lanes),
+          engines(lanes),
+          enginePtrs(lanes),
+          electionPtrs(lanes),
+          split(params) {
+      for (unsigned k = 0; k < lanes; ++k) {
+        enginePtrs[k] = &engines[k];
+        electionPtrs[k] = &elections[k];
+      }
     }
   };
+  std::vector<Scratch> scratch;
+  scratch.reserve(nThreads);
+  for (unsigned i = 0; i < nThreads; ++i)
+    scratch.emplace_back(tree->getParameters(), lanes);
+
+  // Samples the new ballots of a single election into the first table of a
+  // thread, sampling the tasks of a split election one after another.
+  auto simulate = [&](Scratch &s, Philox &e) -> void {
+    IRVBallotTable &election = s.elections[0];
+    election.clear();
+    if (!split) {
+      sampleTree(nNew, s.ws, &e, election);
+      return;
+    }
+    tree->split(nNew, SPLIT_DEPTH, s.ws, &e, election, s.split);
+    for (size_t t = 0; t < s.split.size(); ++t)
+      tree->sampleTask(s.split, t, s.ws, election);
+  };
 
-  // Dispatch the jobs
-  std::vector<std::thread> pool(nThreads - 1);
-  // last batch should run on head process
-  for (unsigned i = 0; i < nThreads - 1; ++i) {
-    pool[i] = std::thread(std::bind(processBatch, i, batchSize + (i < batchRemainder)));
+  if (split && nElections < nThreads) {
+    // There are fewer elections than threads, so the tasks of each election
+    // are shared between the threads instead. Each task is sampled into its'
+    // own table, and the tables are appended in order, which gives the same
+    // election as sampling the tasks one after another.
+    std::vector<IRVBallotTable> taskTables;
+    Scratch &s = scratch[0];
+    IRVBallotTable &election = s.elections[0];
+    for (size_t j = 0; j < nElections; ++j) {
+      RcppThread::checkUserInterrupt();
+      Philox e(key, j);
+      election.clear();
+      tree->split(nNew, SPLIT_DEPTH, s.ws, &e, election, s.split);
+      if (taskTables.size() < s.split.size()) taskTables.resize(s.split.size());
+      auto processTasks = [&](unsigned thread, size_t begin,
+                              size_t end) -> void {
+        for (size_t t = begin; t < end; ++t) {
+          RcppThread::checkUserInterrupt();
+          taskTables[t].clear();
+          tree->sampleTask(s.split, t, scratch[thread].ws, taskTables[t]);
+        }
+      };
+      ThreadPool::global().parallelFor(s.split.size(), nThreads, 1,
+                                       processTasks);
+      for (size_t t = 0; t < s.split.size(); ++t)
+        election.append(taskTables[t]);
+      socialChoiceIRV(observed, election, nCandidates, &e, s.tallyWs,
+                      results.data() + j * nCandidates);
+    }
+  } else {
+    // Simulate the elections on the persistent thread pool. Threads which
+    // finish early steal elections from the others, so slow elections do not
+    // leave threads idle. Small chunks (of whole blocks) are taken at a time
+    // to keep stealing cheap.
+    size_t chunk =
+        lanes * std::max<size_t>(1, nElections / (64 * nThreads * lanes));
+    auto processChunk = [&](unsigned thread, size_t begin,
+                            size_t end) -> void {
+      Scratch &s = scratch[thread];
+      for (size_t j = begin; j < end; j += lanes) {
+        // Check for interrupt.
+        RcppThread::checkUserInterrupt();
+        // Simulate a block of elections.
+        unsigned n = std::min<size_t>(lanes, end - j);
+        for (unsigned k = 0; k < n; ++k) {
+          s.engines[k] = Philox(key, j + k);
+          s.elections[k].clear();
+        }
+        if (lanes == 1) {
+          simulate(s, s.engines[0]);
+        } else {
+          tree->sampleLanes(n, laneCounts.data(), s.laneWs,
+                            s.enginePtrs.data(), s.electionPtrs.data());
+        }
+        // Evaluate social choice function.
+        for (unsigned k = 0; k < n; ++k)
+          socialChoiceIRV(observed, s.elections[k], nCandidates,
+                          &s.engines[k], s.tallyWs,
+                          results.data() + (j + k) * nCandidates);
+      }
+    };
+    ThreadPool::global().parallelFor(nElections, nThreads, chunk,
+                                     processChunk);
   }
 
-  // Process final batch on main process
-  processBatch(nThreads - 1, batchSize);
-
-  // Join the threads
-  std::for_each(pool.begin(), pool.end(), [](std::thread &t) { t.join(); });
-
   // Aggregate the results
   Rcpp::NumericVector out(nCandidates);
   out.names() = candidateVector;
-  for (unsigned i = 0; i < nThreads; ++i) {
-    for (unsigned j = 0; j < results[i].size(); ++j) {
-      for (unsigned k = nCandidates - nWinners; k < nCandidates; ++k) {
-        out[results[i][j][k]] = out[results[i][j][k]] + 1;
-      }
+  for (size_t j = 0; j < results.size(); j += nCandidates) {
+    for (unsigned k = nCandidates - nWinners; k < nCandidates; ++k) {
+      out[results[j + k]] = out[results[j + k]] + 1;
     }
   }
 
   out = out / nElections;
   return out;
 }
+
+void RDirichletTree::save(std::string path) {
+  // Saving writes the nodes, so a loaded tree is rebuilt first.
+  thaw();
+  std::vector<std::string> names(candidateVector.begin(),
+                                 candidateVector.end());
+  IRVSnapshot::write(path, names, tree->getParameters(), tree->getRoot(),
+                     tree->getObserved(), nObserved);
+}
+
+Rcpp::List RDirichletTree::load(std::string path) {
+  // The snapshot is validated before any state is replaced.
+  std::shared_ptr<IRVSnapshot> loaded = std::make_shared<IRVSnapshot>(path);
+
+  // Replace the candidates.
+  candidateVector = Rcpp::CharacterVector();
+  candidateMap.clear();
+  const std::vector<std::string> &names = loaded->getCandidates();
+  for (size_t i = 0; i < names.size(); ++i) {
+    candidateVector.push_back(names[i]);
+    candidateMap[names[i]] = i;
+  }
+
+  // Replace the tree with an empty one, which samples from the snapshot until
+  // it is changed.
+  IRVParameters *params = new IRVParameters(
+      loaded->getNCandidates(), loaded->getMinDepth(), loaded->getMaxDepth(),
+      loaded->getA0(), loaded->getVD());
+  delete tree->getParameters();
+  delete tree;
+  tree = new DirichletTree<IRVNode, IRVBallot, IRVParameters>(params);
+  snapshot = std::move(loaded);
+
+  // Restore the observation records, and return the observations so that the
+  // R object can record them.
+  nObserved = snapshot->getNObserved();
+  observedDepths.clear();
+  IRVBallotTable observations{};
+  for (const auto &[b, count] : snapshot->getObservations()) {
+    observedDepths.insert(b.nPreferences());
+    observations.add(b, count);
+  }
+  return rankingList(observations);
+}
+
+RDirichletTree *RDirichletTree::clone() {
+  // The clone has its' own parameters, so that they can be changed
+  // independently, but shares the nodes and observations of this tree until
+  // either tree is updated.
+  IRVParameters *params = tree->getParameters();
+  IRVParameters *cloneParams = new IRVParameters(
+      params->getNCandidates(), params->getMinDepth(), params->getMaxDepth(),
+      params->getA0(), params->getVD());
+  return new RDirichletTree(*this, tree->clone(cloneParams));
+}
+
+void RDirichletTree::merge(RDirichletTree &other) {
+  if (&other == this) Rcpp::stop("A tree cannot be merged with itself.");
+  // The candidate indices must agree for the trees' nodes to correspond.
+  if (candidateMap != other.candidateMap)
+    Rcpp::stop("Trees can only be merged if they have the same candidates, "
+               "in the same order.");
+  if (!tree->getParameters()->compatible(other.tree->getParameters()))
+    Rcpp::stop("Trees can only be merged if they have the same `min_depth`, "
+               "`max_depth`, `a0` and `vd` parameters.");
+
+  // Both trees need their nodes to be merged.
+  thaw();
+  other.thaw();
+  tree->merge(*other.tree);
+  nObserved += other.nObserved;
+  observedDepths.insert(other.observedDepths.begin(),
+                        other.observedDepths.end());
+}
+
+// Join the worker threads before the package's code is unloaded.
+extern "C" void R_unload_elections_dtree(DllInfo *) { ThreadPool::shutdown(); }
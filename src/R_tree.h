@@ -11,11 +11,19 @@
 #ifndef R_TREE_H
 #define R_TREE_H
 
+#include <RcppCommon.h>
+
+// Expose the class to Rcpp before it is included, so that methods returning a
+// new RDirichletTree pointer are wrapped as R objects which own it.
+class RDirichletTree;
+RCPP_EXPOSED_CLASS_NODECL(RDirichletTree)
+
 #include <Rcpp.h>
 #include <RcppThread.h>
 
+#include <cstdint>
+#include <memory>
 #include <random>
-#include <thread>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
@@ -23,6 +31,11 @@
 #include "dirichlet_tree.h"
 #include "irv_ballot.h"
 #include "irv_node.h"
+#include "irv_snapshot.h"
+#include "observation_store.h"
+#include "philox.h"
+#include "preflib.h"
+#include "thread_pool.h"
 
 /*! \brief An Rcpp object which implements the `dtree` R object interface.
  *
@@ -31,6 +44,15 @@
  */
 class RDirichletTree {
  private:
+  // The smallest number of new ballots in a simulated election for which
+  // `samplePosterior` splits the election into independent sub-tree samples,
+  // and the depth of those sub-trees.
+  static constexpr unsigned SPLIT_SAMPLE_MIN = 1 << 16;
+  static constexpr unsigned SPLIT_DEPTH = 2;
+
+  // The number of elections simulated together by `samplePosterior`.
+  static constexpr unsigned SAMPLE_LANES = 8;
+
   // The underlying Dirichlet-tree.
   DirichletTree<IRVNode, IRVBallot, IRVParameters> *tree;
 
@@ -47,6 +69,22 @@ class RDirichletTree {
   // the posterior can reduce to a Dirichlet distribution or not.
   std::unordered_set<unsigned> observedDepths{};
 
+  // The snapshot the tree was loaded from, if any. While it is held, the
+  // tree has no nodes and samples are drawn from the snapshot directly. The
+  // nodes are only rebuilt from its' observations when the tree is changed.
+  // Clones of the tree share the snapshot.
+  std::shared_ptr<const IRVSnapshot> snapshot{};
+
+  /*! \brief Constructs a clone of another RDirichletTree.
+   *
+   * \param other The tree being cloned.
+   *
+   * \param tree_ A copy-on-write clone of the underlying tree of `other`,
+   * which is owned by the new object.
+   */
+  RDirichletTree(const RDirichletTree &other,
+                 DirichletTree<IRVNode, IRVBallot, IRVParameters> *tree_);
+
   /*! \brief Converts an R list of valid IRV ballot vectors to a
    * std::list<IRVBallotCount> format.
    *
@@ -61,6 +99,57 @@ class RDirichletTree {
    */
   std::list<IRVBallotCount> parseBallotList(Rcpp::List bs);
 
+  /*! \brief Updates the tree with a batch of unique ballots.
+   *
+   *  Warns if any ballot is shorter than the minimum depth, records the
+   * observed depths and counts, and then updates the tree in one pass.
+   *
+   * \param batch The unique ballots and their counts.
+   *
+   * \param nThreads The maximum number of threads to update the tree with.
+   */
+  void updateBatch(const ObservationStore<IRVBallot> &batch,
+                   unsigned nThreads);
+
+  /*! \brief Converts a table of unique ballots to a ranking matrix.
+   *
+   * \param table The unique ballots and their counts.
+   *
+   * \return A list with an integer matrix `rankings`, holding the rank of each
+   * candidate (column) on each ballot (row) or NA, and an integer vector
+   * `frequencies` holding the count of each ballot.
+   */
+  Rcpp::List rankingList(const IRVBallotTable &table);
+
+  /*! \brief Rebuilds the nodes of a tree loaded from a snapshot.
+   *
+   *  Updates the tree with the observations in the snapshot, and releases the
+   * snapshot. Does nothing if the tree was not loaded from a snapshot.
+   */
+  void thaw();
+
+  /*! \brief Samples from the posterior predictive distribution into a sink.
+   *
+   *  Samples from the snapshot if the tree was loaded from one, and from the
+   * tree's nodes otherwise.
+   *
+   * \param n The number of ballots to sample.
+   *
+   * \param ws A workspace for sampling.
+   *
+   * \param engine A PRNG for sampling.
+   *
+   * \param sink A sink for each distinct ballot, as for emitIRVBallot.
+   */
+  template <typename Engine, typename Sink>
+  void sampleTree(unsigned n, IRVWorkspace &ws, Engine *engine, Sink &sink) {
+    if (snapshot) {
+      snapshot->sample(tree->getParameters(), n, ws, engine, sink);
+    } else {
+      tree->sample(n, ws, engine, sink);
+    }
+  }
+
  public:
   // Constructor
   RDirichletTree(Rcpp::CharacterVector candidates, unsigned minDepth_,
@@ -89,7 +178,15 @@ class RDirichletTree {
   // Other methods
   void reset();
   void update(Rcpp::List ballots);
+  void updateRankings(Rcpp::IntegerMatrix rankings, Rcpp::IntegerVector counts,
+                      unsigned nThreads);
+  Rcpp::List updatePrefLib(std::string path, unsigned nThreads);
   Rcpp::List samplePredictive(unsigned nSamples, std::string seed);
+  void writePredictive(unsigned nSamples, std::string path, std::string seed);
+  void save(std::string path);
+  Rcpp::List load(std::string path);
+  RDirichletTree *clone();
+  void merge(RDirichletTree &other);
   Rcpp::NumericVector samplePosterior(unsigned nElections, unsigned nBallots,
                                       unsigned nWinners, bool replace,
                                       unsigned nThreads, std::string seed);
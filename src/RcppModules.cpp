@@ -7,8 +7,7 @@
  *                   the Dirichlet-tree interface to R.
  *****************************************************************************/
 
-#include <Rcpp.h>
-
+// R_tree.h exposes RDirichletTree to Rcpp before including Rcpp.h.
 #include "R_tree.h"
 
 // The Rcpp Dirichlet-tree interface to R.
@@ -29,6 +28,13 @@ RCPP_MODULE(dirichlet_tree_module) {
       // Other methods
       .method("reset", &RDirichletTree::reset)
       .method("update", &RDirichletTree::update)
+      .method("update_rankings", &RDirichletTree::updateRankings)
+      .method("update_preflib", &RDirichletTree::updatePrefLib)
       .method("sample_predictive", &RDirichletTree::samplePredictive)
+      .method("write_predictive", &RDirichletTree::writePredictive)
+      .method("save", &RDirichletTree::save)
+      .method("load", &RDirichletTree::load)
+      .method("clone", &RDirichletTree::clone)
+      .method("merge", &RDirichletTree::merge)
       .method("sample_posterior", &RDirichletTree::samplePosterior);
 }
@@ -0,0 +1,187 @@
+/******************************************************************************
+ * File:             arena.h
+ *
+ * Author:           Floyd Everest <me@floydeverest.com>
+ * Created:          10/16/26
+ * Description:      This file declares the `Arena` class, a slab allocator
+ *                   which owns all of the nodes (and their parameter and
+ *                   child arrays) in a Dirichlet-tree. Allocation is a
+ *                   pointer bump into a large slab, resetting the arena
+ *                   rewinds it to the first slab, and the memory is only
+ *                   returned to the system when the arena is destroyed.
+ *****************************************************************************/
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+class Arena {
+ private:
+  // A contiguous block of memory from which allocations are carved.
+  struct Slab {
+    std::unique_ptr<char[]> data;
+    size_t size;
+  };
+
+  // The default number of bytes in each slab.
+  size_t slabSize;
+
+  // All slabs owned by the arena, in order of allocation.
+  std::vector<Slab> slabs{};
+
+  // The index of the slab currently being carved.
+  size_t current = 0;
+
+  // The number of bytes used in the current slab.
+  size_t offset = 0;
+
+  // The arena on whose behalf the allocations are made, or null if they are
+  // made on behalf of this arena. A tree can give each thread its' own arena
+  // which allocates on behalf of the tree's arena, and adopt them afterwards.
+  const Arena *owner;
+
+ public:
+  /*! \brief Constructs an empty Arena.
+   *
+   * \param slabSize_ The number of bytes to request from the system each time
+   * the arena runs out of space.
+   *
+   * \param owner_ The arena on whose behalf allocations are made, which
+   * should adopt this arena once it is no longer used. Null if the arena
+   * allocates on its' own behalf.
+   *
+   * \return An empty Arena. No memory is allocated until it is first used.
+   */
+  explicit Arena(size_t slabSize_ = 1 << 20, const Arena *owner_ = nullptr)
+      : slabSize(slabSize_), owner(owner_) {}
+
+  // Copy constructor is removed, since the arena owns its' slabs.
+  Arena(const Arena &) = delete;
+
+  // Copy assignment via `=` operator is removed.
+  Arena &operator=(const Arena &) = delete;
+
+  /*! \brief Allocates uninitialized memory from the arena.
+   *
+   *  Carves `bytes` bytes from the current slab, moving on to the next slab
+   * (or requesting a new one from the system) when the current slab cannot
+   * fit the allocation.
+   *
+   * \param bytes The number of bytes to allocate.
+   *
+   * \param align The required alignment of the allocation.
+   *
+   * \return A pointer to the allocated memory, valid until the arena is reset
+   * or destroyed.
+   */
+  void *allocate(size_t bytes, size_t align = alignof(std::max_align_t)) {
+    while (current < slabs.size()) {
+      size_t start = (offset + align - 1) & ~(align - 1);
+      if (start + bytes <= slabs[current].size) {
+        offset = start + bytes;
+        return slabs[current].data.get() + start;
+      }
+      ++current;
+      offset = 0;
+    }
+    // No existing slab can fit the allocation, so we create a new one. Slabs
+    // are allocated with `new char[]`, so the start of each slab is aligned
+    // for any fundamental type.
+    size_t size = std::max(slabSize, bytes);
+    slabs.push_back({std::unique_ptr<char[]>(new char[size]), size});
+    current = slabs.size() - 1;
+    offset = bytes;
+    return slabs[current].data.get();
+  }
+
+  /*! \brief Constructs a new object in the arena.
+   *
+   *  The destructor of the object will never be called, so it must not own
+   * any resources outside of the arena.
+   *
+   * \param args The arguments to forward to the constructor of T.
+   *
+   * \return A pointer to the new object.
+   */
+  template <typename T, typename... Args>
+  T *create(Args &&...args) {
+    void *p = allocate(sizeof(T), alignof(T));
+    return new (p) T(std::forward<Args>(args)...);
+  }
+
+  /*! \brief Allocates a zero-initialized array of trivial types.
+   *
+   * \param n The number of elements in the array.
+   *
+   * \return A pointer to the first element of the array.
+   */
+  template <typename T>
+  T *allocateArray(size_t n) {
+    T *p = static_cast<T *>(allocate(sizeof(T) * n, alignof(T)));
+    std::memset(static_cast<void *>(p), 0, sizeof(T) * n);
+    return p;
+  }
+
+  /*! \brief Rewinds the arena to the start of the first slab.
+   *
+   *  All objects allocated from the arena are invalidated, but the slabs are
+   * kept so that subsequent allocations do not need to request any memory from
+   * the system.
+   */
+  void reset() {
+    current = 0;
+    offset = 0;
+  }
+
+  /*! \brief Takes ownership of the slabs of another arena.
+   *
+   *  The objects allocated from the other arena stay valid for as long as
+   * this arena is not reset or destroyed, and the other arena is left empty.
+   * The adopted slabs are reused once this arena is reset.
+   *
+   * \param other The arena to take the slabs of.
+   */
+  void adopt(Arena &other) {
+    // The adopted slabs are in use, so they are placed before the current
+    // slab, with the slabs which have already been filled.
+    size_t n = other.slabs.size();
+    slabs.insert(slabs.begin() + current,
+                 std::make_move_iterator(other.slabs.begin()),
+                 std::make_move_iterator(other.slabs.end()));
+    current += n;
+    other.slabs.clear();
+    other.reset();
+  }
+
+  /*! \brief Gets the number of bytes requested for each new slab.
+   *
+   * \return The slab size given to the constructor.
+   */
+  size_t getSlabSize() const { return slabSize; }
+
+  /*! \brief Gets the arena on whose behalf allocations are made.
+   *
+   * \return A pointer to the owning arena, which is this arena unless another
+   * was given to the constructor.
+   */
+  const Arena *getOwner() const { return owner == nullptr ? this : owner; }
+
+  /*! \brief Gets the number of bytes the arena has requested from the system.
+   *
+   * \return The total size of all slabs owned by the arena.
+   */
+  size_t capacity() const {
+    size_t out = 0;
+    for (const auto &slab : slabs) out += slab.size;
+    return out;
+  }
+};
+
+#endif /* ARENA_H */
@@ -14,16 +14,44 @@
 #ifndef DIRICHLET_TREE_H
 #define DIRICHLET_TREE_H
 
+#include <algorithm>
+#include <cstdint>
 #include <list>
-#include <map>
+#include <memory>
 #include <random>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
 
+#include "arena.h"
 #include "irv_ballot.h"
+#include "irv_frozen.h"
+#include "observation_store.h"
+#include "thread_pool.h"
 #include "tree_node.h"
 
 template <typename NodeType, typename Outcome, class Parameters>
 class DirichletTree {
  private:
+  // The smallest batch which is split between threads by a parallel update.
+  static constexpr size_t PARALLEL_UPDATE_MIN = 1 << 12;
+
+  // The number of bytes in each slab of the arenas created for clones. These
+  // are smaller than the default, since a clone typically only copies the
+  // nodes on the paths to a few new observations.
+  static constexpr size_t CLONE_SLAB_SIZE = 1 << 16;
+
+  // The arena which owns every node created or copied by this tree. Nodes are
+  // never freed individually; resetting the tree rewinds the arena, and
+  // destroying the tree releases its' slabs.
+  std::shared_ptr<Arena> arena;
+
+  // The arenas which own the nodes this tree shares with its' clones (or with
+  // the tree it was cloned from). These are frozen, so their nodes are never
+  // modified; they are copied into `arena` before being updated.
+  std::vector<std::shared_ptr<const Arena>> sharedArenas{};
+
   // The interior root node for the Dirichlet-tree.
   NodeType *root;
 
@@ -37,12 +65,38 @@ class DirichletTree {
 
   // The number of outcomes observed to obtain the posterior.
   unsigned nObserved = 0;
-  // A map of unique observations to the number of times it has been observed.
-  std::map<Outcome, unsigned> observed{};
+  // The unique observations and the number of times each has been observed,
+  // keyed by `parameters->outcomeKey`.
+  ObservationStore<Outcome> observed;
 
   // A default PRNG for sampling.
   std::mt19937 engine;
 
+  // A read-only image of the tree compiled for sampling by `freeze`, or null.
+  // It is discarded whenever the tree is modified, and is shared with clones
+  // until either tree is updated.
+  std::shared_ptr<const typename NodeType::Frozen> frozen{};
+
+  // Constructs a clone of `other`, without allocating a root. Used by `clone`.
+  DirichletTree(Parameters *parameters_, DirichletTree &other);
+
+  // Moves the tree's own arena to the shared arenas, so that its' nodes can be
+  // shared with another tree. Does nothing if the arena has never been used.
+  void shareNodes() {
+    if (arena->capacity() > 0) {
+      sharedArenas.push_back(arena);
+      arena = std::make_shared<Arena>(CLONE_SLAB_SIZE);
+    }
+  }
+
+  // Copies the root into the tree's own arena if it is shared, so that it can
+  // be updated. Returns the arena.
+  Arena *ownRoot() {
+    if (root->getOwner() != arena.get())
+      root = arena->template create<NodeType>(*root, arena.get());
+    return arena.get();
+  }
+
  public:
   /*! \brief The DirichletTree constructor.
    *
@@ -57,10 +111,36 @@ class DirichletTree {
    */
   DirichletTree(Parameters *parameters_, std::string seed = "12345");
 
-  // No copy constructor
+  // No copy constructor. Use `clone` instead.
   DirichletTree(const DirichletTree &dirichletTree) = delete;
 
-  ~DirichletTree();
+  /*! \brief Creates a copy-on-write clone of the tree.
+   *
+   *  The clone shares every node with this tree, and each tree copies only
+   * the nodes on the paths to its' later updates, so cloning takes constant
+   * time and memory. The observations are shared in the same way. The clone
+   * starts with a copy of the PRNG state of this tree.
+   *
+   * \param parameters_ The parameters for the clone, which must describe the
+   * same number of outcomes as those of this tree.
+   *
+   * \return A pointer to a new DirichletTree, owned by the caller.
+   */
+  DirichletTree *clone(Parameters *parameters_);
+
+  /*! \brief Merges the observations of another tree into this one.
+   *
+   *  Afterwards, this tree is the posterior having observed the outcomes of
+   * both trees. The parameters of corresponding nodes are summed, and the
+   * sub-trees which only the other tree has observed are shared with it
+   * rather than copied, in the same way as `clone`. Both trees can still be
+   * updated independently after the merge.
+   *
+   * \param other A tree with compatible parameters, which is not this tree.
+   *
+   * \return void
+   */
+  void merge(DirichletTree &other);
 
   /*! \brief Resets the distribution to its' prior.
    *
@@ -85,6 +165,33 @@ class DirichletTree {
    */
   void update(const std::pair<Outcome, unsigned> &oc);
 
+  /*! \brief Update a Dirichlet-tree with a batch of observed outcomes.
+   *
+   *  Equivalent to updating with each (outcome, count) pair in turn. The
+   * batch is sorted first, so that the nodes on each shared path prefix are
+   * updated once for the whole batch. Batches should be deduplicated by the
+   * caller to keep the sort small, but repeated outcomes are still counted
+   * correctly.
+   *
+   *  Large batches can be split between threads. The root's parameters are
+   * updated first, and the sorted batch is partitioned by the child of the
+   * root each outcome passes through (and further down the tree for any
+   * child with a large share of the batch). Each partition then updates its'
+   * own disjoint sub-tree, allocating nodes from an arena per thread, so the
+   * resulting tree is identical to a sequential update.
+   *
+   * \param first An iterator to the first std::pair<Outcome, unsigned>. The
+   * pairs must outlive the call.
+   *
+   * \param last An iterator past the last pair.
+   *
+   * \param nThreads The maximum number of threads to update the tree with.
+   *
+   * \return void
+   */
+  template <typename InputIt>
+  void update(InputIt first, InputIt last, unsigned nThreads = 1);
+
   /*! \brief Sample outcomes from the posterior predictive distribution.
    *
    *  Samples a specified number of outcomes from one realisation of the
@@ -101,6 +208,128 @@ class DirichletTree {
   std::list<std::pair<Outcome, unsigned>> sample(
       unsigned n, std::mt19937 *engine = nullptr);
 
+  /*! \brief Sample outcomes from the posterior predictive distribution into a
+   * sink.
+   *
+   *  Samples a specified number of outcomes from one realisation of the
+   * Dirichlet-tree, passing each (outcome, count) pair to the sink as it is
+   * sampled instead of collecting them in a list.
+   *
+   * \param n The number of outcomes to sample from a single realisation of the
+   * Dirichlet-tree.
+   *
+   * \param ws A workspace for the nodes to sample with. Reusing a workspace
+   * between calls avoids any heap allocations while sampling.
+   *
+   * \param engine A PRNG for randomness, either a mt19937 or a Philox. A null
+   * mt19937 pointer selects the default engine.
+   *
+   * \param sink A callable invoked as `sink(outcome, count)`.
+   */
+  template <typename Engine, typename Sink>
+  void sample(unsigned n, typename NodeType::Workspace &ws,
+              Engine *engine, Sink &sink);
+
+  /*! \brief Sample outcomes from several realisations of the Dirichlet-tree
+   * in one traversal.
+   *
+   *  Each lane samples from its' own realisation with its' own engine, and
+   * receives exactly the outcomes which `sample` would pass to its' sink with
+   * that engine. Traversing the tree once for every lane means each node is
+   * only read once.
+   *
+   * \param lanes The number of lanes.
+   *
+   * \param n The number of outcomes to sample in each lane, which must be
+   * positive.
+   *
+   * \param ws A lane workspace for the nodes to sample with, with room for at
+   * least `lanes` lanes.
+   *
+   * \param engines A PRNG for each lane, either mt19937s or Philoxes.
+   *
+   * \param sinks A pointer to a callable for each lane, invoked as
+   * `sink(outcome, count)`.
+   */
+  template <typename Engine, typename Sink>
+  void sampleLanes(unsigned lanes, const unsigned *n,
+                   typename NodeType::LaneWorkspace &ws,
+                   Engine *const *engines, Sink *const *sinks);
+
+  /*! \brief Split a sample from the posterior predictive distribution into
+   * independent tasks.
+   *
+   *  Samples the top levels of one realisation of the Dirichlet-tree, and
+   * records each sub-tree below `splitDepth` as a task which samples with
+   * its' own PRNG stream. Sampling every task into the sink completes the
+   * sample, and since the tasks are independent they can be sampled on
+   * separate threads without changing the outcomes.
+   *
+   * \param n The number of outcomes to sample from a single realisation of the
+   * Dirichlet-tree.
+   *
+   * \param splitDepth The depth of the sub-trees to be sampled as tasks.
+   *
+   * \param ws A workspace for the nodes to sample with.
+   *
+   * \param engine A PRNG for randomness, either a mt19937 or a Philox. A null
+   * mt19937 pointer selects the default engine.
+   *
+   * \param sink A callable invoked as `sink(outcome, count)` for each outcome
+   * sampled above the split.
+   *
+   * \param out The split to record the tasks in, which is cleared first.
+   */
+  template <typename Engine, typename Sink>
+  void split(unsigned n, unsigned splitDepth,
+             typename NodeType::Workspace &ws, Engine *engine, Sink &sink,
+             typename NodeType::Split &out);
+
+  /*! \brief Samples the sub-tree of a task from a split.
+   *
+   * \param split A split made by `split`, with no update to the tree since.
+   *
+   * \param i The index of the task.
+   *
+   * \param ws A workspace for the nodes to sample with.
+   *
+   * \param sink A callable invoked as `sink(outcome, count)`.
+   */
+  template <typename Sink>
+  void sampleTask(const typename NodeType::Split &split, size_t i,
+                  typename NodeType::Workspace &ws, Sink &sink) {
+    if (split.frozen) {
+      frozen->sampleTask(parameters, split, i, ws, sink);
+    } else {
+      split.sample(parameters, i, ws, sink);
+    }
+  }
+
+  /*! \brief Compiles the tree into a read-only image for sampling.
+   *
+   *  The image holds the nodes in one contiguous breadth-first array with the
+   * prior already added to their parameters, and `sample`, `sampleLanes` and
+   * `split` use it for as long as it is current. Sampling from the image gives
+   * identical outcomes to sampling from the nodes. Updating, merging or
+   * resetting the tree discards the image, as does changing the parameters,
+   * so `freeze` should be called again before the next run of samples. Does
+   * nothing if the image is already current.
+   *
+   * \return void
+   */
+  void freeze() {
+    if (!isFrozen())
+      frozen = std::make_shared<const typename NodeType::Frozen>(parameters,
+                                                                 root);
+  }
+
+  /*! \brief Indicates whether the tree is sampled from a frozen image.
+   *
+   * \return True if `freeze` has been called since the tree or its'
+   * parameters last changed.
+   */
+  bool isFrozen() const { return frozen && frozen->matches(parameters); }
+
   /*! \brief Sample possible full sets from the posterior.
    *
    *  Assuming we have been updating the Dirichlet-tree with observations
@@ -122,8 +351,75 @@ class DirichletTree {
   std::list<std::pair<Outcome, unsigned>> posteriorSet(
       unsigned N, bool replace, std::mt19937 *engine = nullptr);
 
+  /*! \brief Sample a possible full set from the posterior into a sink.
+   *
+   *  Equivalent to the list-returning overload, except that the observed
+   * outcomes and the new samples are passed to the sink as (outcome, count)
+   * pairs. Nothing is emitted if N is smaller than the number of observations.
+   *
+   * \param N The number of observations in the complete set.
+   *
+   * \param replacement A boolean indicating whether or not all draws should
+   * be re-sampled from the posterior predictive.
+   *
+   * \param ws A workspace for the nodes to sample with. Reusing a workspace
+   * between calls avoids any heap allocations while sampling.
+   *
+   * \param engine A PRNG for randomness, either a mt19937 or a Philox. A null
+   * mt19937 pointer selects the default engine.
+   *
+   * \param sink A callable invoked as `sink(outcome, count)`.
+   */
+  template <typename Engine, typename Sink>
+  void posteriorSet(unsigned N, bool replace, typename NodeType::Workspace &ws,
+                    Engine *engine, Sink &sink);
+
+  /*! \brief Sample the new outcomes of a possible full set from the posterior.
+   *
+   *  Equivalent to the sink overload of `posteriorSet`, except that the
+   * observed outcomes are not emitted when sampling without replacement. The
+   * observations are the same for every set, so callers which need many sets
+   * can process `getObserved()` once and only handle the new samples.
+   *
+   * \param N The number of observations in the complete set.
+   *
+   * \param replacement A boolean indicating whether or not all draws should
+   * be re-sampled from the posterior predictive.
+   *
+   * \param ws A workspace for the nodes to sample with.
+   *
+   * \param engine A PRNG for randomness, either a mt19937 or a Philox. A null
+   * mt19937 pointer selects the default engine.
+   *
+   * \param sink A callable invoked as `sink(outcome, count)`.
+   */
+  template <typename Engine, typename Sink>
+  void posteriorSetUnobserved(unsigned N, bool replace,
+                              typename NodeType::Workspace &ws, Engine *engine,
+                              Sink &sink);
+
   // Getters
 
+  /*! \brief Gets the observed outcomes.
+   *
+   * \return A store of each unique observed outcome and the number of times
+   * it has been observed, iterable as (outcome, count) pairs in order of first
+   * observation.
+   */
+  const ObservationStore<Outcome> &getObserved() const { return observed; }
+
+  /*! \brief Gets the total number of observed outcomes.
+   *
+   * \return The number of observations, counting repeats.
+   */
+  unsigned getNObserved() const { return nObserved; }
+
+  /*! \brief Gets the root node of the tree.
+   *
+   * \return A pointer to the root node.
+   */
+  const NodeType *getRoot() const { return root; }
+
   /*! \brief Get the PRNG engine.
    *
    *  Gets a pointer to the mt19937 PRNG.
@@ -160,20 +456,72 @@ template <typename NodeType, typename Outcome, typename Parameters>
 DirichletTree<NodeType, Outcome, Parameters>::DirichletTree(
     Parameters *parameters_, std::string seed) {
   parameters = parameters_;
+  observed = ObservationStore<Outcome>(parameters->exactOutcomeKeys());
 
   // Initialize the root node of the tree.
-  root = new NodeType(0, parameters);
+  arena = std::make_shared<Arena>();
+  root = arena->create<NodeType>(0, parameters, arena.get());
 
   // Initialize a default PRNG, seed it and warm it up.
   std::mt19937 engine{};
   setSeed(seed);
 }
 
+template <typename NodeType, typename Outcome, typename Parameters>
+DirichletTree<NodeType, Outcome, Parameters>::DirichletTree(
+    Parameters *parameters_, DirichletTree &other)
+    : arena(std::make_shared<Arena>(CLONE_SLAB_SIZE)),
+      sharedArenas(other.sharedArenas),
+      root(other.root),
+      parameters(parameters_),
+      nObserved(other.nObserved),
+      observed(other.observed.fork()),
+      engine(other.engine),
+      frozen(other.frozen) {}
+
+template <typename NodeType, typename Outcome, typename Parameters>
+DirichletTree<NodeType, Outcome, Parameters> *
+DirichletTree<NodeType, Outcome, Parameters>::clone(Parameters *parameters_) {
+  // Freeze the nodes of this tree by moving its' arena to the shared arenas.
+  // From now on, both trees copy a node into their own arena before updating
+  // it.
+  shareNodes();
+  return new DirichletTree(parameters_, *this);
+}
+
+template <typename NodeType, typename Outcome, typename Parameters>
+void DirichletTree<NodeType, Outcome, Parameters>::merge(DirichletTree &other) {
+  if (&other == this)
+    throw std::runtime_error("A tree cannot be merged with itself.");
+  if (!parameters->compatible(other.parameters))
+    throw std::runtime_error(
+        "Trees can only be merged if their parameters are the same.");
+
+  // Freeze the nodes of the other tree, and hold on to every arena which owns
+  // them.
+  other.shareNodes();
+  for (const auto &shared : other.sharedArenas)
+    if (std::find(sharedArenas.begin(), sharedArenas.end(), shared) ==
+        sharedArenas.end())
+      sharedArenas.push_back(shared);
+
+  for (const auto &[o, c] : other.observed)
+    observed.add(o, parameters->outcomeKey(o), c);
+  nObserved += other.nObserved;
+
+  frozen.reset();
+  Arena *owned = ownRoot();
+  root->merge(parameters, *other.root, owned);
+}
+
 template <typename NodeType, typename Outcome, typename Parameters>
 void DirichletTree<NodeType, Outcome, Parameters>::reset() {
-  // Replace the root node, calling the destructor of the old root after call.
-  delete root;
-  root = new NodeType(0, parameters);
+  // Rewind the arena, which releases every node at once, and replace the root.
+  // The shared nodes are released by the clones which still hold them.
+  frozen.reset();
+  sharedArenas.clear();
+  arena->reset();
+  root = arena->create<NodeType>(0, parameters, arena.get());
   // Destroy the observations list
   observed.clear();
   nObserved = 0;
@@ -182,55 +530,171 @@ void DirichletTree<NodeType, Outcome, Parameters>::reset() {
 template <typename NodeType, typename Outcome, typename Parameters>
 void DirichletTree<NodeType, Outcome, Parameters>::update(
     const std::pair<Outcome, unsigned> &oc) {
-  if (observed.count(oc.first) == 0) {
-    observed[oc.first] = oc.second;
+  observed.add(oc.first, parameters->outcomeKey(oc.first), oc.second);
+  nObserved += oc.second;
+  frozen.reset();
+  std::vector<unsigned> path = parameters->defaultPath();
+  Arena *owned = ownRoot();
+  root->update(parameters, oc.first, path, oc.second, owned);
+}
+
+template <typename NodeType, typename Outcome, typename Parameters>
+template <typename InputIt>
+void DirichletTree<NodeType, Outcome, Parameters>::update(InputIt first,
+                                                          InputIt last,
+                                                          unsigned nThreads) {
+  std::vector<const std::pair<Outcome, unsigned> *> sorted;
+  for (InputIt it = first; it != last; ++it) {
+    const std::pair<Outcome, unsigned> &oc = *it;
+    observed.add(oc.first, parameters->outcomeKey(oc.first), oc.second);
+    nObserved += oc.second;
+    sorted.push_back(&oc);
+  }
+  frozen.reset();
+  if (sorted.size() < PARALLEL_UPDATE_MIN) nThreads = 1;
+  auto less = [](const std::pair<Outcome, unsigned> *a,
+                 const std::pair<Outcome, unsigned> *b) {
+    return a->first < b->first;
+  };
+  if (nThreads <= 1) {
+    std::sort(sorted.begin(), sorted.end(), less);
   } else {
-    observed[oc.first] = observed[oc.first] + oc.second;
+    ThreadPool::global().parallelSort(sorted.begin(), sorted.end(), nThreads,
+                                      less);
   }
-  nObserved += oc.second;
+
   std::vector<unsigned> path = parameters->defaultPath();
-  root->update(oc.first, path, oc.second);
+  Arena *owned = ownRoot();
+  if (nThreads <= 1) {
+    root->update(parameters, sorted.data(), sorted.data() + sorted.size(),
+                 path, owned);
+    return;
+  }
+
+  // Split the batch into several tasks per thread so that the work can be
+  // balanced, and start with the largest tasks.
+  std::vector<typename NodeType::UpdateTask> tasks;
+  root->partition(parameters, sorted.data(), sorted.data() + sorted.size(),
+                  path, owned, sorted.size() / (4 * nThreads), tasks);
+  std::stable_sort(tasks.begin(), tasks.end(),
+                   [](const typename NodeType::UpdateTask &a,
+                      const typename NodeType::UpdateTask &b) {
+                     return a.last - a.first > b.last - b.first;
+                   });
+
+  // Each thread allocates from its' own arena on behalf of the tree's arena,
+  // which adopts their slabs once every task is done.
+  std::vector<std::unique_ptr<Arena>> arenas;
+  for (unsigned t = 0; t < nThreads; ++t)
+    arenas.push_back(std::make_unique<Arena>(arena->getSlabSize(), owned));
+  ThreadPool::global().parallelFor(
+      tasks.size(), nThreads, 1, [&](unsigned t, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i)
+          tasks[i].node->update(parameters, tasks[i].first, tasks[i].last,
+                                tasks[i].path, arenas[t].get());
+      });
+  for (auto &threadArena : arenas) owned->adopt(*threadArena);
 }
 
 template <typename NodeType, typename Outcome, typename Parameters>
-std::list<std::pair<Outcome, unsigned>>
-DirichletTree<NodeType, Outcome, Parameters>::sample(unsigned n,
-                                                     std::mt19937 *engine_) {
+template <typename Engine, typename Sink>
+void DirichletTree<NodeType, Outcome, Parameters>::sample(
+    unsigned n, typename NodeType::Workspace &ws, Engine *engine_,
+    Sink &sink) {
   // Use the default engine unless one is passed to the method.
-  if (engine_ == nullptr) {
-    engine_ = &engine;
+  if constexpr (std::is_same_v<Engine, std::mt19937>) {
+    if (engine_ == nullptr) engine_ = &engine;
   }
 
-  // Initialize output
-  std::vector<unsigned> path = parameters->defaultPath();
-  std::list<std::pair<Outcome, unsigned>> out = root->sample(n, path, engine_);
+  if (isFrozen()) {
+    frozen->sample(parameters, n, ws, engine_, sink);
+  } else {
+    root->sample(parameters, n, ws, engine_, sink);
+  }
+}
 
-  return out;
+template <typename NodeType, typename Outcome, typename Parameters>
+template <typename Engine, typename Sink>
+void DirichletTree<NodeType, Outcome, Parameters>::sampleLanes(
+    unsigned lanes, const unsigned *n, typename NodeType::LaneWorkspace &ws,
+    Engine *const *engines, Sink *const *sinks) {
+  if (isFrozen()) {
+    frozen->sampleLanes(parameters, lanes, n, ws, engines, sinks);
+  } else {
+    root->sampleLanes(parameters, lanes, n, ws, engines, sinks);
+  }
 }
 
 template <typename NodeType, typename Outcome, typename Parameters>
-DirichletTree<NodeType, Outcome, Parameters>::~DirichletTree() {
-  delete root;
+template <typename Engine, typename Sink>
+void DirichletTree<NodeType, Outcome, Parameters>::split(
+    unsigned n, unsigned splitDepth, typename NodeType::Workspace &ws,
+    Engine *engine_, Sink &sink, typename NodeType::Split &out) {
+  // Use the default engine unless one is passed to the method.
+  if constexpr (std::is_same_v<Engine, std::mt19937>) {
+    if (engine_ == nullptr) engine_ = &engine;
+  }
+
+  out.clear();
+  if (isFrozen()) {
+    frozen->split(parameters, n, splitDepth, ws, engine_, sink, out);
+  } else {
+    root->split(parameters, n, splitDepth, ws, engine_, sink, out);
+  }
+
+  // The streams of the tasks are keyed by the engine, after the split.
+  uint64_t hi = (*engine_)();
+  out.key = hi << 32 | static_cast<uint32_t>((*engine_)());
 }
 
 template <typename NodeType, typename Outcome, typename Parameters>
 std::list<std::pair<Outcome, unsigned>>
-DirichletTree<NodeType, Outcome, Parameters>::posteriorSet(
-    unsigned N, bool replace, std::mt19937 *engine) {
+DirichletTree<NodeType, Outcome, Parameters>::sample(unsigned n,
+                                                     std::mt19937 *engine_) {
+  std::list<std::pair<Outcome, unsigned>> out{};
+  auto sink = [&out](const Outcome &o, unsigned c) { out.emplace_back(o, c); };
+  typename NodeType::Workspace ws(parameters);
+  sample(n, ws, engine_, sink);
+  return out;
+}
+
+template <typename NodeType, typename Outcome, typename Parameters>
+template <typename Engine, typename Sink>
+void DirichletTree<NodeType, Outcome, Parameters>::posteriorSet(
+    unsigned N, bool replace, typename NodeType::Workspace &ws,
+    Engine *engine, Sink &sink) {
+  // Emit the observed data (when sampling without replacement), followed by
+  // the new samples. Nothing is emitted in the invalid case.
+  if (!replace && nObserved <= N)
+    for (const auto &[o, c] : observed) sink(o, c);
+  posteriorSetUnobserved(N, replace, ws, engine, sink);
+}
+
+template <typename NodeType, typename Outcome, typename Parameters>
+template <typename Engine, typename Sink>
+void DirichletTree<NodeType, Outcome, Parameters>::posteriorSetUnobserved(
+    unsigned N, bool replace, typename NodeType::Workspace &ws,
+    Engine *engine, Sink &sink) {
   // Handle the sampling with replacement case first.
   if (replace) {
-    return sample(N, engine);
+    sample(N, ws, engine, sink);
+    return;
   }
 
-  // Handle invalid case by returning empty list.
-  if (nObserved > N) return {};
+  // Handle invalid case by emitting nothing.
+  if (nObserved > N) return;
 
-  // Initialize output by copying observed data.
-  std::list<std::pair<Outcome, unsigned>> out(observed.begin(), observed.end());
-
-  // Then sample new outcomes and add them to the end of the list.
-  out.splice(out.end(), sample(N - nObserved, engine));
+  sample(N - nObserved, ws, engine, sink);
+}
 
+template <typename NodeType, typename Outcome, typename Parameters>
+std::list<std::pair<Outcome, unsigned>>
+DirichletTree<NodeType, Outcome, Parameters>::posteriorSet(
+    unsigned N, bool replace, std::mt19937 *engine) {
+  std::list<std::pair<Outcome, unsigned>> out{};
+  auto sink = [&out](const Outcome &o, unsigned c) { out.emplace_back(o, c); };
+  typename NodeType::Workspace ws(parameters);
+  posteriorSet(N, replace, ws, engine, sink);
   return out;
 }
 
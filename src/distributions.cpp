@@ -9,76 +9,564 @@
 
 #include "distributions.h"
 
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+
+namespace {
+
+/*! \brief Draws a uniform variate on the open interval (0, 1).
+ *
+ * \param engine A PRNG for sampling.
+ *
+ * \return A uniform variate with 32 bits of resolution.
+ */
+template <typename Engine>
+inline double uniform01(Engine *engine) {
+  return ((*engine)() + 0.5) * 0x1p-32;
+}
+
+/*! \brief Draws a uniform variate on [0, 1) with full double precision.
+ *
+ * \param engine A PRNG for sampling.
+ *
+ * \return A uniform variate with 53 bits of resolution.
+ */
+template <typename Engine>
+inline double uniform53(Engine *engine) {
+  uint64_t hi = (*engine)() >> 5;
+  uint64_t lo = (*engine)() >> 6;
+  return (hi * 67108864. + lo) * 0x1p-53;
+}
+
+// The tables for a 128-layer Ziggurat sampler of the standard normal
+// distribution (Marsaglia and Tsang, 2000).
+struct NormalZiggurat {
+  // The right-most layer boundary and the area of each layer.
+  static constexpr double R = 3.442619855899;
+  static constexpr double V = 9.91256303526217e-3;
+
+  // Acceptance thresholds for the 31-bit magnitude of the sampled integer.
+  uint32_t k[128];
+  // The scale from the sampled integer to the x-coordinate of each layer.
+  double w[128];
+  // The density at the boundary of each layer.
+  double f[128];
+
+  NormalZiggurat() {
+    const double m = 2147483648.;  // 2^31
+    double dn = R, tn = R;
+    double q = V / std::exp(-.5 * dn * dn);
+    k[0] = static_cast<uint32_t>((dn / q) * m);
+    k[1] = 0;
+    w[0] = q / m;
+    w[127] = dn / m;
+    f[0] = 1.;
+    f[127] = std::exp(-.5 * dn * dn);
+    for (int i = 126; i >= 1; --i) {
+      dn = std::sqrt(-2. * std::log(V / dn + std::exp(-.5 * dn * dn)));
+      k[i + 1] = static_cast<uint32_t>((dn / tn) * m);
+      tn = dn;
+      f[i] = std::exp(-.5 * dn * dn);
+      w[i] = dn / m;
+    }
+  }
+};
+
+const NormalZiggurat ZIGGURAT{};
+
+/*! \brief Draws a standard normal variate.
+ *
+ *  Uses the Ziggurat method. The layer is chosen with a separate draw from the
+ * value, which avoids the correlation between the two in the original
+ * single-draw formulation.
+ *
+ * \param engine A PRNG for sampling.
+ *
+ * \return A sample from N(0, 1).
+ */
+template <typename Engine>
+inline double rNormal(Engine *engine) {
+  const NormalZiggurat &z = ZIGGURAT;
+  for (;;) {
+    int32_t hz = static_cast<int32_t>((*engine)());
+    unsigned iz = (*engine)() & 127;
+    uint32_t magnitude = hz < 0 ? 0u - static_cast<uint32_t>(hz) : hz;
+    double x = hz * z.w[iz];
+    // The fast path, which accepts ~99% of draws.
+    if (magnitude < z.k[iz]) return x;
+    if (iz == 0) {
+      // Sample from the tail beyond R.
+      double xt, y;
+      do {
+        xt = -std::log(uniform01(engine)) / NormalZiggurat::R;
+        y = -std::log(uniform01(engine));
+      } while (y + y < xt * xt);
+      return hz > 0 ? NormalZiggurat::R + xt : -NormalZiggurat::R - xt;
+    }
+    // Otherwise accept or reject the point in the wedge of the layer.
+    if (z.f[iz] + uniform01(engine) * (z.f[iz - 1] - z.f[iz]) <
+        std::exp(-.5 * x * x))
+      return x;
+  }
+}
+
+/*! \brief A Gamma(shape, 1) sampler with precomputed constants.
+ *
+ *  Uses the method of Marsaglia and Tsang (2000). Shapes below 1 are boosted
+ * by sampling Gamma(shape + 1) and multiplying by U^(1 / shape). A
+ * non-positive shape yields a degenerate distribution at zero.
+ */
+struct GammaSampler {
+  double shape;
+  // Whether the shape is boosted by 1, and the exponent for the boost.
+  bool boost;
+  double invShape;
+  // The constants d = shape - 1/3 and c = 1 / sqrt(9d) for the boosted shape.
+  double d;
+  double c;
+
+  explicit GammaSampler(double shape_) : shape(shape_) {
+    boost = shape < 1.;
+    invShape = 1. / shape;
+    d = (boost ? shape + 1. : shape) - 1. / 3.;
+    c = 1. / std::sqrt(9. * d);
+  }
+
+  template <typename Engine>
+  inline double operator()(Engine *engine) const {
+    if (!(shape > 0.)) return 0.;
+    double x, v, u, x2;
+    for (;;) {
+      do {
+        x = rNormal(engine);
+        v = 1. + c * x;
+      } while (v <= 0.);
+      v = v * v * v;
+      u = uniform01(engine);
+      x2 = x * x;
+      // The squeeze accepts most draws without evaluating a logarithm.
+      if (u < 1. - 0.0331 * x2 * x2) break;
+      if (std::log(u) < 0.5 * x2 + d * (1. - v + std::log(v))) break;
+    }
+    if (boost) return d * v * std::exp(std::log(uniform01(engine)) * invShape);
+    return d * v;
+  }
+};
+
+/*! \brief A Binomial(n, p) sampler.
+ *
+ *  Uses inversion by sequential search when the mean is small, and otherwise
+ * the BTPE algorithm of Kachitvichyanukul and Schmeiser (1988), which has a
+ * constant expected cost regardless of n.
+ */
+class BinomialSampler {
+ private:
+  // The parameters of the sampler. `r` is min(p, 1 - p), and `flip`
+  // indicates whether samples must be reflected as n - y.
+  unsigned n;
+  double p;
+  double r, q;
+  bool flip;
+  bool btpe;
+
+  // Constants for inversion.
+  double qn, s, a;
+  unsigned bound;
+
+  // Constants for BTPE.
+  long m;
+  double nrq, fm, p1, xm, xl, xr, c, laml, lamr, p2, p3, p4;
+
+  // Computes the constants for the parameters.
+  void setup() {
+    flip = p > 0.5;
+    r = flip ? 1. - p : p;
+    q = 1. - r;
+    s = r / q;
+    a = (n + 1) * s;
+    btpe = n * r >= 30.;
+    if (!btpe) {
+      qn = std::exp(n * std::log1p(-r));
+      double np = n * r;
+      bound = static_cast<unsigned>(
+          std::min<double>(n, np + 10. * std::sqrt(np * q + 1.)));
+      return;
+    }
+    nrq = n * r * q;
+    fm = n * r + r;
+    m = static_cast<long>(std::floor(fm));
+    p1 = std::floor(2.195 * std::sqrt(nrq) - 4.6 * q) + 0.5;
+    xm = m + 0.5;
+    xl = xm - p1;
+    xr = xm + p1;
+    c = 0.134 + 20.5 / (15.3 + m);
+    double al = (fm - xl) / (fm - xl * r);
+    laml = al * (1. + al / 2.);
+    double ar = (xr - fm) / (xr * q);
+    lamr = ar * (1. + ar / 2.);
+    p2 = p1 * (1. + 2. * c);
+    p3 = p2 + c / laml;
+    p4 = p3 + c / lamr;
+  }
+
+  template <typename Engine>
+  unsigned inversion(Engine *engine) const {
+    unsigned x = 0;
+    double px = qn;
+    double u = uniform53(engine);
+    while (u > px) {
+      ++x;
+      if (x > bound) {
+        // Restart if the search runs past the bound due to rounding.
+        x = 0;
+        px = qn;
+        u = uniform53(engine);
+      } else {
+        u -= px;
+        px *= a / x - s;
+      }
+    }
+    return x;
+  }
+
+  // Returns true if log(v) lies below the log of the ratio f(y) / f(m) of
+  // binomial probabilities, using the squeeze and Stirling approximations.
+  bool accept(long y, double v) const {
+    long k = std::labs(y - m);
+    if (k <= 20 || k >= nrq / 2. - 1.) {
+      // Evaluate f(y) / f(m) explicitly using the recurrence.
+      double f = 1.;
+      if (m < y) {
+        for (long i = m + 1; i <= y; ++i) f *= a / i - s;
+      } else if (m > y) {
+        for (long i = y + 1; i <= m; ++i) f /= a / i - s;
+      }
+      return v <= f;
+    }
+    double rho =
+        (k / nrq) * ((k * (k / 3. + 0.625) + 0.16666666666666666) / nrq + 0.5);
+    double t = -static_cast<double>(k) * k / (2. * nrq);
+    double A = std::log(v);
+    if (A < t - rho) return true;
+    if (A > t + rho) return false;
+    double x1 = y + 1., f1 = m + 1., z = n + 1. - m, w = n - y + 1.;
+    double x2 = x1 * x1, f2 = f1 * f1, z2 = z * z, w2 = w * w;
+    auto stirling = [](double x, double xx) {
+      return (13680. - (462. - (132. - (99. - 140. / xx) / xx) / xx) / xx) /
+             x / 166320.;
+    };
+    double bound = xm * std::log(f1 / x1) + (n - m + 0.5) * std::log(z / w) +
+                   (y - m) * std::log(w * r / (x1 * q)) + stirling(f1, f2) +
+                   stirling(z, z2) + stirling(x1, x2) + stirling(w, w2);
+    return A <= bound;
+  }
+
+  template <typename Engine>
+  unsigned btpeSample(Engine *engine) const {
+    for (;;) {
+      double u = uniform53(engine) * p4;
+      double v = uniform53(engine);
+      long y;
+      if (u <= p1) {
+        // The triangular region, which is accepted immediately.
+        return static_cast<unsigned>(std::floor(xm - p1 * v + u));
+      } else if (u <= p2) {
+        // The parallelograms.
+        double x = xl + (u - p1) / c;
+        v = v * c + 1. - std::fabs(m - x + 0.5) / p1;
+        if (v > 1.) continue;
+        y = static_cast<long>(std::floor(x));
+      } else if (u <= p3) {
+        // The left exponential tail.
+        if (v == 0.) continue;
+        y = static_cast<long>(std::floor(xl + std::log(v) / laml));
+        if (y < 0) continue;
+        v = v * (u - p2) * laml;
+      } else {
+        // The right exponential tail.
+        if (v == 0.) continue;
+        y = static_cast<long>(std::floor(xr - std::log(v) / lamr));
+        if (y > static_cast<long>(n)) continue;
+        v = v * (u - p3) * lamr;
+      }
+      if (accept(y, v)) return static_cast<unsigned>(y);
+    }
+  }
+
+ public:
+  /*! \brief Constructs a sampler for Binomial(n, p).
+   *
+   * \param n_ The number of trials, which must be positive.
+   *
+   * \param p_ The success probability, in (0, 1).
+   *
+   * \return A sampler with its' constants computed.
+   */
+  BinomialSampler(unsigned n_, double p_) : n(n_), p(p_) { setup(); }
+
+  /*! \brief Draws a sample from Binomial(n, p).
+   *
+   * \param engine A PRNG for sampling.
+   *
+   * \return The number of successes.
+   */
+  template <typename Engine>
+  unsigned operator()(Engine *engine) const {
+    unsigned y = btpe ? btpeSample(engine) : inversion(engine);
+    return flip ? n - y : y;
+  }
+};
+
+}  // namespace
+
 std::vector<unsigned> rDirichletMultinomial(const unsigned &N,
                                             const std::vector<double> &a,
                                             std::mt19937 *engine) {
-  // Draw p ~ Dirichlet(a)
-  std::vector<double> p = rDirichlet(a, engine);
-  // Draw out ~ Multinomial(p)
-  return rMultinomial(N, p, engine);
+  std::vector<unsigned> out(a.size());
+  std::vector<double> scratch(a.size());
+  rDirichletMultinomial(N, a.data(), a.size(), out.data(), scratch.data(),
+                        engine);
+  return out;
 }
 
 std::vector<unsigned> rMultinomial(const unsigned &N,
                                    const std::vector<double> &p,
                                    std::mt19937 *engine) {
-  size_t d = p.size();
   std::vector<unsigned> out(p.size());
+  rMultinomial(N, p.data(), p.size(), out.data(), engine);
+  return out;
+}
 
+std::vector<double> rDirichlet(const std::vector<double> &a,
+                               std::mt19937 *engine) {
+  std::vector<double> out(a.size());
+  rDirichlet(a.data(), a.size(), out.data(), engine);
+  return out;
+}
+
+/*! \brief Normalises independent gamma variates into a Dirichlet sample.
+ *
+ * \param d The number of variates.
+ *
+ * \param out The gamma variates, which are replaced by the probabilities.
+ *
+ * \param engine A PRNG, used only if every variate is zero.
+ */
+template <typename Engine>
+inline void normaliseGammas(unsigned d, double *out, Engine *engine) {
+  double gamma_sum = 0.;
+  for (unsigned i = 0; i < d; ++i) gamma_sum += out[i];
+
+  // Edge case where all gammas are zero.
+  if (gamma_sum == 0.) {
+    // Choose index i uniformly at random to have p_i=1, and set all others to
+    // p_j=0.
+    unsigned idx = rUniformIndex(d, engine);
+    for (unsigned i = 0; i < d; ++i) out[i] = 0.;
+    out[idx] = 1.;
+    return;
+  }
+
+  // Otherwise normalize the gamma variates.
+  double norm = 1. / gamma_sum;
+  for (unsigned i = 0; i < d; ++i) out[i] *= norm;
+}
+
+template <typename Engine>
+void rDirichletMultinomial(unsigned N, const double *a, unsigned d,
+                           unsigned *out, double *scratch,
+                           Engine *engine) {
+  rDirichletMultinomial(N, 0., a, d, out, scratch, engine);
+}
+
+template <typename Engine>
+void rDirichletMultinomial(unsigned N, double a0, const double *as, unsigned d,
+                           unsigned *out, double *scratch,
+                           Engine *engine) {
+  // The urn needs O(N d) additions but no gamma or binomial variates, so it is
+  // cheapest for the small counts deep in the tree. The crossover with the
+  // full method is at roughly N = 2.5d.
+  if (2 * N <= 5 * d)
+    rDirichletMultinomialUrn(N, a0, as, d, out, scratch, engine);
+  else
+    rDirichletMultinomialFull(N, a0, as, d, out, scratch, engine);
+}
+
+template <typename Engine>
+void rDirichletMultinomialFull(unsigned N, double a0, const double *as,
+                               unsigned d, unsigned *out, double *scratch,
+                               Engine *engine) {
+  // Draw p ~ Dirichlet(a0 + as)
+  rDirichlet(a0, as, d, scratch, engine);
+  // Draw out ~ Multinomial(p)
+  rMultinomial(N, scratch, d, out, engine);
+}
+
+template <typename Engine>
+void rDirichletMultinomialUrn(unsigned N, double a0, const double *as,
+                              unsigned d, unsigned *out, double *scratch,
+                              Engine *engine) {
+  // The urn starts with weight a0 + as[i] for each category, and each draw
+  // adds one to the weight of the category drawn.
+  double total = 0.;
+  for (unsigned i = 0; i < d; ++i) {
+    scratch[i] = as == nullptr ? a0 : a0 + as[i];
+    total += scratch[i];
+    out[i] = 0;
+  }
+  // Edge case where all parameters are zero, handled as in rDirichlet.
+  if (total == 0.) {
+    out[rUniformIndex(d, engine)] = N;
+    return;
+  }
+  for (unsigned n = 0; n < N; ++n) {
+    double u = uniform53(engine) * total;
+    // Fall back to the last positive category if rounding leaves u past the
+    // final cumulative weight.
+    unsigned k = d - 1;
+    while (scratch[k] <= 0. && k > 0) --k;
+    for (unsigned i = 0; i < k; ++i) {
+      if (u < scratch[i]) {
+        k = i;
+        break;
+      }
+      u -= scratch[i];
+    }
+    ++out[k];
+    scratch[k] += 1.;
+    total += 1.;
+  }
+}
+
+template <typename Engine>
+void rDirichletMultinomialLanes(unsigned lanes, const unsigned *N, double a0,
+                                const double *as, unsigned d, unsigned *out,
+                                double *scratch, Engine *const *engines) {
+  // The shapes are computed once for every lane, and the final row of each
+  // buffer holds a single lane while it is sampled.
+  double *lane = scratch + lanes * d;
+  unsigned *laneOut = out + lanes * d;
+  for (unsigned i = 0; i < d; ++i) lane[i] = as == nullptr ? a0 : a0 + as[i];
+
+  // The lanes which use the full method draw their gamma variates category
+  // by category, so the sampler constants for each shape are shared between
+  // the lanes. Each lane still draws its' variates in category order.
+  bool anyFull = false;
+  for (unsigned k = 0; k < lanes; ++k)
+    anyFull = anyFull || (N[k] > 0 && 2 * N[k] > 5 * d);
+  if (anyFull) {
+    GammaSampler g(lane[0]);
+    for (unsigned i = 0; i < d; ++i) {
+      if (lane[i] != g.shape) g = GammaSampler(lane[i]);
+      double *row = scratch + i * lanes;
+      for (unsigned k = 0; k < lanes; ++k)
+        if (N[k] > 0 && 2 * N[k] > 5 * d) row[k] = g(engines[k]);
+    }
+  }
+
+  for (unsigned k = 0; k < lanes; ++k) {
+    if (N[k] == 0) {
+      for (unsigned i = 0; i < d; ++i) out[i * lanes + k] = 0;
+      continue;
+    }
+    if (2 * N[k] > 5 * d) {
+      for (unsigned i = 0; i < d; ++i) lane[i] = scratch[i * lanes + k];
+      normaliseGammas(d, lane, engines[k]);
+      rMultinomial(N[k], lane, d, laneOut, engines[k]);
+    } else {
+      rDirichletMultinomialUrn(N[k], a0, as, d, laneOut, lane, engines[k]);
+    }
+    for (unsigned i = 0; i < d; ++i) out[i * lanes + k] = laneOut[i];
+  }
+}
+
+template <typename Engine>
+void rMultinomial(unsigned N, const double *p, unsigned d, unsigned *out,
+                  Engine *engine) {
   // norm is necessary because floating point precision does not often allow
   // the probabilities p to sum to exactly 1.0f.
   double norm = 0.0;
   for (size_t i = 0; i < d; ++i) norm += p[i];
 
-  // Draw from Multinomial(N, p)
+  // Draw from Multinomial(N, p) using binomial marginals.
   double sum_ps = 0.0;
-  double pnorm;
   unsigned n = N;
   for (size_t i = 0; i < d; ++i) {
-    if (norm - (sum_ps + p[i]) == 0.0) {
-      // First check if this is the last positive p.
+    if (n == 0 || norm - (sum_ps + p[i]) == 0.0) {
+      // Either every sample has been allocated, or this is the last positive
+      // p, so the remaining counts are determined.
       out[i] = n;
       for (size_t j = i + 1; j < d; ++j) out[j] = 0;
       break;
-    } else {
-      // Otherwise continue to draw using binomial marginals
-      pnorm = p[i] / (norm - sum_ps);
-      std::binomial_distribution<unsigned> b(n, pnorm);
-      out[i] = b(*engine);
-      n -= out[i];
-      // Normalise remaining ps.
-      sum_ps += p[i];
     }
+    out[i] = rBinomial(n, p[i] / (norm - sum_ps), engine);
+    n -= out[i];
+    // Normalise remaining ps.
+    sum_ps += p[i];
   }
-  return out;
 }
 
-std::vector<double> rDirichlet(const std::vector<double> &a,
-                               std::mt19937 *engine) {
-  unsigned d = a.size();
-  std::vector<double> gamma(d);
-  double gamma_sum = 0.;
+template <typename Engine>
+unsigned rBinomial(unsigned n, double p, Engine *engine) {
+  if (n == 0 || p <= 0.) return 0;
+  if (p >= 1.) return n;
+  return BinomialSampler(n, p)(engine);
+}
 
-  // Sample the gamma variates for category i.
-  for (size_t i = 0; i < d; ++i) {
-    std::gamma_distribution<double> g(a[i]);
-    gamma[i] = g(*engine);
-    gamma_sum += gamma[i];
-  }
+template <typename Engine>
+void rDirichlet(const double *a, unsigned d, double *out,
+                Engine *engine) {
+  rDirichlet(0., a, d, out, engine);
+}
 
-  // Edge case where all gammas are zero.
-  if (gamma_sum == 0.) {
-    // Choose index i uniformly at random to have p_i=1, and set all others to
-    // p_j=0.
-    std::uniform_int_distribution<unsigned> rint(0, d - 1);
-    unsigned idx = rint(*engine);
-    for (size_t i = 0; i < d; ++i) gamma[i] = 0.;
-    gamma[idx] = 1.;
-    return gamma;
+template <typename Engine>
+void rDirichlet(double a0, const double *as, unsigned d, double *out,
+                Engine *engine) {
+  if (as == nullptr) {
+    // Every category has the same shape, so the constants for the gamma
+    // sampler only need to be computed once.
+    GammaSampler g(a0);
+    for (unsigned i = 0; i < d; ++i) out[i] = g(engine);
+  } else {
+    // Compute the shapes in a separate (vectorisable) pass, then draw each
+    // gamma variate in place. Runs of equal shapes are common since unobserved
+    // children only have the prior parameter, so we only recompute the
+    // sampler constants when the shape changes.
+    for (unsigned i = 0; i < d; ++i) out[i] = a0 + as[i];
+    GammaSampler g(out[0]);
+    for (unsigned i = 0; i < d; ++i) {
+      if (out[i] != g.shape) g = GammaSampler(out[i]);
+      out[i] = g(engine);
+    }
   }
 
-  // Otherwise normalize the gamma variates and return.
-  for (size_t i = 0; i < d; ++i) {
-    gamma[i] = gamma[i] / gamma_sum;
-  }
-  return gamma;
+  normaliseGammas(d, out, engine);
 }
+
+// Explicit instantiations for the supported PRNGs.
+#define INSTANTIATE_DISTRIBUTIONS(Engine)                                     \
+  template void rDirichletMultinomial(unsigned, const double *, unsigned,     \
+                                      unsigned *, double *, Engine *);        \
+  template void rDirichletMultinomial(unsigned, double, const double *,       \
+                                      unsigned, unsigned *, double *,         \
+                                      Engine *);                              \
+  template void rDirichletMultinomialFull(unsigned, double, const double *,   \
+                                          unsigned, unsigned *, double *,     \
+                                          Engine *);                          \
+  template void rDirichletMultinomialUrn(unsigned, double, const double *,    \
+                                         unsigned, unsigned *, double *,      \
+                                         Engine *);                           \
+  template void rDirichletMultinomialLanes(unsigned, const unsigned *,        \
+                                           double, const double *, unsigned,  \
+                                           unsigned *, double *,              \
+                                           Engine *const *);                  \
+  template void rMultinomial(unsigned, const double *, unsigned, unsigned *,  \
+                             Engine *);                                       \
+  template unsigned rBinomial(unsigned, double, Engine *);                    \
+  template void rDirichlet(const double *, unsigned, double *, Engine *);     \
+  template void rDirichlet(double, const double *, unsigned, double *,        \
+                           Engine *);
+
+INSTANTIATE_DISTRIBUTIONS(std::mt19937)
+INSTANTIATE_DISTRIBUTIONS(Philox)
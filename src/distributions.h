@@ -11,9 +11,12 @@
 #define DISTRIBUTIONS_H
 
 #include <algorithm>
+#include <cstdint>
 #include <random>
 #include <vector>
 
+#include "philox.h"
+
 /*! \brief Draws a sample from a Dirichlet Multinomial distribution.
  *
  *  Given the count, `a` parameters and dimension of the distribution, this
@@ -66,4 +69,217 @@ std::vector<unsigned> rMultinomial(const unsigned &N,
 std::vector<double> rDirichlet(const std::vector<double> &a,
                                std::mt19937 *engine);
 
+// The allocation-free kernels below are templated on the PRNG, and are
+// instantiated in distributions.cpp for std::mt19937 and Philox.
+
+/*! \brief Draws a sample from a Dirichlet Multinomial distribution into a
+ * caller-supplied buffer.
+ *
+ *  Equivalent to the vector overload, but performs no heap allocations.
+ *
+ * \param N The total number of multinomial samples.
+ *
+ * \param a The `a` parameter to the Dirichlet distribution, of length d.
+ *
+ * \param d The dimension of the distribution.
+ *
+ * \param out The buffer of length d to write the sampled counts to.
+ *
+ * \param scratch A buffer of length d used for the intermediate Dirichlet
+ * probabilities.
+ *
+ * \param engine A PRNG for sampling.
+ */
+template <typename Engine>
+void rDirichletMultinomial(unsigned N, const double *a, unsigned d,
+                           unsigned *out, double *scratch,
+                           Engine *engine);
+
+/*! \brief Draws a sample from a Dirichlet Multinomial distribution with
+ * parameters a0 + as.
+ *
+ *  This is the form of the posterior at each node of a Dirichlet-tree, so the
+ * parameters do not need to be copied into a separate buffer first. The
+ * sampling method is chosen based on N and d: a Polya urn for small counts,
+ * and otherwise a Dirichlet sample followed by a Multinomial sample.
+ *
+ * \param N The total number of multinomial samples.
+ *
+ * \param a0 The prior parameter added to every category.
+ *
+ * \param as The observed counts for each category, of length d, or nullptr if
+ * every category has parameter a0.
+ *
+ * \param d The dimension of the distribution.
+ *
+ * \param out The buffer of length d to write the sampled counts to.
+ *
+ * \param scratch A buffer of length d used for the intermediate Dirichlet
+ * probabilities.
+ *
+ * \param engine A PRNG for sampling.
+ */
+template <typename Engine>
+void rDirichletMultinomial(unsigned N, double a0, const double *as, unsigned d,
+                           unsigned *out, double *scratch,
+                           Engine *engine);
+
+/*! \brief Draws a Dirichlet Multinomial sample via a Dirichlet sample.
+ *
+ *  Draws the category probabilities from Dirichlet(a0 + as), then the counts
+ * from a Multinomial distribution. The cost is dominated by the d gamma
+ * variates, regardless of N. The arguments are as for rDirichletMultinomial.
+ */
+template <typename Engine>
+void rDirichletMultinomialFull(unsigned N, double a0, const double *as,
+                               unsigned d, unsigned *out, double *scratch,
+                               Engine *engine);
+
+/*! \brief Draws a Dirichlet Multinomial sample via a Polya urn.
+ *
+ *  Draws the N samples one at a time, each time adding the sampled category
+ * back to the urn. This needs only N uniform variates, so it is cheapest when
+ * N is small relative to d. The arguments are as for rDirichletMultinomial,
+ * and `scratch` holds the urn weights.
+ */
+template <typename Engine>
+void rDirichletMultinomialUrn(unsigned N, double a0, const double *as,
+                              unsigned d, unsigned *out, double *scratch,
+                              Engine *engine);
+
+/*! \brief Draws Dirichlet Multinomial samples with parameters a0 + as for
+ * several independent lanes at once.
+ *
+ *  Each lane draws from its' own engine, and receives exactly the counts that
+ * rDirichletMultinomial would give it with the same engine, except that a
+ * lane with no samples draws nothing. Sampling the lanes together means that
+ * the parameters are read, and the gamma sampler constants computed, once for
+ * all of the lanes.
+ *
+ * \param lanes The number of lanes.
+ *
+ * \param N The total number of multinomial samples for each lane.
+ *
+ * \param a0 The prior parameter added to every category.
+ *
+ * \param as The observed counts for each category, of length d, or nullptr if
+ * every category has parameter a0.
+ *
+ * \param d The dimension of the distribution.
+ *
+ * \param out A buffer of (lanes + 1) * d elements. The count of category i in
+ * lane k is written to `out[i * lanes + k]`, and the final d elements are
+ * used as scratch.
+ *
+ * \param scratch A buffer of (lanes + 1) * d elements.
+ *
+ * \param engines A PRNG for each lane.
+ */
+template <typename Engine>
+void rDirichletMultinomialLanes(unsigned lanes, const unsigned *N, double a0,
+                                const double *as, unsigned d, unsigned *out,
+                                double *scratch, Engine *const *engines);
+
+/*! \brief Draws a sample from a Multinomial distribution into a
+ * caller-supplied buffer.
+ *
+ *  Equivalent to the vector overload, but performs no heap allocations.
+ *
+ * \param N The total number of Multinomial samples.
+ *
+ * \param p The category probabilities, of length d.
+ *
+ * \param d The number of categories.
+ *
+ * \param out The buffer of length d to write the sampled counts to.
+ *
+ * \param engine A PRNG for sampling.
+ */
+template <typename Engine>
+void rMultinomial(unsigned N, const double *p, unsigned d, unsigned *out,
+                  Engine *engine);
+
+/*! \brief Draws a sample from a Dirichlet distribution into a caller-supplied
+ * buffer.
+ *
+ *  Equivalent to the vector overload, but performs no heap allocations.
+ *
+ * \param a The a parameter to the Dirichlet distribution, of length d.
+ *
+ * \param d The dimension of a.
+ *
+ * \param out The buffer of length d to write the sampled probabilities to.
+ *
+ * \param *engine A PRNG for sampling.
+ */
+template <typename Engine>
+void rDirichlet(const double *a, unsigned d, double *out, Engine *engine);
+
+/*! \brief Draws a sample from a Binomial distribution.
+ *
+ *  Uses inversion when the mean is small and the BTPE algorithm otherwise, so
+ * the cost does not grow with the number of trials.
+ *
+ * \param n The number of trials.
+ *
+ * \param p The success probability.
+ *
+ * \param engine A PRNG for sampling.
+ *
+ * \return The number of successes.
+ */
+template <typename Engine>
+unsigned rBinomial(unsigned n, double p, Engine *engine);
+
+/*! \brief Draws a sample from a Dirichlet distribution with parameters
+ * a0 + as into a caller-supplied buffer.
+ *
+ *  All of the gamma variates are drawn in one batch using the method of
+ * Marsaglia and Tsang, so the output stream does not depend on the standard
+ * library implementation. When `as` is nullptr the distribution is symmetric
+ * and the sampler constants are computed only once.
+ *
+ * \param a0 The prior parameter added to every category.
+ *
+ * \param as The observed counts for each category, of length d, or nullptr if
+ * every category has parameter a0.
+ *
+ * \param d The dimension of the distribution.
+ *
+ * \param out The buffer of length d to write the sampled probabilities to.
+ *
+ * \param *engine A PRNG for sampling.
+ */
+template <typename Engine>
+void rDirichlet(double a0, const double *as, unsigned d, double *out,
+                Engine *engine);
+
+/*! \brief Draws a uniformly distributed index.
+ *
+ *  Uses Lemire's nearly divisionless method, which is unbiased and, unlike
+ * std::uniform_int_distribution, gives the same result on every platform.
+ *
+ * \param n The number of possible indices.
+ *
+ * \param engine A PRNG producing 32-bit outputs.
+ *
+ * \return An index in [0, n).
+ */
+template <typename Engine>
+unsigned rUniformIndex(unsigned n, Engine *engine);
+
+template <typename Engine>
+unsigned rUniformIndex(unsigned n, Engine *engine) {
+  uint64_t m = static_cast<uint64_t>((*engine)()) * n;
+  uint32_t low = static_cast<uint32_t>(m);
+  if (low < n) {
+    uint32_t threshold = (0u - n) % n;
+    while (low < threshold) {
+      m = static_cast<uint64_t>((*engine)()) * n;
+      low = static_cast<uint32_t>(m);
+    }
+  }
+  return static_cast<unsigned>(m >> 32);
+}
+
 #endif /* DISTRIBUTIONS_H */
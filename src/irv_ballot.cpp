@@ -9,130 +9,268 @@
 
 #include "irv_ballot.h"
 
-IRVBallot::IRVBallot(std::list<unsigned> preferences_) {
-  preferences = std::move(preferences_);
-}
+#include <atomic>
+#include <bitset>
+#include <cstring>
+
+#include "distributions.h"
 
 bool IRVBallot::eliminateFirstPref() {
-  preferences.pop_front();
+  --length;
+  std::memmove(preferences, preferences + 1, length);
   // Return whether or not the ballot is empty.
-  if (nPreferences() == 0) {
-    return true;
-  } else {
-    return false;
-  }
+  return length == 0;
 }
 
-bool IRVBallot::operator==(const IRVBallot &b) {
-  // First check the number of specified candidates is equal.
-  if (!(nPreferences() == b.nPreferences())) {
-    return false;
-  }
-  // Then check each preference to ensure they are equal.
-  return std::equal(preferences.begin(), preferences.end(),
-                    b.preferences.begin());
+bool IRVBallot::operator==(const IRVBallot &b) const {
+  // First check the number of specified candidates is equal, then check each
+  // preference to ensure they are equal.
+  return length == b.length &&
+         std::memcmp(preferences, b.preferences, length) == 0;
 }
 
 bool IRVBallot::operator<(const IRVBallot &b) const {
-  return std::lexicographical_compare(preferences.begin(), preferences.end(),
-                                      b.preferences.begin(),
-                                      b.preferences.end());
+  // Compare the common prefix, and fall back to the lengths when one ballot is
+  // a prefix of the other.
+  int cmp = std::memcmp(preferences, b.preferences, std::min(length, b.length));
+  if (cmp != 0) return cmp < 0;
+  return length < b.length;
+}
+
+size_t IRVBallot::hash() const {
+  // FNV-1a over the length and the specified preferences.
+  uint64_t h = 14695981039346656037ull;
+  h = (h ^ length) * 1099511628211ull;
+  for (unsigned i = 0; i < length; ++i)
+    h = (h ^ preferences[i]) * 1099511628211ull;
+  return static_cast<size_t>(h);
+}
+
+uint64_t IRVBallot::rank(unsigned nCandidates) const {
+  // Count the ballots with fewer preferences. There are n! / (n - j)! ballots
+  // with j preferences.
+  uint64_t nShorter = 0, nOfLength = 1;
+  for (unsigned j = 0; j < length; ++j) {
+    nShorter += nOfLength;
+    nOfLength *= nCandidates - j;
+  }
+  // The i-th digit of the Lehmer code is the number of unused candidates with
+  // a smaller index than the i-th preference, and has base n - i.
+  uint64_t used = 0, code = 0;
+  for (unsigned i = 0; i < length; ++i) {
+    uint64_t below = (uint64_t(1) << preferences[i]) - 1;
+    unsigned digit = preferences[i] - std::bitset<64>(used & below).count();
+    code = code * (nCandidates - i) + digit;
+    used |= uint64_t(1) << preferences[i];
+  }
+  return nShorter + code;
 }
 
-std::vector<unsigned> socialChoiceIRV(std::list<IRVBallotCount> &ballots,
+IRVBallot IRVBallot::unrank(uint64_t rank, unsigned nCandidates) {
+  // Find the number of preferences.
+  unsigned length = 0;
+  uint64_t nOfLength = 1;
+  while (rank >= nOfLength) {
+    rank -= nOfLength;
+    nOfLength *= nCandidates - length;
+    ++length;
+  }
+  // Decode the Lehmer code, starting from the last digit.
+  unsigned digits[MAX_RANKED_CANDIDATES];
+  for (unsigned i = length; i-- > 0;) {
+    digits[i] = rank % (nCandidates - i);
+    rank /= nCandidates - i;
+  }
+  // Map each digit to the unused candidate with that many unused candidates
+  // before it.
+  IRVBallot b;
+  uint64_t used = 0;
+  for (unsigned i = 0; i < length; ++i) {
+    unsigned c = 0;
+    for (unsigned skip = digits[i];; ++c) {
+      if ((used >> c) & 1) continue;
+      if (skip-- == 0) break;
+    }
+    used |= uint64_t(1) << c;
+    b.push_back(c);
+  }
+  return b;
+}
+
+std::vector<unsigned> socialChoiceIRV(const IRVBallotTable &table,
                                       unsigned nCandidates,
                                       std::mt19937 *engine) {
-  unsigned firstPref;
-  bool isEmpty = false;
+  std::vector<unsigned> out(nCandidates);
+  IRVTallyWorkspace ws;
+  socialChoiceIRV(table, nCandidates, engine, ws, out.data());
+  return out;
+}
 
-  // For tie-breaking
-  std::uniform_int_distribution<> rand_int_distr;
+uint64_t nextIRVBallotTrieId() {
+  // Identifiers start at 1, since 0 marks an empty cache.
+  static std::atomic<uint64_t> nextId{1};
+  return nextId.fetch_add(1, std::memory_order_relaxed);
+}
 
-  std::vector<unsigned> out{};
+void IRVBallotTrie::tally(uint64_t eliminated, unsigned nCandidates,
+                          unsigned *out) const {
+  for (unsigned c = 0; c < nCandidates; ++c) out[c] = 0;
+  // A standing candidate receives every ballot in its' subtree, so the walk
+  // skips over it. Otherwise the ballots pass on to the next preference, and
+  // those which end here are exhausted.
+  uint32_t i = 0, n = nodes.size();
+  while (i < n) {
+    const Node &node = nodes[i];
+    if ((eliminated >> node.candidate) & 1) {
+      ++i;
+    } else {
+      out[node.candidate] += node.subtreeCount;
+      i = node.end;
+    }
+  }
+}
 
-  // Filter out the empty ballots, as these are useless to the
-  // social choice function.
-  ballots.remove_if(
-      [](IRVBallotCount &b) { return b.first.nPreferences() == 0; });
+const unsigned *IRVTallyWorkspace::trieTally(const IRVBallotTrie &trie,
+                                             uint64_t eliminated,
+                                             unsigned nCandidates) {
+  const size_t nSlots = size_t(1) << IRVTallyWorkspace::TRIE_CACHE_BITS;
+  if (trieId != trie.getId() || nTrieMasks >= nSlots / 2) {
+    trieId = trie.getId();
+    trieMasks.assign(nSlots, EMPTY);
+    trieTallies.resize(nSlots * nCandidates);
+    nTrieMasks = 0;
+  }
+  // Fibonacci hashing, then linear probing.
+  size_t slot = (eliminated * 0x9E3779B97F4A7C15ull) >>
+                (64 - IRVTallyWorkspace::TRIE_CACHE_BITS);
+  while (trieMasks[slot] != eliminated) {
+    if (trieMasks[slot] == EMPTY) {
+      trieMasks[slot] = eliminated;
+      ++nTrieMasks;
+      trie.tally(eliminated, nCandidates,
+                 trieTallies.data() + slot * nCandidates);
+      break;
+    }
+    slot = (slot + 1) & (nSlots - 1);
+  }
+  return trieTallies.data() + slot * nCandidates;
+}
 
-  unsigned nEliminations = 0;
+namespace {
 
-  // An array of booleans representing whether or not the candidate index has
-  // been eliminated.
-  std::vector<bool> eliminated(nCandidates, false);
+// The IRV kernel shared by the socialChoiceIRV overloads. The tallies of
+// `base` (if it is not null) are added to the tallies of `table` when
+// choosing each candidate to eliminate. If MaxC is positive, there are at most
+// MaxC candidates, and the loops over the candidates run over all MaxC of
+// them with the extra candidates masked out.
+template <unsigned MaxC, typename Engine>
+void irvKernel(const IRVBallotTrie *base, const IRVBallotTable &table,
+               unsigned nCandidates, Engine *engine, IRVTallyWorkspace &ws,
+               unsigned *out) {
+  const uint32_t NONE = IRVTallyWorkspace::NONE;
+  const unsigned nLoop = MaxC > 0 ? MaxC : nCandidates;
+  // Bit c is set if candidate c is not in the election.
+  const uint64_t absent = ~uint64_t(0) << nCandidates;
+  unsigned *tallies = ws.tallies;
+  uint32_t *head = ws.head;
+  for (unsigned c = 0; c < nLoop; ++c) {
+    tallies[c] = 0;
+    head[c] = NONE;
+  }
 
-  // The minimum tally among standing candidates.
-  unsigned min_tally;
-  std::vector<unsigned> tied_min{};
+  size_t nBallots = table.size();
+  ws.next.resize(nBallots);
+  ws.cursors.assign(nBallots, 0);
+  uint32_t *next = ws.next.data();
+  uint8_t *cursors = ws.cursors.data();
 
-  // The index of the next candidate to be eliminated.
-  unsigned elim;
+  // Tally the first preference of each ballot, skipping the empty ballots.
+  for (size_t i = 0; i < nBallots; ++i) {
+    if (table.length(i) == 0) continue;
+    unsigned c = table.ballot(i)[0];
+    next[i] = head[c];
+    head[c] = i;
+    tallies[c] += table.count(i);
+  }
 
-  // Vector of lists of iterators to the ballotcounts which contribute to the
-  // tally for each candidate.
-  std::vector<std::list<std::list<IRVBallotCount>::iterator>> tally_groups(
-      nCandidates);
-  // The vector of candidate tallies.
-  std::vector<unsigned> tallies(nCandidates, 0);
+  // Bit c is set once candidate c has been eliminated.
+  uint64_t eliminated = 0;
+  unsigned tied[IRVBallot::MAX_PREFERENCES];
 
-  // Tally the initial first preferences for each ballot.
-  for (auto it = ballots.begin(); it != ballots.end(); ++it) {
-    firstPref = it->first.firstPreference();
-    tally_groups[firstPref].push_back(it);
-    tallies[firstPref] += it->second;
-  }
+  for (unsigned nEliminations = 0; nEliminations < nCandidates;
+       ++nEliminations) {
+    const unsigned *baseTallies =
+        base ? ws.trieTally(*base, eliminated, nCandidates) : nullptr;
 
-  // While more than one candidate stands.
-  while (nEliminations < nCandidates) {
-    // Determine candidates with the minimum tally.
-    min_tally = std::numeric_limits<unsigned>::max();
-    for (unsigned i = 0; i < nCandidates; ++i) {
-      if (!eliminated[i] && tallies[i] <= min_tally) {
-        if (tallies[i] == min_tally) {
-          tied_min.push_back(i);
-        } else {
-          tied_min = {i};
-          min_tally = tallies[i];
-        }
+    // Determine the standing candidates with the minimum tally.
+    unsigned minTally = std::numeric_limits<unsigned>::max();
+    unsigned nTied = 0;
+    for (unsigned c = 0; c < nLoop; ++c) {
+      if (((eliminated | absent) >> c) & 1) continue;
+      unsigned tally = tallies[c] + (baseTallies ? baseTallies[c] : 0);
+      if (tally < minTally) {
+        minTally = tally;
+        nTied = 0;
       }
+      if (tally == minTally) tied[nTied++] = c;
     }
     // Tie-break by choosing at random from the tied candidates.
-    rand_int_distr = std::uniform_int_distribution<>(
-        0, std::distance(tied_min.begin(), tied_min.end()) - 1);
-    elim = tied_min[rand_int_distr(*engine)];
+    unsigned elim = nTied == 1 ? tied[0] : tied[rUniformIndex(nTied, engine)];
 
     // Eliminate the standing candidate with the minimum tally.
-    eliminated[elim] = true;
-    out.push_back(elim);
-
-    // Redistribute the ballots attributed to the losing candidate.
-    auto list_start = tally_groups[elim].begin();
-    auto list_end = tally_groups[elim].end();
-    while (list_start != list_end) {
-      // Delete all eliminated candidates from the start of the ballot.
-      firstPref = (*list_start)->first.firstPreference();
-      while (eliminated[firstPref]) {
-        // Check if the ballot was emptied. If so, we break now.
-        isEmpty = (*list_start)->first.eliminateFirstPref();
-        if (isEmpty) break;
-        // Otherwise, continue looking for a standing next-preference.
-        firstPref = (*list_start)->first.firstPreference();
-      }
-      if (isEmpty) {
-        // If the resulting ballot was emptied, then we delete it from
-        // the full set of ballots, and we don't redistribute it.
-        ballots.erase(*list_start);
-      } else {
-        // If it is not empty, we add the ballotcount to the next *standing*
-        // candidates' tally.
-        tally_groups[firstPref].push_back(*list_start);
-        tallies[firstPref] += (*list_start)->second;
+    eliminated |= uint64_t(1) << elim;
+    out[nEliminations] = elim;
+
+    // Move each ballot in the losing candidate's group on to its' next
+    // standing preference, or drop it if it is exhausted.
+    for (uint32_t i = head[elim]; i != NONE;) {
+      uint32_t following = next[i];
+      const uint8_t *b = table.ballot(i);
+      unsigned length = table.length(i);
+      unsigned cursor = cursors[i];
+      while (cursor < length && ((eliminated >> b[cursor]) & 1)) ++cursor;
+      cursors[i] = cursor;
+      if (cursor < length) {
+        unsigned c = b[cursor];
+        next[i] = head[c];
+        head[c] = i;
+        tallies[c] += table.count(i);
       }
-      // Now that the ballot has been redistributed, continue
-      list_start = tally_groups[elim].erase(list_start);
+      i = following;
     }
-    ++nEliminations;
+    head[elim] = NONE;
   }
+}
 
-  return out;
+}  // namespace
+
+template <typename Engine>
+void socialChoiceIRV(const IRVBallotTable &table, unsigned nCandidates,
+                     Engine *engine, IRVTallyWorkspace &ws, unsigned *out) {
+  dispatchMaxCandidates(nCandidates, [&](auto maxC) {
+    irvKernel<decltype(maxC)::value>(nullptr, table, nCandidates, engine, ws,
+                                     out);
+  });
+}
+
+template <typename Engine>
+void socialChoiceIRV(const IRVBallotTrie &base, const IRVBallotTable &table,
+                     unsigned nCandidates, Engine *engine,
+                     IRVTallyWorkspace &ws, unsigned *out) {
+  dispatchMaxCandidates(nCandidates, [&](auto maxC) {
+    irvKernel<decltype(maxC)::value>(&base, table, nCandidates, engine, ws,
+                                     out);
+  });
 }
+
+// Explicit instantiations for the supported PRNGs.
+template void socialChoiceIRV(const IRVBallotTable &, unsigned, std::mt19937 *,
+                              IRVTallyWorkspace &, unsigned *);
+template void socialChoiceIRV(const IRVBallotTable &, unsigned, Philox *,
+                              IRVTallyWorkspace &, unsigned *);
+template void socialChoiceIRV(const IRVBallotTrie &, const IRVBallotTable &,
+                              unsigned, std::mt19937 *, IRVTallyWorkspace &,
+                              unsigned *);
+template void socialChoiceIRV(const IRVBallotTrie &, const IRVBallotTable &,
+                              unsigned, Philox *, IRVTallyWorkspace &,
+                              unsigned *);
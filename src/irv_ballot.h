@@ -13,27 +13,64 @@
 #define IRV_BALLOT_H
 
 #include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
 #include <limits>
 #include <list>
 #include <random>
 #include <sstream>
 #include <string>
+#include <type_traits>
 #include <vector>
 
 class IRVBallot {
  public:
-  // The IRV Ballot in list representation with candidate indices in order of
-  // preference as elements, e.g. {0, 1, 2, 3, 4} or {4, 3, 2}.
-  std::list<unsigned> preferences;
+  // The maximum number of preferences an IRVBallot can hold. Together with the
+  // length byte, a ballot occupies exactly one 64-byte cache line.
+  static constexpr unsigned MAX_PREFERENCES = 63;
+
+  // The largest number of candidates for which every ballot has a rank which
+  // fits in 64 bits.
+  static constexpr unsigned MAX_RANKED_CANDIDATES = 20;
+
+ private:
+  // The number of preferences specified by the ballot.
+  uint8_t length = 0;
+
+  // The candidate indices in order of preference, e.g. {0, 1, 2, 3, 4} or
+  // {4, 3, 2}. Only the first `length` elements are meaningful.
+  uint8_t preferences[MAX_PREFERENCES];
+
+ public:
+  /*! \brief Constructs an empty IRVBallot.
+   *
+   * \return A ballot which specifies no preferences.
+   */
+  IRVBallot() {}
 
   /*! \brief The IRVBallot constructor.
    *
-   * \param preferences A list representation of an IRV ballot consisting of
-   * candidate indices in order of preference.
+   * \param first An iterator to the first candidate index in order of
+   * preference.
+   *
+   * \param last An iterator past the last candidate index.
    *
    * \return A ballot with the specified preferences.
    */
-  IRVBallot(std::list<unsigned> preferences);
+  template <typename InputIt>
+  IRVBallot(InputIt first, InputIt last) {
+    for (; first != last; ++first) push_back(*first);
+  }
+
+  /*! \brief The IRVBallot constructor.
+   *
+   * \param preferences A list of candidate indices in order of preference.
+   *
+   * \return A ballot with the specified preferences.
+   */
+  IRVBallot(std::initializer_list<unsigned> preferences)
+      : IRVBallot(preferences.begin(), preferences.end()) {}
 
   /*! \brief Returns the number of preferences specified by the ballot
    *
@@ -43,7 +80,16 @@ class IRVBallot {
    *
    * \return The number of specified preferences.
    */
-  unsigned nPreferences() const { return preferences.size(); }
+  unsigned nPreferences() const { return length; }
+
+  /*! \brief Returns the candidate index at a given preference.
+   *
+   * \param i The (zero-indexed) preference to look up, less than
+   * `nPreferences()`.
+   *
+   * \return The index of the candidate given the i-th preference.
+   */
+  unsigned operator[](unsigned i) const { return preferences[i]; }
 
   /*! \brief Returns the first preference of the ballot.
    *
@@ -52,7 +98,18 @@ class IRVBallot {
    *
    * \return The first preference of the ballot.
    */
-  unsigned firstPreference() const { return preferences.front(); }
+  unsigned firstPreference() const { return preferences[0]; }
+
+  // Iterators over the candidate indices in order of preference.
+  const uint8_t *begin() const { return preferences; }
+  const uint8_t *end() const { return preferences + length; }
+
+  /*! \brief Appends a preference to the end of the ballot.
+   *
+   * \param candidate The index of the next preferred candidate. The ballot
+   * must have fewer than MAX_PREFERENCES preferences.
+   */
+  void push_back(unsigned candidate) { preferences[length++] = candidate; }
 
   /*! \brief Eliminate the first candidate.
    *
@@ -71,7 +128,7 @@ class IRVBallot {
    *
    * \return A boolean representing whether or not the two ballots are equal.
    */
-  bool operator==(const IRVBallot &b);
+  bool operator==(const IRVBallot &b) const;
 
   /*! \breif Defines a comparison < on IRV ballots.
    *
@@ -83,24 +140,444 @@ class IRVBallot {
    * \return A boolean representing whether this ballot is less than b2.
    */
   bool operator<(const IRVBallot &b) const;
+
+  /*! \brief Computes a hash of the ballot.
+   *
+   * \return A hash of the specified preferences, suitable for unordered
+   * containers.
+   */
+  size_t hash() const;
+
+  /*! \brief Computes the rank of the ballot among all possible ballots.
+   *
+   *  Ballots are partial permutations of the candidates. They are ranked
+   * first by their number of preferences, and then lexicographically using a
+   * Lehmer code of the preferences. This gives a bijection between the
+   * ballots and the integers from zero up to (but not including) the number
+   * of possible ballots, so the rank can be used in place of the ballot as a
+   * key.
+   *
+   * \param nCandidates The number of candidates, which must be at most
+   * MAX_RANKED_CANDIDATES. Each preference must be a distinct candidate index
+   * less than nCandidates.
+   *
+   * \return The rank of the ballot.
+   */
+  uint64_t rank(unsigned nCandidates) const;
+
+  /*! \brief Constructs a ballot from its' rank.
+   *
+   *  The inverse of `rank`.
+   *
+   * \param rank The rank of the ballot.
+   *
+   * \param nCandidates The number of candidates, which must be at most
+   * MAX_RANKED_CANDIDATES.
+   *
+   * \return The ballot with the given rank.
+   */
+  static IRVBallot unrank(uint64_t rank, unsigned nCandidates);
+};
+
+namespace std {
+template <>
+struct hash<IRVBallot> {
+  size_t operator()(const IRVBallot &b) const { return b.hash(); }
 };
+}  // namespace std
 
 typedef std::pair<IRVBallot, unsigned> IRVBallotCount;
 
+/*! \brief Calls a function with a compile-time bound on the number of
+ * candidates.
+ *
+ *  Kernels which loop over the candidates are instantiated for a few small
+ * bounds, which cover most elections, so that those loops have a fixed trip
+ * count and their buffers fit on the stack. Larger elections use the
+ * unbounded kernel.
+ *
+ * \param nCandidates The number of candidates.
+ *
+ * \param f A generic callable, invoked as
+ * `f(std::integral_constant<unsigned, MaxC>{})`, where MaxC is the smallest
+ * bound of at least nCandidates, or zero if there is none.
+ */
+template <typename F>
+inline void dispatchMaxCandidates(unsigned nCandidates, F &&f) {
+  if (nCandidates <= 8) {
+    f(std::integral_constant<unsigned, 8>{});
+  } else if (nCandidates <= 16) {
+    f(std::integral_constant<unsigned, 16>{});
+  } else {
+    f(std::integral_constant<unsigned, 0>{});
+  }
+}
+
+/*! \brief A compact table of ballot counts.
+ *
+ *  Stores the preferences of every ballot back-to-back in a single array,
+ * with an offset array marking where each ballot starts, in the style of a
+ * compressed sparse row matrix. The sampler emits ballots in depth-first
+ * order, so ballots which share a prefix are adjacent. Clearing the table
+ * keeps its' capacity, so that a table reused between elections does not
+ * allocate in the steady state.
+ *
+ *  A table can be passed directly as a sink to the sampling methods.
+ */
+class IRVBallotTable {
+ private:
+  // The preferences of every ballot, concatenated.
+  std::vector<uint8_t> preferences{};
+
+  // The start of each ballot in `preferences`, followed by the total length.
+  std::vector<uint32_t> offsets{0};
+
+  // The count of each ballot.
+  std::vector<unsigned> counts{};
+
+ public:
+  /*! \brief Removes every ballot from the table, keeping its' capacity.
+   */
+  void clear() {
+    preferences.clear();
+    offsets.resize(1);
+    counts.clear();
+  }
+
+  /*! \brief Gets the number of distinct ballots in the table.
+   *
+   * \return The number of (ballot, count) entries.
+   */
+  size_t size() const { return counts.size(); }
+
+  /*! \brief Gets the preferences of a ballot.
+   *
+   * \param i The index of the ballot.
+   *
+   * \return A pointer to the first preference of the ballot.
+   */
+  const uint8_t *ballot(size_t i) const {
+    return preferences.data() + offsets[i];
+  }
+
+  /*! \brief Gets the number of preferences specified by a ballot.
+   *
+   * \param i The index of the ballot.
+   *
+   * \return The length of the ballot.
+   */
+  unsigned length(size_t i) const { return offsets[i + 1] - offsets[i]; }
+
+  /*! \brief Gets the count of a ballot.
+   *
+   * \param i The index of the ballot.
+   *
+   * \return The number of times the ballot occurs.
+   */
+  unsigned count(size_t i) const { return counts[i]; }
+
+  /*! \brief Appends a ballot given by an array of candidate indices.
+   *
+   * \param prefs The candidate indices in order of preference.
+   *
+   * \param n The number of preferences.
+   *
+   * \param count The number of times the ballot occurs.
+   */
+  template <typename Index>
+  void add(const Index *prefs, unsigned n, unsigned count) {
+    for (unsigned i = 0; i < n; ++i)
+      preferences.push_back(static_cast<uint8_t>(prefs[i]));
+    offsets.push_back(preferences.size());
+    counts.push_back(count);
+  }
+
+  /*! \brief Appends a ballot.
+   *
+   * \param b The ballot.
+   *
+   * \param count The number of times the ballot occurs.
+   */
+  void add(const IRVBallot &b, unsigned count) {
+    add(b.begin(), b.nPreferences(), count);
+  }
+
+  /*! \brief Adds to the count of a ballot already in the table.
+   *
+   * \param i The index of the ballot.
+   *
+   * \param count The number of extra occurrences of the ballot.
+   */
+  void addCount(size_t i, unsigned count) { counts[i] += count; }
+
+  /*! \brief Appends every ballot of another table.
+   *
+   * \param other The table to append, in its' order.
+   */
+  void append(const IRVBallotTable &other) {
+    uint32_t base = preferences.size();
+    preferences.insert(preferences.end(), other.preferences.begin(),
+                       other.preferences.end());
+    for (size_t i = 1; i < other.offsets.size(); ++i)
+      offsets.push_back(base + other.offsets[i]);
+    counts.insert(counts.end(), other.counts.begin(), other.counts.end());
+  }
+
+  // The sink interface, which allows the sampler to write directly into the
+  // table.
+  void operator()(const IRVBallot &b, unsigned count) { add(b, count); }
+  void operator()(const unsigned *prefs, unsigned n, unsigned count) {
+    add(prefs, n, count);
+  }
+};
+
+/*! \brief An immutable prefix trie of ballot counts, for pre-tallying a fixed
+ * set of ballots.
+ *
+ *  The nodes are stored in depth-first order, and each node records the total
+ * count of the ballots in its' subtree. The tallies for a given set of
+ * eliminated candidates are found by walking the trie, assigning the whole
+ * subtree of each standing candidate at once, so only the nodes below
+ * eliminated prefixes are visited.
+ */
+class IRVBallotTrie {
+ private:
+  struct Node {
+    // The candidate at this position of the ballot.
+    uint8_t candidate;
+    // The total count of the ballots which pass through this node.
+    unsigned subtreeCount;
+    // The index of the node following this node's subtree.
+    uint32_t end;
+  };
+
+  // The nodes in depth-first order. The top-level nodes are the first
+  // preferences.
+  std::vector<Node> nodes{};
+
+  // A process-unique identifier, for caches of the tallies.
+  uint64_t id;
+
+ public:
+  /*! \brief Constructs a trie from a range of (IRVBallot, count) pairs.
+   *
+   *  The range does not need to be sorted, and may be any range of pairs
+   * such as a std::map<IRVBallot, unsigned>. Each ballot should only appear
+   * once, and the range must outlive the constructor. Empty ballots never
+   * count towards a tally, so they are dropped.
+   *
+   * \param first An iterator to the first pair.
+   *
+   * \param last An iterator past the last pair.
+   *
+   * \return A trie containing the ballots.
+   */
+  template <typename InputIt>
+  IRVBallotTrie(InputIt first, InputIt last);
+
+  /*! \brief Constructs an empty trie.
+   */
+  IRVBallotTrie()
+      : IRVBallotTrie((IRVBallotCount *)nullptr, (IRVBallotCount *)nullptr) {}
+
+  /*! \brief Gets the identifier of the trie.
+   *
+   * \return An identifier which is unique to this trie within the process.
+   */
+  uint64_t getId() const { return id; }
+
+  /*! \brief Tallies the ballots, given the eliminated candidates.
+   *
+   * \param eliminated A mask with bit c set if candidate c is eliminated.
+   *
+   * \param nCandidates The number of candidates.
+   *
+   * \param out A buffer of length nCandidates to write the tallies to.
+   */
+  void tally(uint64_t eliminated, unsigned nCandidates, unsigned *out) const;
+};
+
+/*! \brief Scratch memory for the IRV social choice function.
+ *
+ *  The per-candidate state lives in fixed arrays, since there are at most
+ * IRVBallot::MAX_PREFERENCES candidates. The per-ballot state grows to fit the
+ * largest election seen, so reusing a workspace between calls to
+ * `socialChoiceIRV` avoids any heap allocations in the steady state. A
+ * workspace must not be shared between threads.
+ */
+class IRVTallyWorkspace {
+ public:
+  // A sentinel marking the end of a tally group.
+  static constexpr uint32_t NONE = 0xffffffff;
+
+  // The candidate tallies.
+  unsigned tallies[IRVBallot::MAX_PREFERENCES];
+
+  // The first ballot in the tally group of each candidate. The groups are
+  // singly-linked lists threaded through `next`.
+  uint32_t head[IRVBallot::MAX_PREFERENCES];
+
+  // The next ballot in the same tally group as each ballot.
+  std::vector<uint32_t> next;
+
+  // The position of the current standing preference of each ballot.
+  std::vector<uint8_t> cursors;
+
+  // The identifier of the IRVBallotTrie whose tallies are cached below.
+  uint64_t trieId = 0;
+
+  // An open-addressed table of the masks of eliminated candidates whose trie
+  // tallies are cached, where EMPTY marks an unused slot. The tallies for
+  // slot i are stored in row i of `trieTallies`, in rows of nCandidates
+  // elements.
+  static constexpr uint64_t EMPTY = std::numeric_limits<uint64_t>::max();
+  static constexpr unsigned TRIE_CACHE_BITS = 12;
+  std::vector<uint64_t> trieMasks{};
+  std::vector<unsigned> trieTallies{};
+  size_t nTrieMasks = 0;
+
+  /*! \brief Constructs a workspace for any election.
+   *
+   *  The per-candidate state has a fixed size and the other buffers grow on
+   * first use, so a workspace can be used for elections with up to
+   * IRVBallot::MAX_PREFERENCES candidates.
+   *
+   * \return A workspace whose per-ballot buffers are empty.
+   */
+  IRVTallyWorkspace() : next(), cursors() {}
+
+  /*! \brief Gets the tallies of a trie, given the eliminated candidates.
+   *
+   *  Tallies are cached by the mask of eliminated candidates, so repeated
+   * elimination sequences (which are common between simulated elections) cost
+   * a single lookup. The cache has a fixed size, so it is allocated once, and
+   * it is discarded whenever a different trie is used or it becomes half full.
+   *
+   * \param trie The trie to tally.
+   *
+   * \param eliminated A mask with bit c set if candidate c is eliminated.
+   *
+   * \param nCandidates The number of candidates.
+   *
+   * \return A pointer to the nCandidates tallies, valid until the next call.
+   */
+  const unsigned *trieTally(const IRVBallotTrie &trie, uint64_t eliminated,
+                            unsigned nCandidates);
+};
+
+/*! \brief Evaluates the outcome of an IRV election from a ballot table.
+ *
+ *  Eliminated candidates are tracked in a 64-bit mask. Each ballot keeps a
+ * cursor to its' current standing preference and sits in the tally group of
+ * that candidate, so eliminating a candidate only touches the ballots in its'
+ * group. The table is not modified.
+ *
+ * \param table The ballot counts for the election.
+ *
+ * \param nCandidates The number of candidates in the election, which must be
+ * at most IRVBallot::MAX_PREFERENCES.
+ *
+ * \param engine A pointer to a PRNG for tie-breaking, either a mt19937 or a
+ * Philox.
+ *
+ * \param ws The scratch memory for the tallies.
+ *
+ * \param out A buffer of length nCandidates to write the candidate indices to,
+ * in order of elimination.
+ */
+template <typename Engine>
+void socialChoiceIRV(const IRVBallotTable &table, unsigned nCandidates,
+                     Engine *engine, IRVTallyWorkspace &ws, unsigned *out);
+
+/*! \brief Evaluates the outcome of an IRV election from a fixed set of ballots
+ * plus a ballot table.
+ *
+ *  Equivalent to evaluating the union of the ballots in `base` and `table`,
+ * but the tallies for `base` are cached in the workspace, so that the cost
+ * of each evaluation is proportional to the size of `table` when the same
+ * base is used repeatedly. This is used to evaluate simulated elections which
+ * all contain the same observed ballots.
+ *
+ * \param base The fixed ballots, for example the observed ballots.
+ *
+ * \param table The remaining ballot counts for the election.
+ *
+ * \param nCandidates The number of candidates in the election, which must be
+ * at most IRVBallot::MAX_PREFERENCES.
+ *
+ * \param engine A pointer to a PRNG for tie-breaking, either a mt19937 or a
+ * Philox.
+ *
+ * \param ws The scratch memory for the tallies, including the cache of base
+ * tallies.
+ *
+ * \param out A buffer of length nCandidates to write the candidate indices to,
+ * in order of elimination.
+ */
+template <typename Engine>
+void socialChoiceIRV(const IRVBallotTrie &base, const IRVBallotTable &table,
+                     unsigned nCandidates, Engine *engine,
+                     IRVTallyWorkspace &ws, unsigned *out);
+
 /*! \brief Evaluates the outcome of an IRV election.
  *
- *  Given a set of ballots, this applies the social choice function to determine
- * the elimination order.
+ *  Equivalent to the workspace overload, for one-off evaluations.
  *
- * \param ballotcounts A reference to a set of ballot counts to conduct the
- * social choice function with. The reference object will be deleted.
+ * \param table The ballot counts for the election.
+ *
+ * \param nCandidates The number of candidates in the election.
  *
  * \param engine A pointer to a mt19937 PRNG for tie-breaking.
  *
  * \return A list of candidate indices in order of elimination.
  */
-std::vector<unsigned> socialChoiceIRV(std::list<IRVBallotCount> &ballotcounts,
+std::vector<unsigned> socialChoiceIRV(const IRVBallotTable &table,
                                       unsigned nCandidates,
                                       std::mt19937 *engine);
 
+// The source of unique IRVBallotTrie identifiers.
+uint64_t nextIRVBallotTrieId();
+
+template <typename InputIt>
+IRVBallotTrie::IRVBallotTrie(InputIt first, InputIt last)
+    : id(nextIRVBallotTrieId()) {
+  // Sort the ballots, so that ballots sharing a prefix are adjacent and every
+  // prefix precedes its' extensions.
+  std::vector<std::pair<const IRVBallot *, unsigned>> sorted;
+  for (InputIt it = first; it != last; ++it) {
+    if (it->first.nPreferences() > 0 && it->second > 0)
+      sorted.emplace_back(&it->first, it->second);
+  }
+  std::sort(sorted.begin(), sorted.end(),
+            [](const std::pair<const IRVBallot *, unsigned> &a,
+               const std::pair<const IRVBallot *, unsigned> &b) {
+              return *a.first < *b.first;
+            });
+
+  // The nodes on the path of the previous ballot.
+  std::vector<uint32_t> stack;
+  const IRVBallot *previous = nullptr;
+  for (const auto &bc : sorted) {
+    const IRVBallot &b = *bc.first;
+    // Close the nodes which are not shared with the previous ballot.
+    unsigned shared = 0;
+    if (previous != nullptr) {
+      unsigned n = std::min(b.nPreferences(), previous->nPreferences());
+      while (shared < n && b[shared] == (*previous)[shared]) ++shared;
+    }
+    while (stack.size() > shared) {
+      nodes[stack.back()].end = nodes.size();
+      stack.pop_back();
+    }
+    // Open the nodes for the rest of this ballot.
+    for (unsigned k = shared; k < b.nPreferences(); ++k) {
+      stack.push_back(nodes.size());
+      nodes.push_back({static_cast<uint8_t>(b[k]), 0, 0});
+    }
+    for (uint32_t i : stack) nodes[i].subtreeCount += bc.second;
+    previous = &b;
+  }
+  for (uint32_t i : stack) nodes[i].end = nodes.size();
+}
+
 #endif /* IRV_BALLOT_H */
@@ -0,0 +1,77 @@
+/******************************************************************************
+ * File:             irv_frozen.cpp
+ *
+ * Author:           Floyd Everest <me@floydeverest.com>
+ * Created:          10/16/26
+ * Description:      This file implements the IRVFrozenTree methods as outlined
+ *                   in `irv_frozen.h`.
+ *****************************************************************************/
+
+#include "irv_frozen.h"
+
+#include <stdexcept>
+
+uint64_t IRVFrozenTree::blockSize(const IRVNode *node) const {
+  uint64_t n = node->getNSlots();
+  return 1 + n + 1 + (node->isSparse() ? (n + 7) / 8 : 0) +
+         (node->getDepth() + 1 < maxDepth ? (n + 1) / 2 : 0);
+}
+
+IRVFrozenTree::IRVFrozenTree(IRVParameters *params, const IRVNode *root)
+    : nCandidates(params->getNCandidates()),
+      minDepth(params->getMinDepth()),
+      maxDepth(params->getMaxDepth()),
+      a0(params->getA0()),
+      vd(params->getVD()) {
+  // Add the prior to the posterior parameters exactly as the nodes do when
+  // sampling, so that the samples are identical.
+  for (unsigned depth = 0; depth < maxDepth; ++depth)
+    priors.push_back(vd ? a0 * params->depthFactor(depth) : a0);
+
+  // The nodes are visited breadth-first, and each node is given its' offset
+  // when its' parent is visited, so that the parent can record it.
+  struct Pending {
+    const IRVNode *node;
+    uint32_t offset;
+  };
+  std::vector<Pending> queue{{root, 0}};
+  uint64_t next = blockSize(root);
+  for (size_t q = 0; q < queue.size(); ++q) {
+    const IRVNode *node = queue[q].node;
+    uint32_t offset = queue[q].offset;
+    unsigned depth = node->getDepth();
+    unsigned nSlots = node->getNSlots();
+    words.resize(offset + blockSize(node));
+
+    uint64_t *section = words.data() + offset;
+    uint32_t *header = reinterpret_cast<uint32_t *>(section++);
+    header[0] = nSlots;
+    header[1] = node->isSparse();
+
+    double *alphas = reinterpret_cast<double *>(section);
+    for (unsigned k = 0; k < nSlots; ++k)
+      alphas[k] = priors[depth] + node->getSlotA(k);
+    alphas[nSlots] = priors[depth] + node->getTerminalA();
+    section += nSlots + 1;
+
+    if (node->isSparse()) {
+      uint8_t *indices = reinterpret_cast<uint8_t *>(section);
+      for (unsigned k = 0; k < nSlots; ++k) indices[k] = node->getSlotIndex(k);
+      section += (nSlots + 7) / 8;
+    }
+
+    if (depth + 1 >= maxDepth) continue;
+
+    uint32_t *children = reinterpret_cast<uint32_t *>(section);
+    for (unsigned k = 0; k < nSlots; ++k) {
+      const IRVNode *child = node->getSlotChild(k);
+      if (child == nullptr) continue;
+      if (next > UINT32_MAX)
+        throw std::runtime_error("The tree is too large to freeze.");
+      children[k] = static_cast<uint32_t>(next);
+      queue.push_back({child, children[k]});
+      next += blockSize(child);
+    }
+  }
+  words.shrink_to_fit();
+}
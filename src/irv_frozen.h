@@ -0,0 +1,424 @@
+/******************************************************************************
+ * File:             irv_frozen.h
+ *
+ * Author:           Floyd Everest <me@floydeverest.com>
+ * Created:          10/16/26
+ * Description:      This file declares the `IRVFrozenTree` class, a read-only
+ *                   image of an IRV Dirichlet-tree compiled for sampling. The
+ *                   nodes are stored breadth-first in one contiguous buffer,
+ *                   each with its' posterior Dirichlet parameters (the prior
+ *                   already added) followed by the offsets of its' children,
+ *                   so sampling reads consecutive memory rather than chasing
+ *                   pointers between arena slabs.
+ *****************************************************************************/
+
+#ifndef IRV_FROZEN_H
+#define IRV_FROZEN_H
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "distributions.h"
+#include "irv_node.h"
+
+/*
+ * The image is a sequence of 8-byte words. The node at offset o (in words)
+ * which stores n of its' children (see IRVNode::getNSlots) is laid out as
+ *
+ *   header    One word holding n and whether the node is sparse, as two
+ *             uint32_t values.
+ *   alphas    The n + 1 posterior parameters a0 + as[k] of the stored
+ *             children and the terminal outcome, as doubles, where a0 is
+ *             scaled by the depth factor if the tree reduces to a Dirichlet
+ *             distribution. The other children only have the prior.
+ *   indices   The index of each stored child, as n uint8_t values padded to
+ *             a whole word, if the node is sparse. Otherwise every child is
+ *             stored, in order.
+ *   children  The word offset of each stored child, as n uint32_t values
+ *             padded to a whole word, where zero marks a child which has not
+ *             been initialized. Nodes one preference from the maximum depth
+ *             have no sub-trees to sample, so they have no children.
+ *
+ * The root is at offset zero, and the nodes of each depth follow those of the
+ * depth above, so the top levels which every sample passes through share a
+ * few cache lines.
+ */
+
+class IRVFrozenTree {
+ private:
+  // The nodes of the tree.
+  std::vector<uint64_t> words{};
+
+  // The parameters the image was compiled with.
+  unsigned nCandidates;
+  unsigned minDepth;
+  unsigned maxDepth;
+  double a0;
+  bool vd;
+
+  // The prior parameter of each outcome at each depth.
+  std::vector<double> priors{};
+
+  // The sections of the block of a node.
+  struct Block {
+    unsigned nSlots;
+    const double *alphas;
+    // Null if the node is dense.
+    const uint8_t *indices;
+    // Null if the node has no children.
+    const uint32_t *children;
+  };
+
+  // Returns the number of words in the block of a node.
+  uint64_t blockSize(const IRVNode *node) const;
+
+  // Returns the block of the node at an offset.
+  Block blockAt(uint32_t node, unsigned depth) const {
+    const uint32_t *header =
+        reinterpret_cast<const uint32_t *>(words.data() + node);
+    const uint64_t *section = words.data() + node + 1;
+    Block block{header[0], reinterpret_cast<const double *>(section), nullptr,
+                nullptr};
+    section += block.nSlots + 1;
+    if (header[1] != 0) {
+      block.indices = reinterpret_cast<const uint8_t *>(section);
+      section += (block.nSlots + 7) / 8;
+    }
+    if (depth + 1 < maxDepth)
+      block.children = reinterpret_cast<const uint32_t *>(section);
+    return block;
+  }
+
+  // Returns the posterior parameters of every outcome of a node, which are
+  // written to the scratch if the node is sparse.
+  const double *outcomeAlphas(const Block &block, unsigned depth,
+                              double *scratch) const {
+    if (block.indices == nullptr) return block.alphas;
+    unsigned nChildren = nCandidates - depth;
+    std::fill(scratch, scratch + nChildren, priors[depth]);
+    for (unsigned k = 0; k < block.nSlots; ++k)
+      scratch[block.indices[k]] = block.alphas[k];
+    scratch[nChildren] = block.alphas[block.nSlots];
+    return scratch;
+  }
+
+  // Returns the offset of a child while visiting the children in order of
+  // index, as for IRVNode::childAt, or zero if it is uninitialized.
+  uint32_t childAt(const Block &block, unsigned i, unsigned &slot) const {
+    if (block.indices == nullptr) return block.children[i];
+    while (slot < block.nSlots && block.indices[slot] < i) ++slot;
+    return slot < block.nSlots && block.indices[slot] == i
+               ? block.children[slot]
+               : 0;
+  }
+
+  // The following mirror the IRVNode methods of the same names, so that the
+  // image gives identical samples to the tree it was compiled from. The shape
+  // is an IRVShape, as for IRVNode.
+
+  template <typename Shape, typename Engine, typename Sink>
+  void sampleNode(Shape shape, IRVParameters *params, uint32_t node,
+                  unsigned depth, unsigned count, IRVWorkspace &ws,
+                  Engine *engine, Sink &sink) const;
+
+  template <typename Shape, typename Engine, typename Sink>
+  void sampleNodeLanes(Shape shape, IRVParameters *params, uint32_t node,
+                       unsigned depth, unsigned lanes, const unsigned *count,
+                       IRVLaneWorkspace &ws, Engine *const *engines,
+                       Sink *const *sinks) const;
+
+  template <typename Shape, typename Engine, typename Sink>
+  void splitNode(Shape shape, IRVParameters *params, uint32_t node,
+                 unsigned depth, unsigned count, unsigned splitDepth,
+                 IRVWorkspace &ws, Engine *engine, Sink &sink,
+                 IRVSplit &out) const;
+
+ public:
+  /*! \brief Compiles a tree into a frozen image.
+   *
+   * \param params The parameters of the tree. The image must be rebuilt if
+   * they change, see `matches`.
+   *
+   * \param root The root node of the tree.
+   *
+   * \return An image which samples identically to the tree.
+   */
+  IRVFrozenTree(IRVParameters *params, const IRVNode *root);
+
+  /*! \brief Checks whether the image is valid for a set of parameters.
+   *
+   * \param params The current parameters of the tree.
+   *
+   * \return True if the image was compiled with the same parameters.
+   */
+  bool matches(IRVParameters *params) const {
+    return nCandidates == params->getNCandidates() &&
+           minDepth == params->getMinDepth() &&
+           maxDepth == params->getMaxDepth() && a0 == params->getA0() &&
+           vd == params->getVD();
+  }
+
+  /*! \brief Gets the size of the image.
+   *
+   * \return The number of bytes in the image.
+   */
+  size_t bytes() const { return words.size() * sizeof(uint64_t); }
+
+  /*! \brief Samples ballots from the posterior predictive distribution.
+   *
+   *  Equivalent to IRVNode::sample at the root of the compiled tree.
+   *
+   * \param params The parameters the image was compiled with.
+   *
+   * \param count The number of ballots to sample.
+   *
+   * \param ws The workspace for sampling, whose `path` is the default path.
+   *
+   * \param engine A PRNG for random sampling.
+   *
+   * \param sink A sink for each distinct ballot, as for emitIRVBallot.
+   */
+  template <typename Engine, typename Sink>
+  void sample(IRVParameters *params, unsigned count, IRVWorkspace &ws,
+              Engine *engine, Sink &sink) const {
+    dispatchIRVShape(params, [&](auto shape) {
+      sampleNode(shape, params, 0, 0, count, ws, engine, sink);
+    });
+  }
+
+  /*! \brief Samples ballots from several realisations in one traversal.
+   *
+   *  Equivalent to IRVNode::sampleLanes at the root of the compiled tree.
+   */
+  template <typename Engine, typename Sink>
+  void sampleLanes(IRVParameters *params, unsigned lanes,
+                   const unsigned *count, IRVLaneWorkspace &ws,
+                   Engine *const *engines, Sink *const *sinks) const {
+    dispatchIRVShape(params, [&](auto shape) {
+      sampleNodeLanes(shape, params, 0, 0, lanes, count, ws, engines, sinks);
+    });
+  }
+
+  /*! \brief Splits a sample into independent tasks.
+   *
+   *  Equivalent to IRVNode::split at the root of the compiled tree, except
+   * that the tasks refer to the image. They are sampled with `sampleTask`.
+   */
+  template <typename Engine, typename Sink>
+  void split(IRVParameters *params, unsigned count, unsigned splitDepth,
+             IRVWorkspace &ws, Engine *engine, Sink &sink,
+             IRVSplit &out) const {
+    out.frozen = true;
+    dispatchIRVShape(params, [&](auto shape) {
+      splitNode(shape, params, 0, 0, count, splitDepth, ws, engine, sink, out);
+    });
+  }
+
+  /*! \brief Samples the sub-tree of a task split from the image.
+   *
+   *  Equivalent to IRVSplit::sample for a split of the compiled tree.
+   *
+   * \param params The parameters the image was compiled with.
+   *
+   * \param split A split made by `split`.
+   *
+   * \param i The index of the task.
+   *
+   * \param ws The workspace for sampling, whose `path` is the default path.
+   *
+   * \param sink A sink for each distinct ballot, as for emitIRVBallot.
+   */
+  template <typename Sink>
+  void sampleTask(IRVParameters *params, const IRVSplit &split, size_t i,
+                  IRVWorkspace &ws, Sink &sink) const;
+};
+
+template <typename Shape, typename Engine, typename Sink>
+void IRVFrozenTree::sampleNode(Shape shape, IRVParameters *params,
+                               uint32_t node, unsigned depth, unsigned count,
+                               IRVWorkspace &ws, Engine *engine,
+                               Sink &sink) const {
+  std::vector<unsigned> &path = ws.path;
+
+  unsigned nChildren = nCandidates - depth;
+  unsigned nOutcomes = nChildren + (depth >= minDepth);
+
+  // The prior is already added to the parameters.
+  IRVNodeBuffers<Shape::MAX_CANDIDATES> buffers(ws, depth);
+  unsigned *mnomCounts = buffers.counts;
+  Block block = blockAt(node, depth);
+  rDirichletMultinomial(count, outcomeAlphas(block, depth, buffers.alphas),
+                        nOutcomes, mnomCounts, buffers.probs, engine);
+
+  // Emit terminal node ballots
+  if (depth >= minDepth && mnomCounts[nChildren] > 0)
+    emitIRVBallot(sink, path, depth, mnomCounts[nChildren]);
+
+  // Emit the completed ballots one preference from the maximum depth.
+  if (depth == maxDepth - 1) {
+    for (unsigned i = 0; i < nChildren; ++i) {
+      if (mnomCounts[i] == 0) continue;
+      std::swap(path[depth], path[depth + i]);
+      emitIRVBallot(sink, path, depth + 1, mnomCounts[i]);
+      std::swap(path[depth], path[depth + i]);
+    }
+    return;
+  }
+
+  // Otherwise sample from each subtree, lazily if it was never observed.
+  unsigned slot = 0;
+  for (unsigned i = 0; i < nChildren; ++i) {
+    if (mnomCounts[i] == 0) continue;
+    uint32_t child = childAt(block, i, slot);
+    std::swap(path[depth], path[depth + i]);
+    if (child == 0) {
+      lazyIRVBallots(shape, params, mnomCounts[i], depth + 1, ws, engine,
+                     sink);
+    } else {
+      sampleNode(shape, params, child, depth + 1, mnomCounts[i], ws, engine,
+                 sink);
+    }
+    std::swap(path[depth], path[depth + i]);
+  }
+}
+
+template <typename Shape, typename Engine, typename Sink>
+void IRVFrozenTree::sampleNodeLanes(Shape shape, IRVParameters *params,
+                                    uint32_t node, unsigned depth,
+                                    unsigned lanes, const unsigned *count,
+                                    IRVLaneWorkspace &ws,
+                                    Engine *const *engines,
+                                    Sink *const *sinks) const {
+  std::vector<unsigned> &path = ws.ws.path;
+
+  unsigned nChildren = nCandidates - depth;
+  unsigned nOutcomes = nChildren + (depth >= minDepth);
+
+  unsigned *mnomCounts = ws.countsAt(depth);
+  Block block = blockAt(node, depth);
+  rDirichletMultinomialLanes(lanes, count, 0.,
+                             outcomeAlphas(block, depth, ws.ws.alphas.data()),
+                             nOutcomes, mnomCounts, ws.probs.data(), engines);
+
+  // Emit terminal node ballots
+  if (depth >= minDepth) {
+    const unsigned *terminal = mnomCounts + nChildren * lanes;
+    for (unsigned k = 0; k < lanes; ++k)
+      if (terminal[k] > 0) emitIRVBallot(*sinks[k], path, depth, terminal[k]);
+  }
+
+  // Emit the completed ballots one preference from the maximum depth.
+  if (depth == maxDepth - 1) {
+    for (unsigned i = 0; i < nChildren; ++i) {
+      std::swap(path[depth], path[depth + i]);
+      for (unsigned k = 0; k < lanes; ++k) {
+        unsigned c = mnomCounts[i * lanes + k];
+        if (c > 0) emitIRVBallot(*sinks[k], path, depth + 1, c);
+      }
+      std::swap(path[depth], path[depth + i]);
+    }
+    return;
+  }
+
+  // Otherwise sample from each subtree with the lanes which reach it.
+  unsigned slot = 0;
+  unsigned childCounts[IRVLaneWorkspace::MAX_LANES];
+  Engine *childEngines[IRVLaneWorkspace::MAX_LANES];
+  Sink *childSinks[IRVLaneWorkspace::MAX_LANES];
+  for (unsigned i = 0; i < nChildren; ++i) {
+    unsigned nActive = 0;
+    for (unsigned k = 0; k < lanes; ++k) {
+      unsigned c = mnomCounts[i * lanes + k];
+      if (c == 0) continue;
+      childCounts[nActive] = c;
+      childEngines[nActive] = engines[k];
+      childSinks[nActive++] = sinks[k];
+    }
+    if (nActive == 0) continue;
+    uint32_t child = childAt(block, i, slot);
+    std::swap(path[depth], path[depth + i]);
+    if (child == 0) {
+      for (unsigned k = 0; k < nActive; ++k)
+        lazyIRVBallots(shape, params, childCounts[k], depth + 1, ws.ws,
+                       childEngines[k], *childSinks[k]);
+    } else if (nActive == 1) {
+      sampleNode(shape, params, child, depth + 1, childCounts[0], ws.ws,
+                 childEngines[0], *childSinks[0]);
+    } else {
+      sampleNodeLanes(shape, params, child, depth + 1, nActive, childCounts,
+                      ws, childEngines, childSinks);
+    }
+    std::swap(path[depth], path[depth + i]);
+  }
+}
+
+template <typename Shape, typename Engine, typename Sink>
+void IRVFrozenTree::splitNode(Shape shape, IRVParameters *params,
+                              uint32_t node, unsigned depth, unsigned count,
+                              unsigned splitDepth, IRVWorkspace &ws,
+                              Engine *engine, Sink &sink,
+                              IRVSplit &out) const {
+  std::vector<unsigned> &path = ws.path;
+
+  unsigned nChildren = nCandidates - depth;
+  unsigned nOutcomes = nChildren + (depth >= minDepth);
+
+  IRVNodeBuffers<Shape::MAX_CANDIDATES> buffers(ws, depth);
+  unsigned *mnomCounts = buffers.counts;
+  Block block = blockAt(node, depth);
+  rDirichletMultinomial(count, outcomeAlphas(block, depth, buffers.alphas),
+                        nOutcomes, mnomCounts, buffers.probs, engine);
+
+  // Emit terminal node ballots
+  if (depth >= minDepth && mnomCounts[nChildren] > 0)
+    emitIRVBallot(sink, path, depth, mnomCounts[nChildren]);
+
+  // Emit the completed ballots one preference from the maximum depth.
+  if (depth == maxDepth - 1) {
+    for (unsigned i = 0; i < nChildren; ++i) {
+      if (mnomCounts[i] == 0) continue;
+      std::swap(path[depth], path[depth + i]);
+      emitIRVBallot(sink, path, depth + 1, mnomCounts[i]);
+      std::swap(path[depth], path[depth + i]);
+    }
+    return;
+  }
+
+  // Record each sub-tree at the split depth as a task.
+  unsigned slot = 0;
+  for (unsigned i = 0; i < nChildren; ++i) {
+    if (mnomCounts[i] == 0) continue;
+    uint32_t child = childAt(block, i, slot);
+    std::swap(path[depth], path[depth + i]);
+    if (depth + 1 >= splitDepth || child == 0) {
+      out.add(child, depth + 1, mnomCounts[i], path);
+    } else {
+      splitNode(shape, params, child, depth + 1, mnomCounts[i], splitDepth,
+                ws, engine, sink, out);
+    }
+    std::swap(path[depth], path[depth + i]);
+  }
+}
+
+template <typename Sink>
+void IRVFrozenTree::sampleTask(IRVParameters *params, const IRVSplit &split,
+                               size_t i, IRVWorkspace &ws, Sink &sink) const {
+  const IRVSplit::Task &task = split.tasks[i];
+  Philox engine(split.key, i);
+  std::copy(split.paths.begin() + i * split.stride,
+            split.paths.begin() + (i + 1) * split.stride, ws.path.begin());
+  dispatchIRVShape(params, [&](auto shape) {
+    if (task.frozenNode == 0) {
+      lazyIRVBallots(shape, params, task.count, task.depth, ws, &engine,
+                     sink);
+    } else {
+      sampleNode(shape, params, task.frozenNode, task.depth, task.count, ws,
+                 &engine, sink);
+    }
+  });
+  // Restore the default path.
+  std::iota(ws.path.begin(), ws.path.end(), 0u);
+}
+
+#endif /* IRV_FROZEN_H */
@@ -8,6 +8,8 @@
  *****************************************************************************/
 #include "irv_node.h"
 
+#include <algorithm>
+
 // Calculates the factors with which to multiply a0 in order to obtain the
 // interior parameters which reduce to a Dirichlet distribution.
 void IRVParameters::calculateDepthFactors() {
@@ -27,154 +29,134 @@ void IRVParameters::calculateDepthFactors() {
 std::list<IRVBallotCount> lazyIRVBallots(IRVParameters *params, unsigned count,
                                          std::vector<unsigned> path,
                                          unsigned depth, std::mt19937 *engine) {
-  // Get parameters
-  unsigned nCandidates = params->getNCandidates();
-  double minDepth = params->getMinDepth();
-  double maxDepth = params->getMaxDepth();
-  double a0 = params->getA0();
-  if (params->getVD()) a0 = a0 * params->depthFactor(depth);
-
   std::list<IRVBallotCount> out = {};
-
-  std::vector<unsigned> mnomCounts;
-
-  unsigned nChildren = nCandidates - depth;
-  unsigned nOutcomes = nChildren + (depth >= minDepth);
-
-  std::vector<double> a(nOutcomes);
-
-  if (depth == nCandidates - 1 || depth == maxDepth) {
-    // If the ballot is completely specified, return count * the specified
-    // ballot.
-    IRVBallot b(std::list<unsigned>(path.begin(), path.begin() + depth));
-    out.emplace_back(std::move(b), count);
-    return out;
-  }
-
-  // Otherwise we sample from a Dirichlet-Multinomial distribution to
-  // determine how many ballots we sample from each sub-tree (or how many
-  // ballots terminate).
-
-  // We start by initializing a to the appropriate values.
-  for (unsigned i = 0; i < nOutcomes; ++i) a[i] = a0;
-  mnomCounts = rDirichletMultinomial(count, a, engine);
-
-  // Add the ballots which terminate at this node.
-  if (depth >= minDepth && mnomCounts[nOutcomes - 1] > 0) {
-    // Create the ballot.
-    IRVBallot b(std::list<unsigned>(path.begin(), path.begin() + depth));
-    // Add ballots to output.
-    out.emplace_back(std::move(b), mnomCounts[nOutcomes - 1]);
-  }
-
-  for (unsigned i = 0; i < nChildren; ++i) {
-    // Skip if there the sampled count for the subtree is zero.
-    if (mnomCounts[i] == 0) continue;
-
-    // Update path for recursive sampling.
-    std::swap(path[depth], path[depth + i]);
-    // Combine results with output.
-    out.splice(out.end(),
-               lazyIRVBallots(params, mnomCounts[i], path, depth + 1, engine));
-    // Change the path back for further sampling.
-    std::swap(path[depth], path[depth + i]);
-  }
-
+  auto sink = [&out](const IRVBallot &b, unsigned c) {
+    out.emplace_back(b, c);
+  };
+  IRVWorkspace ws(params);
+  ws.path = std::move(path);
+  lazyIRVBallots(params, count, depth, ws, engine, sink);
   return out;
 }
 
-IRVNode::IRVNode(unsigned depth_, IRVParameters *parameters_) {
-  parameters = parameters_;
+IRVNode::IRVNode(unsigned depth_, IRVParameters *parameters, Arena *arena) {
+  owner = arena->getOwner();
   nChildren = parameters->getNCandidates() - depth_;
   depth = depth_;
 
-  as = new double[nChildren + 1];  // +1 for incomplete ballots
-  for (unsigned i = 0; i < nChildren + 1; ++i) as[i] = 0.;
+  // Deep nodes of trees with many candidates typically observe only a few
+  // of their children, so those nodes start with room for a few children and
+  // grow as they are observed.
+  capacity = nChildren > DENSE_MAX_CHILDREN ? SPARSE_MIN_SLOTS : nChildren;
+  nSlots = isSparse() ? 0 : nChildren;
 
-  children = new NodeP[nChildren]{nullptr};
+  // Both arrays are zero-initialized by the arena. `as` has an extra element
+  // for incomplete ballots.
+  as = allocateAs(capacity, arena);
+  children = arena->allocateArray<NodeP>(capacity);
 }
 
-IRVNode::~IRVNode() {
-  // Destructor must delete the entire sub-tree. Hence, we need to delete any
-  // initialized nodes in the sub-tree before removing the array.
-  delete[] as;
-  for (unsigned i = 0; i < nChildren; ++i) {
-    if (children[i] != nullptr) delete children[i];
-  }
-  delete[] children;
+IRVNode::IRVNode(const IRVNode &node, Arena *arena) {
+  owner = arena->getOwner();
+  nChildren = node.nChildren;
+  depth = node.depth;
+  nSlots = node.nSlots;
+  capacity = node.capacity;
+
+  as = allocateAs(capacity, arena);
+  std::copy(node.as, node.as + capacity + 1, as);
+  if (isSparse()) std::copy(node.indices(), node.indices() + nSlots, indices());
+  children = arena->allocateArray<NodeP>(capacity);
+  std::copy(node.children, node.children + capacity, children);
 }
 
-std::list<IRVBallotCount> IRVNode::sample(unsigned count,
-                                          std::vector<unsigned> path,
-                                          std::mt19937 *engine) {
-  std::list<IRVBallotCount> out = {};
-
-  unsigned minDepth = parameters->getMinDepth();
-  unsigned maxDepth = parameters->getMaxDepth();
-  double a0 = parameters->getA0();
-  if (parameters->getVD()) a0 = a0 * parameters->depthFactor(depth);
-
-  unsigned nOutcomes = nChildren + (depth >= minDepth);
-
-  std::vector<double> asPost(nOutcomes);
-  for (unsigned i = 0; i < nOutcomes; ++i) asPost[i] = as[i] + a0;
-
-  // Get Dirichlet-multinomial counts for next-preference selections below
-  // current node.
-  std::vector<unsigned> mnomCounts =
-      rDirichletMultinomial(count, asPost, engine);
-
-  // Add terminal node ballots
-  if (depth >= minDepth && mnomCounts[nChildren] > 0) {
-    IRVBallot b(std::list<unsigned>(path.begin(), path.begin() + depth));
-
-    out.emplace_back(std::move(b), mnomCounts[nChildren]);
-  }
-
-  // If the ballot is one preference from being completely specified, add the
-  // completed ballots to the output.
-  if (depth == maxDepth - 1) {
-    for (unsigned i = 0; i < nChildren; ++i) {
-      // Skip if there the sampled count for the ballot is zero.
-      if (mnomCounts[i] == 0) continue;
-
-      std::swap(path[depth], path[depth + i]);
-
-      IRVBallot b(std::list<unsigned>(path.begin(), path.begin() + depth + 1));
+double IRVNode::getA(unsigned i) const {
+  if (i == nChildren) return as[capacity];
+  if (!isSparse()) return as[i];
+  for (unsigned k = 0; k < nSlots; ++k)
+    if (indices()[k] == i) return as[k];
+  return 0.;
+}
 
-      out.emplace_back(std::move(b), mnomCounts[i]);
+const IRVNode *IRVNode::getChild(unsigned i) const {
+  unsigned slot = 0;
+  return childAt(i, slot);
+}
 
-      std::swap(path[depth], path[depth + i]);
+unsigned IRVNode::slotFor(unsigned i, Arena *arena) {
+  if (!isSparse()) return i;
+  uint8_t *index = indices();
+  unsigned slot = 0;
+  while (slot < nSlots && index[slot] < i) ++slot;
+  if (slot < nSlots && index[slot] == i) return slot;
+
+  if (nSlots == capacity) {
+    // Copy the slots into arrays twice the size, or into dense arrays if the
+    // node has room for more than an eighth of its' children.
+    bool dense = 8 * capacity > nChildren;
+    unsigned newCapacity = dense ? nChildren : 2 * capacity;
+    double *newAs = allocateAs(newCapacity, arena);
+    NodeP *newChildren = arena->allocateArray<NodeP>(newCapacity);
+    uint8_t *newIndex = reinterpret_cast<uint8_t *>(newAs + newCapacity + 1);
+    for (unsigned k = 0; k < nSlots; ++k) {
+      unsigned to = dense ? index[k] : k;
+      if (!dense) newIndex[k] = index[k];
+      newAs[to] = as[k];
+      newChildren[to] = children[k];
+    }
+    newAs[newCapacity] = as[capacity];
+    as = newAs;
+    children = newChildren;
+    capacity = newCapacity;
+    if (dense) {
+      nSlots = nChildren;
+      return i;
     }
-    // Return early since there are no child nodes to sample from.
-    return out;
+    index = newIndex;
   }
 
-  // Otherwise we continue recursively sampling from subtrees. If a subtree is
-  // not specified, then we lazily generate samples from a uniform dirichlet
-  // tree.
-  for (unsigned i = 0; i < nChildren; ++i) {
-    // Skip if there the sampled count for the subtree is zero.
-    if (mnomCounts[i] == 0) continue;
-
-    // Sample from the next subtree.
-    std::swap(path[depth], path[depth + i]);
+  // Shift the later slots along to keep the indices in order.
+  for (unsigned k = nSlots; k > slot; --k) {
+    index[k] = index[k - 1];
+    as[k] = as[k - 1];
+    children[k] = children[k - 1];
+  }
+  index[slot] = i;
+  as[slot] = 0.;
+  children[slot] = nullptr;
+  ++nSlots;
+  return slot;
+}
 
-    // Add the samples to the output.
-    if (children[i] == nullptr) {
-      out.splice(out.end(), lazyIRVBallots(parameters, mnomCounts[i], path,
-                                           depth + 1, engine));
-    } else {
-      out.splice(out.end(), children[i]->sample(mnomCounts[i], path, engine));
-    }
-    std::swap(path[depth], path[depth + i]);
+IRVNode *IRVNode::mutableChild(unsigned slot, IRVParameters *parameters,
+                               Arena *arena) {
+  if (children[slot] == nullptr) {
+    children[slot] = arena->create<IRVNode>(depth + 1, parameters, arena);
+  } else if (children[slot]->owner != arena->getOwner()) {
+    // The child is shared with another tree, so we copy it before it is
+    // modified. Only the nodes on the updated paths are ever copied.
+    children[slot] = arena->create<IRVNode>(*children[slot], arena);
   }
+  return children[slot];
+}
 
+std::list<IRVBallotCount> IRVNode::sample(IRVParameters *parameters,
+                                          unsigned count,
+                                          std::vector<unsigned> path,
+                                          std::mt19937 *engine) {
+  std::list<IRVBallotCount> out = {};
+  auto sink = [&out](const IRVBallot &b, unsigned c) {
+    out.emplace_back(b, c);
+  };
+  IRVWorkspace ws(parameters);
+  ws.path = std::move(path);
+  sample(parameters, count, ws, engine, sink);
   return out;
 }
 
-void IRVNode::update(const IRVBallot &b, std::vector<unsigned> path,
-                     unsigned count) {
+void IRVNode::update(IRVParameters *parameters, const IRVBallot &b,
+                     std::vector<unsigned> path, unsigned count,
+                     Arena *arena) {
   /* We traverse the tree such that at each step, b.preferences and
    * path vectors are exactly equal up to the next index.
    *
@@ -189,33 +171,128 @@ void IRVNode::update(const IRVBallot &b, std::vector<unsigned> path,
   // If the next preference is not defined, then we increment the halting
   // parameter and stop traversing.
   if (depth == b.nPreferences()) {
-    as[nChildren] += count;
+    as[capacity] += count;
     return;
   }
 
   // Determine the next candidate preference.
-  auto it = b.preferences.begin();
-  for (unsigned i = 0; i < depth; ++i) ++it;
-  unsigned nextCandidate = *it;
+  unsigned nextCandidate = b[depth];
 
   // Find the index of the next candidate, and increment the corresponding
   // parameter.
   unsigned i = depth;
   while (path[i] != nextCandidate) ++i;
   unsigned next_idx = i - depth;
-  as[next_idx] += count;
+  unsigned slot = slotFor(next_idx, arena);
+  as[slot] += count;
 
   // Stop traversing if the number of children is 2, since we don't need to
   // access the leaves.
   if (nChildren == 2) return;
 
   // If the next node is uninitialized, we create a new one with one less
-  // candidate to choose from.
-  if (children[next_idx] == nullptr)
-    children[next_idx] = new IRVNode(depth + 1, parameters);
+  // candidate to choose from, and if it is shared we copy it.
+  IRVNode *child = mutableChild(slot, parameters, arena);
 
   // Recursively update the following children down the path, updating the
   // path as we go.
   std::swap(path[depth], path[i]);
-  children[next_idx]->update(b, path);
+  child->update(parameters, b, path, count, arena);
+}
+
+void IRVNode::merge(IRVParameters *parameters, const IRVNode &other,
+                    Arena *arena) {
+  as[capacity] += other.as[other.capacity];
+
+  for (unsigned k = 0; k < other.nSlots; ++k) {
+    if (other.as[k] == 0. && other.children[k] == nullptr) continue;
+    unsigned slot = slotFor(other.getSlotIndex(k), arena);
+    as[slot] += other.as[k];
+    if (other.children[k] == nullptr) continue;
+    if (children[slot] == nullptr) {
+      // The other sub-tree is frozen, so we can share it until it is updated.
+      children[slot] = other.children[k];
+    } else {
+      // Both trees have observed this sub-tree, so it is copied if shared and
+      // then merged. A sub-tree shared by both trees (for example, after
+      // cloning) has its' parameters doubled, like any other observations.
+      mutableChild(slot, parameters, arena)
+          ->merge(parameters, *other.children[k], arena);
+    }
+  }
+}
+
+void IRVNode::partition(IRVParameters *parameters,
+                        const IRVBallotCount *const *first,
+                        const IRVBallotCount *const *last,
+                        std::vector<unsigned> &path, Arena *arena,
+                        size_t maxTaskSize, std::vector<UpdateTask> &tasks) {
+  // This follows the batch update, except that the children are updated by
+  // the tasks.
+  const IRVBallotCount *const *it = first;
+  for (; it != last && (*it)->first.nPreferences() == depth; ++it)
+    as[capacity] += (*it)->second;
+
+  while (it != last) {
+    unsigned nextCandidate = (*it)->first[depth];
+    const IRVBallotCount *const *groupEnd = it;
+    unsigned count = 0;
+    for (; groupEnd != last && (*groupEnd)->first[depth] == nextCandidate;
+         ++groupEnd)
+      count += (*groupEnd)->second;
+
+    unsigned i = depth;
+    while (path[i] != nextCandidate) ++i;
+    unsigned next_idx = i - depth;
+    unsigned slot = slotFor(next_idx, arena);
+    as[slot] += count;
+
+    if (nChildren > 2) {
+      IRVNode *child = mutableChild(slot, parameters, arena);
+      std::swap(path[depth], path[i]);
+      if (static_cast<size_t>(groupEnd - it) > maxTaskSize) {
+        child->partition(parameters, it, groupEnd, path, arena, maxTaskSize,
+                         tasks);
+      } else {
+        tasks.push_back({child, it, groupEnd, path});
+      }
+      std::swap(path[depth], path[i]);
+    }
+    it = groupEnd;
+  }
+}
+
+void IRVNode::update(IRVParameters *parameters,
+                     const IRVBallotCount *const *first,
+                     const IRVBallotCount *const *last,
+                     std::vector<unsigned> &path, Arena *arena) {
+  // The ballots which end at this node sort before their extensions.
+  const IRVBallotCount *const *it = first;
+  for (; it != last && (*it)->first.nPreferences() == depth; ++it)
+    as[capacity] += (*it)->second;
+
+  // The remaining ballots are grouped by their next preference.
+  while (it != last) {
+    unsigned nextCandidate = (*it)->first[depth];
+    const IRVBallotCount *const *groupEnd = it;
+    unsigned count = 0;
+    for (; groupEnd != last && (*groupEnd)->first[depth] == nextCandidate;
+         ++groupEnd)
+      count += (*groupEnd)->second;
+
+    unsigned i = depth;
+    while (path[i] != nextCandidate) ++i;
+    unsigned next_idx = i - depth;
+    unsigned slot = slotFor(next_idx, arena);
+    as[slot] += count;
+
+    // As for a single ballot, the leaves below two children are not stored.
+    if (nChildren > 2) {
+      IRVNode *child = mutableChild(slot, parameters, arena);
+      std::swap(path[depth], path[i]);
+      child->update(parameters, it, groupEnd, path, arena);
+      std::swap(path[depth], path[i]);
+    }
+    it = groupEnd;
+  }
 }
@@ -11,12 +11,17 @@
 #ifndef IRV_NODE_H
 #define IRV_NODE_H
 
+#include <algorithm>
+#include <cstdint>
 #include <list>
+#include <numeric>
 #include <random>
+#include <type_traits>
 #include <vector>
 
 #include "distributions.h"
 #include "irv_ballot.h"
+#include "philox.h"
 #include "tree_node.h"
 
 class IRVParameters : Parameters {
@@ -92,6 +97,27 @@ class IRVParameters : Parameters {
    */
   unsigned getNCandidates() { return nCandidates; }
 
+  /*! \brief Gets a key for storing an observed ballot.
+   *
+   *  The key is the rank of the ballot when every rank fits in 64 bits, and
+   * otherwise a hash of the ballot.
+   *
+   * \param b The ballot.
+   *
+   * \return A 64-bit key for the ballot.
+   */
+  uint64_t outcomeKey(const IRVBallot &b) {
+    return exactOutcomeKeys() ? b.rank(nCandidates) : b.hash();
+  }
+
+  /*! \brief Indicates whether distinct ballots always have distinct keys.
+   *
+   * \return True if `outcomeKey` returns the rank of each ballot.
+   */
+  bool exactOutcomeKeys() {
+    return nCandidates <= IRVBallot::MAX_RANKED_CANDIDATES;
+  }
+
   /*! \brief Gets the minimum depth.
    *
    * \return Returns the minimum number of candidates which must be specified
@@ -151,8 +177,260 @@ class IRVParameters : Parameters {
    * \param a0_ The new prior parameter for the uniform Dirichlet-tree.
    */
   void setVD(bool vd_) { vd = vd_; };
+
+  /*! \brief Checks whether two IRV trees can be merged.
+   *
+   *  Trees are compatible if they have the same number of candidates, the
+   * same ballot lengths and the same prior, so that the sum of their
+   * posterior parameters is the posterior having observed both sets of
+   * ballots.
+   *
+   * \param other The parameters of another tree.
+   *
+   * \return True if the parameters are compatible.
+   */
+  bool compatible(IRVParameters *other) {
+    return nCandidates == other->nCandidates && minDepth == other->minDepth &&
+           maxDepth == other->maxDepth && a0 == other->a0 && vd == other->vd;
+  }
+};
+
+/*! \brief Scratch memory for sampling ballots from an IRV Dirichlet-tree.
+ *
+ *  The sampling recursion and the distribution kernels write into these
+ * buffers rather than allocating their own, so that repeatedly sampling from a
+ * tree performs no heap allocations. A workspace must not be shared between
+ * threads.
+ */
+class IRVWorkspace {
+ public:
+  // The path to the current node, as a permutation on the candidates. The
+  // recursion swaps elements as it descends and swaps them back as it returns,
+  // so this is the default path between calls.
+  std::vector<unsigned> path;
+
+  // Scratch for the Dirichlet probabilities at the current node.
+  std::vector<double> probs;
+
+  // Scratch for the parameters of every outcome of a sparse node.
+  std::vector<double> alphas;
+
+  // The multinomial counts for each depth of the recursion, in rows of
+  // `stride` elements. These need to persist while the children are sampled.
+  std::vector<unsigned> counts;
+
+  // The number of elements in each row of `counts`.
+  unsigned stride;
+
+  /*! \brief Constructs a workspace for sampling from a tree.
+   *
+   * \param params The parameters of the tree to be sampled from. The workspace
+   * is valid for as long as the number of candidates does not change.
+   *
+   * \return A workspace with all buffers allocated.
+   */
+  explicit IRVWorkspace(IRVParameters *params)
+      : path(params->defaultPath()),
+        probs(params->getNCandidates() + 1),
+        alphas(params->getNCandidates() + 1),
+        counts((params->getNCandidates() + 1) * (params->getNCandidates() + 1)),
+        stride(params->getNCandidates() + 1) {}
+
+  /*! \brief Returns the row of multinomial counts for a given depth.
+   *
+   * \param depth The depth in the tree.
+   *
+   * \return A pointer to `stride` counts reserved for the given depth.
+   */
+  unsigned *countsAt(unsigned depth) { return counts.data() + depth * stride; }
 };
 
+/*! \brief Scratch memory for sampling several realisations of an IRV
+ * Dirichlet-tree in one traversal.
+ *
+ *  The counts of each lane are stored together for each outcome, so the
+ * counts of a child in every lane are contiguous. A workspace must not be
+ * shared between threads.
+ */
+class IRVLaneWorkspace {
+ public:
+  // The largest number of lanes which can be sampled at once.
+  static constexpr unsigned MAX_LANES = 16;
+
+  // The scalar workspace, whose path is shared by every lane.
+  IRVWorkspace ws;
+
+  // The maximum number of lanes.
+  unsigned lanes;
+
+  // Scratch for the Dirichlet probabilities at the current node.
+  std::vector<double> probs;
+
+  // The multinomial counts for each depth of the recursion, in rows of
+  // `(lanes + 1) * ws.stride` elements.
+  std::vector<unsigned> counts;
+
+  /*! \brief Constructs a workspace for sampling from a tree.
+   *
+   * \param params The parameters of the tree to be sampled from.
+   *
+   * \param lanes_ The maximum number of lanes to sample at once, which is at
+   * most MAX_LANES.
+   *
+   * \return A workspace with all buffers allocated.
+   */
+  IRVLaneWorkspace(IRVParameters *params, unsigned lanes_)
+      : ws(params),
+        lanes(lanes_),
+        probs((lanes_ + 1) * ws.stride),
+        counts((lanes_ + 1) * ws.stride * (ws.stride + 1)) {}
+
+  /*! \brief Returns the counts for a given depth.
+   *
+   * \param depth The depth in the tree.
+   *
+   * \return A pointer to the counts reserved for the given depth.
+   */
+  unsigned *countsAt(unsigned depth) {
+    return counts.data() + depth * (lanes + 1) * ws.stride;
+  }
+};
+
+/*! \brief The compile-time properties of the trees which a sampling kernel
+ * is specialised for.
+ *
+ *  The sampling recursions are instantiated for each shape, so that the
+ * structure of the prior is fixed at compile time and, when the number of
+ * candidates is bounded, the buffers for each node are arrays in its' stack
+ * frame. `dispatchIRVShape` chooses the shape for a set of parameters.
+ *
+ * \tparam MaxC An upper bound on the number of candidates, or zero if the
+ * buffers are taken from the workspace.
+ *
+ * \tparam VD Whether the prior reduces to a vanilla Dirichlet distribution.
+ */
+template <unsigned MaxC, bool VD>
+struct IRVShape {
+  static constexpr unsigned MAX_CANDIDATES = MaxC;
+
+  /*! \brief Gets the prior parameter of each outcome at a depth.
+   *
+   * \param params The IRV distribution parameters, whose vd flag is VD.
+   *
+   * \param depth The depth in the tree.
+   *
+   * \return The prior parameter, scaled by the depth factor if VD is set.
+   */
+  static double prior(IRVParameters *params, unsigned depth) {
+    if constexpr (VD) {
+      return params->getA0() * params->depthFactor(depth);
+    } else {
+      return params->getA0();
+    }
+  }
+};
+
+/*! \brief Calls a function with the sampling shape for a set of parameters.
+ *
+ * \param params The IRV distribution parameters.
+ *
+ * \param f A generic callable, invoked as `f(IRVShape<MaxC, VD>{})`, where
+ * MaxC is chosen by dispatchMaxCandidates.
+ */
+template <typename F>
+inline void dispatchIRVShape(IRVParameters *params, F &&f) {
+  bool vd = params->getVD();
+  dispatchMaxCandidates(params->getNCandidates(), [&](auto maxC) {
+    constexpr unsigned MaxC = decltype(maxC)::value;
+    if (vd) {
+      f(IRVShape<MaxC, true>{});
+    } else {
+      f(IRVShape<MaxC, false>{});
+    }
+  });
+}
+
+/*! \brief The buffers for the Dirichlet-multinomial draw at a node.
+ *
+ *  The counts must persist while the children are sampled. For a bounded
+ * number of candidates the buffers are arrays in the stack frame of the node,
+ * and otherwise they are taken from the workspace.
+ */
+template <unsigned MaxC>
+struct IRVNodeBuffers {
+  unsigned counts[MaxC + 1];
+  double probs[MaxC + 1];
+  double alphas[MaxC + 1];
+
+  IRVNodeBuffers(IRVWorkspace &, unsigned) {}
+};
+
+template <>
+struct IRVNodeBuffers<0> {
+  unsigned *counts;
+  double *probs;
+  double *alphas;
+
+  IRVNodeBuffers(IRVWorkspace &ws, unsigned depth)
+      : counts(ws.countsAt(depth)),
+        probs(ws.probs.data()),
+        alphas(ws.alphas.data()) {}
+};
+
+/*! \brief Passes a sampled ballot to a sink.
+ *
+ *  Sinks which accept the raw candidate indices, such as an IRVBallotTable,
+ * are invoked as `sink(prefs, n, count)`, which avoids constructing an
+ * IRVBallot. Otherwise the sink is invoked as `sink(ballot, count)`.
+ *
+ * \param sink The sink to emit the ballot to.
+ *
+ * \param path The path to the node, whose first n elements are the ballot.
+ *
+ * \param n The number of preferences in the ballot.
+ *
+ * \param count The number of times the ballot was sampled.
+ */
+template <typename Sink>
+inline void emitIRVBallot(Sink &sink, const std::vector<unsigned> &path,
+                          unsigned n, unsigned count);
+
+/*! \brief Simulate random ballots from a uniform Dirichlet-tree starting from
+ * an incomplete ballot.
+ *
+ *  Simulates random ballots, starting from an internal state in the IRV
+ * stochastic process, and emits each distinct ballot to a sink.
+ *
+ * \param params The IRVParameters for the election.
+ *
+ * \param count The number of ballots to sample.
+ *
+ * \param depth The current depth in the Dirichlet-tree.
+ *
+ * \param ws The workspace for sampling, whose `path` holds the path to the
+ * internal node representing the incomplete ballot.
+ *
+ * \param engine A PRNG for sampling.
+ *
+ * \param sink A sink for each valid IRV ballot sampled from the sub-tree
+ * uniquely specified by the arguments, as for emitIRVBallot.
+ */
+template <typename Engine, typename Sink>
+void lazyIRVBallots(IRVParameters *params, unsigned count, unsigned depth,
+                    IRVWorkspace &ws, Engine *engine, Sink &sink);
+
+/*! \brief Simulate random ballots from a uniform Dirichlet-tree starting from
+ * an incomplete ballot, with a kernel specialised for a shape of tree.
+ *
+ *  Equivalent to the overload without a shape, which dispatches to this one.
+ *
+ * \param shape The IRVShape of the tree, which must admit params.
+ */
+template <typename Shape, typename Engine, typename Sink>
+void lazyIRVBallots(Shape shape, IRVParameters *params, unsigned count,
+                    unsigned depth, IRVWorkspace &ws, Engine *engine,
+                    Sink &sink);
+
 /*! \brief Simulate random ballots from a uniform Dirichlet-tree starting from
  * an incomplete ballot.
  *
@@ -173,13 +451,45 @@ class IRVParameters : Parameters {
  * \return A list of valid IRV ballots from the sub-tree uniquely specified by
  * the arguments.
  */
-std::list<IRVBallotCount> lazyIRVBallots(IRVParameters params, unsigned count,
+std::list<IRVBallotCount> lazyIRVBallots(IRVParameters *params, unsigned count,
                                          std::vector<unsigned> path,
                                          unsigned depth, std::mt19937 *engine);
 
+class IRVSplit;
+class IRVFrozenTree;
+
 class IRVNode : public TreeNode<IRVBallot, IRVNode, IRVParameters> {
  public:
   using NodeP = IRVNode *;
+  using Workspace = IRVWorkspace;
+  using LaneWorkspace = IRVLaneWorkspace;
+  using Split = IRVSplit;
+  using Frozen = IRVFrozenTree;
+
+  // Nodes with at most this many children store every child. Nodes with more
+  // children only store those which have been observed, in order of their
+  // index. A full sparse node doubles its' capacity, unless it already has
+  // room for more than an eighth of its' children, in which case it becomes
+  // dense.
+  static constexpr unsigned DENSE_MAX_CHILDREN = 8;
+
+  // The number of children a new sparse node has room for.
+  static constexpr unsigned SPARSE_MIN_SLOTS = 2;
+
+  /*! \brief A sub-tree to be updated with part of a sorted batch of ballots.
+   *
+   *  The sub-trees of separate tasks are disjoint, so they can be updated on
+   * separate threads.
+   */
+  struct UpdateTask {
+    // The root of the sub-tree, which is owned by the tree.
+    IRVNode *node;
+    // The ballots which pass through the node.
+    const IRVBallotCount *const *first;
+    const IRVBallotCount *const *last;
+    // The path to the node.
+    std::vector<unsigned> path;
+  };
 
   /*! \brief Constructs a new IRVNode.
    *
@@ -194,15 +504,91 @@ class IRVNode : public TreeNode<IRVBallot, IRVNode, IRVParameters> {
    * \param depth_ The depth of this node in the tree.
    *
    * \param parameters A pointer to the object containing the IRV
-   * distribution parameters.
+   * distribution parameters. The node does not keep the pointer.
+   *
+   * \param arena The Arena from which the parameter and child arrays are
+   * allocated.
    *
    * \return Returns a new IRV node.
    */
-  IRVNode(unsigned depth_, IRVParameters *parameters_);
+  IRVNode(unsigned depth_, IRVParameters *parameters, Arena *arena);
+
+  /*! \brief Copies an IRVNode into another arena.
+   *
+   *  The parameters and child pointers are copied, so the copy shares its'
+   * children with the original node. This is used to copy the nodes on the
+   * path to an update when the tree does not own them.
+   *
+   * \param node The node to copy.
+   *
+   * \param arena The Arena which owns the copy and its' arrays.
+   *
+   * \return Returns a copy of the node.
+   */
+  IRVNode(const IRVNode &node, Arena *arena);
+
+  // Getters, for serialising the tree.
+
+  /*! \brief Gets the Dirichlet parameter of an outcome.
+   *
+   * \param i The index of the child, or nChildren for the terminal outcome.
+   *
+   * \return The parameter, which is zero for a child which is not stored.
+   */
+  double getA(unsigned i) const;
 
-  /*! \brief Destroys the node and its' sub-tree.
+  /*! \brief Gets a child of the node.
+   *
+   * \param i The index of the child.
+   *
+   * \return A pointer to the child, or null if it has not been initialized.
+   */
+  const IRVNode *getChild(unsigned i) const;
+
+  /*! \brief Indicates whether the node only stores its' observed children.
+   *
+   * \return True if the node is sparse.
    */
-  ~IRVNode();
+  bool isSparse() const { return capacity < nChildren; }
+
+  /*! \brief Gets the number of children stored by the node.
+   *
+   * \return The number of slots in use, which is nChildren for a dense node.
+   */
+  unsigned getNSlots() const { return nSlots; }
+
+  /*! \brief Gets the index of the child stored in a slot.
+   *
+   * \param k The slot, less than getNSlots(). The indices of the slots are
+   * increasing.
+   *
+   * \return The index of the child.
+   */
+  unsigned getSlotIndex(unsigned k) const {
+    return isSparse() ? indices()[k] : k;
+  }
+
+  /*! \brief Gets the Dirichlet parameter of the child stored in a slot.
+   *
+   * \param k The slot, less than getNSlots().
+   *
+   * \return The parameter of the child.
+   */
+  double getSlotA(unsigned k) const { return as[k]; }
+
+  /*! \brief Gets the child stored in a slot.
+   *
+   * \param k The slot, less than getNSlots().
+   *
+   * \return A pointer to the child, or null if it has not been initialized.
+   */
+  const IRVNode *getSlotChild(unsigned k) const { return children[k]; }
+
+  /*! \brief Gets the Dirichlet parameter of the terminal outcome.
+   *
+   * \return The parameter for ballots which end at this node.
+   */
+  double getTerminalA() const { return as[capacity]; }
 
   /*! \brief Samples valid ballots from the sub-tree.
    *
@@ -210,6 +596,8 @@ class IRVNode : public TreeNode<IRVBallot, IRVNode, IRVParameters> {
    * interface for sampling completed ballots from the starting point
    * represented by this node.
    *
+   * \param parameters The IRV distribution parameters of the tree.
+   *
    * \param count The number of ballots to sample.
    *
    * \param path The path to this node, represented by a permutation on the
@@ -219,23 +607,723 @@ class IRVNode : public TreeNode<IRVBallot, IRVNode, IRVParameters> {
    *
    * \return A list of (ballot, count) pairs sampled from the subtree.
    */
-  std::list<IRVBallotCount> sample(unsigned count, std::vector<unsigned> path,
+  std::list<IRVBallotCount> sample(IRVParameters *parameters, unsigned count,
+                                   std::vector<unsigned> path,
                                    std::mt19937 *engine);
 
+  /*! \brief Samples valid ballots from the sub-tree into a sink.
+   *
+   *  Equivalent to the list-returning overload, but each (ballot, count) pair
+   * is passed to the sink as soon as it is sampled, so no intermediate
+   * containers are built. The sink chooses how to store the output, for
+   * example in a contiguous buffer or as candidate tallies.
+   *
+   * \param parameters The IRV distribution parameters of the tree.
+   *
+   * \param count The number of ballots to sample.
+   *
+   * \param ws The workspace for sampling, whose `path` holds the path to this
+   * node, represented by a permutation on the candidates.
+   *
+   * \param engine A PRNG for random sampling.
+   *
+   * \param sink A sink for each distinct ballot sampled from the subtree, as
+   * for emitIRVBallot.
+   */
+  template <typename Engine, typename Sink>
+  void sample(IRVParameters *parameters, unsigned count, IRVWorkspace &ws,
+              Engine *engine, Sink &sink);
+
+  /*! \brief Samples valid ballots from the sub-tree into a sink, with a
+   * kernel specialised for a shape of tree.
+   *
+   *  Equivalent to the overload without a shape, which dispatches to this
+   * one.
+   *
+   * \param shape The IRVShape of the tree, which must admit parameters.
+   */
+  template <typename Shape, typename Engine, typename Sink>
+  void sample(Shape shape, IRVParameters *parameters, unsigned count,
+              IRVWorkspace &ws, Engine *engine, Sink &sink);
+
+  /*! \brief Samples ballots from the subtree for several lanes at once.
+   *
+   *  Traverses the subtree once for every lane, so that each node is read
+   * once rather than once per lane. Each lane samples exactly the ballots
+   * which `sample` would sample with its' engine, in the same order.
+   *
+   * \param parameters The IRV distribution parameters of the tree.
+   *
+   * \param lanes The number of lanes.
+   *
+   * \param count The number of ballots to sample in each lane, which must be
+   * positive.
+   *
+   * \param ws The workspace for sampling, whose `ws.path` holds the path to
+   * this node.
+   *
+   * \param engines A PRNG for each lane, either mt19937s or Philoxes.
+   *
+   * \param sinks A pointer to a sink for each lane, as for emitIRVBallot.
+   */
+  template <typename Engine, typename Sink>
+  void sampleLanes(IRVParameters *parameters, unsigned lanes,
+                   const unsigned *count, IRVLaneWorkspace &ws,
+                   Engine *const *engines, Sink *const *sinks);
+
+  /*! \brief Samples ballots from the subtree for several lanes at once, with
+   * a kernel specialised for a shape of tree.
+   *
+   *  Equivalent to the overload without a shape, which dispatches to this
+   * one. The lane buffers are too large for the stack, so they are always
+   * taken from the workspace.
+   *
+   * \param shape The IRVShape of the tree, which must admit parameters.
+   */
+  template <typename Shape, typename Engine, typename Sink>
+  void sampleLanes(Shape shape, IRVParameters *parameters, unsigned lanes,
+                   const unsigned *count, IRVLaneWorkspace &ws,
+                   Engine *const *engines, Sink *const *sinks);
+
+  /*! \brief Samples the top levels of the subtree, leaving each sub-tree
+   * below a given depth to be sampled separately.
+   *
+   *  The Dirichlet-multinomial counts are drawn as for `sample`, down to
+   * `splitDepth`. Ballots which terminate above that depth are passed to the
+   * sink, and the count of each sub-tree rooted at that depth (or at an
+   * uninitialized child above it) is recorded as a task in `out`.
+   *
+   * \param parameters The IRV distribution parameters of the tree.
+   *
+   * \param count The number of ballots to sample.
+   *
+   * \param splitDepth The depth of the sub-trees to be sampled separately.
+   *
+   * \param ws The workspace for sampling, whose `path` holds the path to this
+   * node.
+   *
+   * \param engine A PRNG for sampling, either a mt19937 or a Philox.
+   *
+   * \param sink A sink for each ballot sampled above the split, as for
+   * emitIRVBallot.
+   *
+   * \param out The split to record the remaining sub-trees in.
+   */
+  template <typename Engine, typename Sink>
+  void split(IRVParameters *parameters, unsigned count, unsigned splitDepth,
+             IRVWorkspace &ws, Engine *engine, Sink &sink, IRVSplit &out);
+
+  /*! \brief Samples the top levels of the subtree, with a kernel specialised
+   * for a shape of tree.
+   *
+   *  Equivalent to the overload without a shape, which dispatches to this
+   * one.
+   *
+   * \param shape The IRVShape of the tree, which must admit parameters.
+   */
+  template <typename Shape, typename Engine, typename Sink>
+  void split(Shape shape, IRVParameters *parameters, unsigned count,
+             unsigned splitDepth, IRVWorkspace &ws, Engine *engine,
+             Sink &sink, IRVSplit &out);
+
   /*! \brief Updates the parameters in the sub-tree to obtain a posterior.
    *
    *  Given the path to a valid IRV ballot starting from this node, this method
    * updates the parameters along the path to obtain the posterior distribution
-   * having observed this ballot.
+   * having observed this ballot. The node must be owned by the arena.
+   *
+   * \param parameters The IRV distribution parameters of the tree.
    *
    * \param b The ballot to observe.
    *
    * \param path The path to this node.
    *
    * \param count The number of times to observe the ballot.
+   *
+   * \param arena The Arena from which new nodes along the path are allocated.
+   */
+  void update(IRVParameters *parameters, const IRVBallot &b,
+              std::vector<unsigned> path, unsigned count, Arena *arena);
+
+  /*! \brief Updates the sub-tree with a sorted batch of ballots.
+   *
+   *  Equivalent to updating with each ballot in turn, but the ballots are
+   * grouped by their preference at each depth, so each node on a shared
+   * prefix is visited once per batch rather than once per ballot. The node
+   * must be owned by the arena.
+   *
+   * \param parameters The IRV distribution parameters of the tree.
+   *
+   * \param first A pointer to the first (ballot, count) pair. The pairs must
+   * be sorted in increasing order of ballot, and share the preferences given
+   * by the first `depth` elements of path.
+   *
+   * \param last A pointer past the last pair.
+   *
+   * \param path The path to this node. It is permuted while descending, and
+   * restored before returning.
+   *
+   * \param arena The Arena from which new nodes along the paths are allocated.
+   */
+  void update(IRVParameters *parameters, const IRVBallotCount *const *first,
+              const IRVBallotCount *const *last, std::vector<unsigned> &path,
+              Arena *arena);
+
+  /*! \brief Adds the parameters of another sub-tree to this one.
+   *
+   *  Sums the parameters of each pair of corresponding nodes. Children which
+   * have only been initialized in the other sub-tree are shared with it, and
+   * children initialized in both are merged recursively. The node must be
+   * owned by the arena.
+   *
+   * \param parameters The IRV distribution parameters of the tree.
+   *
+   * \param other A node at the same depth and path in another tree.
+   *
+   * \param arena The Arena which owns this node.
    */
-  void update(const IRVBallot &b, std::vector<unsigned> path,
-              unsigned count = 1);
+  void merge(IRVParameters *parameters, const IRVNode &other, Arena *arena);
+
+  /*! \brief Splits a sorted batch of ballots into independent updates.
+   *
+   *  Updates the parameters of this node as for a batch update, and then
+   * creates (or copies) the child for each group of ballots sharing the next
+   * preference. Groups with more than `maxTaskSize` ballots are split again
+   * at the child, and the other groups are added to `tasks`. Updating each
+   * task's node with its' ballots completes the batch update.
+   *
+   * \param parameters The IRV distribution parameters of the tree.
+   *
+   * \param first A pointer to the first (ballot, count) pair, as for a batch
+   * update.
+   *
+   * \param last A pointer past the last pair.
+   *
+   * \param path The path to this node. It is permuted while descending, and
+   * restored before returning.
+   *
+   * \param arena The Arena which owns this node.
+   *
+   * \param maxTaskSize The largest number of ballots in a task, unless the
+   * ballots cannot be split any further.
+   *
+   * \param tasks The tasks to append to.
+   */
+  void partition(IRVParameters *parameters, const IRVBallotCount *const *first,
+                 const IRVBallotCount *const *last,
+                 std::vector<unsigned> &path, Arena *arena, size_t maxTaskSize,
+                 std::vector<UpdateTask> &tasks);
+
+ private:
+  // The number of slots of `as` and `children` in use, and the number
+  // allocated. The terminal parameter follows the slots, at `as[capacity]`. A
+  // dense node stores every child in the slot of its' index, and a node with
+  // fewer slots than children is sparse.
+  uint16_t nSlots;
+  uint16_t capacity;
+
+  /*! \brief Gets the index of the child in each slot of a sparse node.
+   *
+   *  The indices are stored as bytes after the terminal parameter, in the
+   * same array as the parameters.
+   *
+   * \return A pointer to the indices of the slots in use, in increasing order.
+   */
+  uint8_t *indices() const {
+    return reinterpret_cast<uint8_t *>(as + capacity + 1);
+  }
+
+  /*! \brief Allocates the parameters of a node, along with the indices if the
+   * node would be sparse.
+   *
+   * \param slots The number of slots.
+   *
+   * \param arena The Arena from which the parameters are allocated.
+   *
+   * \return A zero-initialized array for the parameters and indices.
+   */
+  double *allocateAs(unsigned slots, Arena *arena) const {
+    size_t n = slots + 1 + (slots < nChildren ? (slots + 7) / 8 : 0);
+    return arena->allocateArray<double>(n);
+  }
+
+  /*! \brief Gets the slot of a child, storing the child if it is not stored.
+   *
+   *  A full sparse node is copied into arrays from the arena with twice the
+   * capacity, or into dense arrays if it has room for more than an eighth of
+   * its' children. The old arrays are released with the arena. The node must
+   * be owned by the arena.
+   *
+   * \param i The index of the child.
+   *
+   * \param arena The Arena which owns this node.
+   *
+   * \return The slot of the child, which is valid until another child is
+   * stored.
+   */
+  unsigned slotFor(unsigned i, Arena *arena);
+
+  /*! \brief Gets the parameters of every outcome for the Dirichlet-multinomial
+   * kernels, which add a0 to each of them.
+   *
+   *  A dense node returns its' own parameters. A sparse node writes a0 plus
+   * the parameter of each outcome to the scratch, and sets a0 to zero, which
+   * gives the kernels identical parameters.
+   *
+   * \param a0 The prior parameter of the outcomes.
+   *
+   * \param scratch Room for nChildren + 1 parameters.
+   *
+   * \return A pointer to the parameters of every outcome.
+   */
+  const double *outcomeAs(double &a0, double *scratch) const {
+    if (!isSparse()) return as;
+    std::fill(scratch, scratch + nChildren, a0);
+    const uint8_t *index = indices();
+    for (unsigned k = 0; k < nSlots; ++k) scratch[index[k]] = a0 + as[k];
+    scratch[nChildren] = a0 + as[capacity];
+    a0 = 0.;
+    return scratch;
+  }
+
+  /*! \brief Gets a child while visiting the children in order of index.
+   *
+   * \param i The index of the child, which must not be less than the index
+   * passed by the previous call with the same cursor.
+   *
+   * \param slot A cursor into the slots, which starts at zero.
+   *
+   * \return A pointer to the child, or null if it has not been initialized.
+   */
+  IRVNode *childAt(unsigned i, unsigned &slot) const {
+    if (!isSparse()) return children[i];
+    const uint8_t *index = indices();
+    while (slot < nSlots && index[slot] < i) ++slot;
+    return slot < nSlots && index[slot] == i ? children[slot] : nullptr;
+  }
+
+  /*! \brief Gets a child which can be updated by the owner of an arena.
+   *
+   *  Creates the child if it has not been initialized, and copies it into the
+   * arena if it is owned by another one, replacing the shared child of this
+   * node with the copy.
+   *
+   * \param slot The slot of the child.
+   *
+   * \param parameters The IRV distribution parameters of the tree.
+   *
+   * \param arena The Arena which owns this node.
+   *
+   * \return A pointer to the child, owned by the arena.
+   */
+  IRVNode *mutableChild(unsigned slot, IRVParameters *parameters,
+                        Arena *arena);
 };
 
+/*! \brief The sub-trees left to sample after splitting a sample at the top
+ * levels of an IRV Dirichlet-tree.
+ *
+ *  Each task samples its' sub-tree with its' own Philox stream, keyed by
+ * `key` and indexed by the task. The ballots sampled by a task therefore do
+ * not depend on which thread samples it, or in which order the tasks are
+ * sampled. Clearing a split keeps the capacity of its' buffers.
+ */
+class IRVSplit {
+ public:
+  struct Task {
+    // The root of the sub-tree, or null if it has not been initialized, in
+    // which case the sub-tree is sampled lazily.
+    IRVNode *node;
+    // The offset of the root of the sub-tree in an IRVFrozenTree instead, if
+    // the split was made from one, or zero if it has not been initialized.
+    uint32_t frozenNode;
+    // The depth of the root of the sub-tree.
+    unsigned depth;
+    // The number of ballots to sample from the sub-tree.
+    unsigned count;
+  };
+
+  // The sub-trees to be sampled.
+  std::vector<Task> tasks{};
+
+  // The path to the root of each sub-tree, in rows of `stride` elements.
+  std::vector<unsigned> paths{};
+
+  // The number of elements in each row of `paths`.
+  unsigned stride;
+
+  // The key of the Philox streams of the tasks.
+  uint64_t key = 0;
+
+  // Whether the tasks refer to the nodes of an IRVFrozenTree, in which case
+  // they are sampled with IRVFrozenTree::sampleTask.
+  bool frozen = false;
+
+  /*! \brief Constructs an empty split.
+   *
+   * \param params The parameters of the tree to be sampled from.
+   *
+   * \return A split with no tasks.
+   */
+  explicit IRVSplit(IRVParameters *params)
+      : stride(params->getNCandidates()) {}
+
+  /*! \brief Removes every task.
+   */
+  void clear() {
+    tasks.clear();
+    paths.clear();
+    frozen = false;
+  }
+
+  /*! \brief Gets the number of tasks.
+   *
+   * \return The number of sub-trees to be sampled.
+   */
+  size_t size() const { return tasks.size(); }
+
+  /*! \brief Records a sub-tree to be sampled.
+   *
+   * \param node The root of the sub-tree, or null if it is uninitialized.
+   *
+   * \param depth The depth of the root of the sub-tree.
+   *
+   * \param count The number of ballots to sample from the sub-tree.
+   *
+   * \param path The path to the root of the sub-tree.
+   */
+  void add(IRVNode *node, unsigned depth, unsigned count,
+           const std::vector<unsigned> &path) {
+    tasks.push_back({node, 0, depth, count});
+    paths.insert(paths.end(), path.begin(), path.end());
+  }
+
+  /*! \brief Records a sub-tree of an IRVFrozenTree to be sampled.
+   *
+   * \param frozenNode The offset of the root of the sub-tree, or zero if it
+   * is uninitialized.
+   *
+   * \param depth The depth of the root of the sub-tree.
+   *
+   * \param count The number of ballots to sample from the sub-tree.
+   *
+   * \param path The path to the root of the sub-tree.
+   */
+  void add(uint32_t frozenNode, unsigned depth, unsigned count,
+           const std::vector<unsigned> &path) {
+    tasks.push_back({nullptr, frozenNode, depth, count});
+    paths.insert(paths.end(), path.begin(), path.end());
+  }
+
+  /*! \brief Samples the sub-tree of a task, for a split made from IRVNodes.
+   *
+   * \param params The IRV distribution parameters of the tree.
+   *
+   * \param i The index of the task.
+   *
+   * \param ws The workspace for sampling, whose `path` is the default path.
+   *
+   * \param sink A sink for each distinct ballot sampled from the sub-tree, as
+   * for emitIRVBallot.
+   */
+  template <typename Sink>
+  void sample(IRVParameters *params, size_t i, IRVWorkspace &ws,
+              Sink &sink) const;
+};
+
+template <typename Sink>
+inline void emitIRVBallot(Sink &sink, const std::vector<unsigned> &path,
+                          unsigned n, unsigned count) {
+  if constexpr (std::is_invocable_v<Sink &, const unsigned *, unsigned,
+                                    unsigned>) {
+    sink(path.data(), n, count);
+  } else {
+    sink(IRVBallot(path.begin(), path.begin() + n), count);
+  }
+}
+
+template <typename Engine, typename Sink>
+void lazyIRVBallots(IRVParameters *params, unsigned count, unsigned depth,
+                    IRVWorkspace &ws, Engine *engine, Sink &sink) {
+  dispatchIRVShape(params, [&](auto shape) {
+    lazyIRVBallots(shape, params, count, depth, ws, engine, sink);
+  });
+}
+
+template <typename Shape, typename Engine, typename Sink>
+void lazyIRVBallots(Shape shape, IRVParameters *params, unsigned count,
+                    unsigned depth, IRVWorkspace &ws, Engine *engine,
+                    Sink &sink) {
+  // Get parameters
+  unsigned nCandidates = params->getNCandidates();
+  double minDepth = params->getMinDepth();
+  double maxDepth = params->getMaxDepth();
+  double a0 = Shape::prior(params, depth);
+
+  std::vector<unsigned> &path = ws.path;
+
+  if (depth == nCandidates - 1 || depth == maxDepth) {
+    // If the ballot is completely specified, emit count * the specified
+    // ballot.
+    emitIRVBallot(sink, path, depth, count);
+    return;
+  }
+
+  unsigned nChildren = nCandidates - depth;
+  unsigned nOutcomes = nChildren + (depth >= minDepth);
+
+  // Otherwise we sample from a Dirichlet-Multinomial distribution to
+  // determine how many ballots we sample from each sub-tree (or how many
+  // ballots terminate).
+
+  // Every outcome has the prior parameter a0, so we use the symmetric form.
+  IRVNodeBuffers<Shape::MAX_CANDIDATES> buffers(ws, depth);
+  unsigned *mnomCounts = buffers.counts;
+  rDirichletMultinomial(count, a0, nullptr, nOutcomes, mnomCounts,
+                        buffers.probs, engine);
+
+  // Emit the ballots which terminate at this node.
+  if (depth >= minDepth && mnomCounts[nOutcomes - 1] > 0)
+    emitIRVBallot(sink, path, depth, mnomCounts[nOutcomes - 1]);
+
+  for (unsigned i = 0; i < nChildren; ++i) {
+    // Skip if there the sampled count for the subtree is zero.
+    if (mnomCounts[i] == 0) continue;
+
+    // Update path for recursive sampling.
+    std::swap(path[depth], path[depth + i]);
+    lazyIRVBallots(shape, params, mnomCounts[i], depth + 1, ws, engine, sink);
+    // Change the path back for further sampling.
+    std::swap(path[depth], path[depth + i]);
+  }
+}
+
+template <typename Engine, typename Sink>
+void IRVNode::sampleLanes(IRVParameters *parameters, unsigned lanes,
+                          const unsigned *count, IRVLaneWorkspace &ws,
+                          Engine *const *engines, Sink *const *sinks) {
+  dispatchIRVShape(parameters, [&](auto shape) {
+    sampleLanes(shape, parameters, lanes, count, ws, engines, sinks);
+  });
+}
+
+template <typename Shape, typename Engine, typename Sink>
+void IRVNode::sampleLanes(Shape shape, IRVParameters *parameters,
+                          unsigned lanes, const unsigned *count,
+                          IRVLaneWorkspace &ws, Engine *const *engines,
+                          Sink *const *sinks) {
+  unsigned minDepth = parameters->getMinDepth();
+  unsigned maxDepth = parameters->getMaxDepth();
+  double a0 = Shape::prior(parameters, depth);
+
+  std::vector<unsigned> &path = ws.ws.path;
+
+  unsigned nOutcomes = nChildren + (depth >= minDepth);
+
+  unsigned *mnomCounts = ws.countsAt(depth);
+  const double *alphas = outcomeAs(a0, ws.ws.alphas.data());
+  rDirichletMultinomialLanes(lanes, count, a0, alphas, nOutcomes, mnomCounts,
+                             ws.probs.data(), engines);
+
+  // Emit terminal node ballots
+  if (depth >= minDepth) {
+    const unsigned *terminal = mnomCounts + nChildren * lanes;
+    for (unsigned k = 0; k < lanes; ++k)
+      if (terminal[k] > 0) emitIRVBallot(*sinks[k], path, depth, terminal[k]);
+  }
+
+  // Emit the completed ballots one preference from the maximum depth.
+  if (depth == maxDepth - 1) {
+    for (unsigned i = 0; i < nChildren; ++i) {
+      std::swap(path[depth], path[depth + i]);
+      for (unsigned k = 0; k < lanes; ++k) {
+        unsigned c = mnomCounts[i * lanes + k];
+        if (c > 0) emitIRVBallot(*sinks[k], path, depth + 1, c);
+      }
+      std::swap(path[depth], path[depth + i]);
+    }
+    return;
+  }
+
+  // Otherwise sample from each subtree in turn. Only the lanes which sample
+  // from a subtree are passed to it, and a single lane is sampled on its' own.
+  // Uninitialized subtrees have no nodes to share between the lanes, so each
+  // lane samples them lazily on its' own.
+  unsigned childCounts[IRVLaneWorkspace::MAX_LANES];
+  Engine *childEngines[IRVLaneWorkspace::MAX_LANES];
+  Sink *childSinks[IRVLaneWorkspace::MAX_LANES];
+  unsigned slot = 0;
+  for (unsigned i = 0; i < nChildren; ++i) {
+    unsigned nActive = 0;
+    for (unsigned k = 0; k < lanes; ++k) {
+      unsigned c = mnomCounts[i * lanes + k];
+      if (c == 0) continue;
+      childCounts[nActive] = c;
+      childEngines[nActive] = engines[k];
+      childSinks[nActive++] = sinks[k];
+    }
+    if (nActive == 0) continue;
+    IRVNode *child = childAt(i, slot);
+    std::swap(path[depth], path[depth + i]);
+    if (child == nullptr) {
+      for (unsigned k = 0; k < nActive; ++k)
+        lazyIRVBallots(shape, parameters, childCounts[k], depth + 1, ws.ws,
+                       childEngines[k], *childSinks[k]);
+    } else if (nActive == 1) {
+      child->sample(shape, parameters, childCounts[0], ws.ws, childEngines[0],
+                    *childSinks[0]);
+    } else {
+      child->sampleLanes(shape, parameters, nActive, childCounts, ws,
+                         childEngines, childSinks);
+    }
+    std::swap(path[depth], path[depth + i]);
+  }
+}
+
+template <typename Engine, typename Sink>
+void IRVNode::sample(IRVParameters *parameters, unsigned count,
+                     IRVWorkspace &ws, Engine *engine, Sink &sink) {
+  dispatchIRVShape(parameters, [&](auto shape) {
+    sample(shape, parameters, count, ws, engine, sink);
+  });
+}
+
+template <typename Shape, typename Engine, typename Sink>
+void IRVNode::sample(Shape shape, IRVParameters *parameters, unsigned count,
+                     IRVWorkspace &ws, Engine *engine, Sink &sink) {
+  unsigned minDepth = parameters->getMinDepth();
+  unsigned maxDepth = parameters->getMaxDepth();
+  double a0 = Shape::prior(parameters, depth);
+
+  std::vector<unsigned> &path = ws.path;
+
+  unsigned nOutcomes = nChildren + (depth >= minDepth);
+
+  // Get Dirichlet-multinomial counts for next-preference selections below
+  // current node, with posterior parameters as + a0.
+  IRVNodeBuffers<Shape::MAX_CANDIDATES> buffers(ws, depth);
+  unsigned *mnomCounts = buffers.counts;
+  const double *alphas = outcomeAs(a0, buffers.alphas);
+  rDirichletMultinomial(count, a0, alphas, nOutcomes, mnomCounts,
+                        buffers.probs, engine);
+
+  // Emit terminal node ballots
+  if (depth >= minDepth && mnomCounts[nChildren] > 0)
+    emitIRVBallot(sink, path, depth, mnomCounts[nChildren]);
+
+  // If the ballot is one preference from being completely specified, emit the
+  // completed ballots.
+  if (depth == maxDepth - 1) {
+    for (unsigned i = 0; i < nChildren; ++i) {
+      // Skip if there the sampled count for the ballot is zero.
+      if (mnomCounts[i] == 0) continue;
+
+      std::swap(path[depth], path[depth + i]);
+      emitIRVBallot(sink, path, depth + 1, mnomCounts[i]);
+      std::swap(path[depth], path[depth + i]);
+    }
+    // Return early since there are no child nodes to sample from.
+    return;
+  }
+
+  // Otherwise we continue recursively sampling from subtrees. If a subtree is
+  // not specified, then we lazily generate samples from a uniform dirichlet
+  // tree.
+  unsigned slot = 0;
+  for (unsigned i = 0; i < nChildren; ++i) {
+    // Skip if there the sampled count for the subtree is zero.
+    if (mnomCounts[i] == 0) continue;
+
+    // Sample from the next subtree.
+    IRVNode *child = childAt(i, slot);
+    std::swap(path[depth], path[depth + i]);
+    if (child == nullptr) {
+      lazyIRVBallots(shape, parameters, mnomCounts[i], depth + 1, ws, engine,
+                     sink);
+    } else {
+      child->sample(shape, parameters, mnomCounts[i], ws, engine, sink);
+    }
+    std::swap(path[depth], path[depth + i]);
+  }
+}
+
+template <typename Engine, typename Sink>
+void IRVNode::split(IRVParameters *parameters, unsigned count,
+                    unsigned splitDepth, IRVWorkspace &ws, Engine *engine,
+                    Sink &sink, IRVSplit &out) {
+  dispatchIRVShape(parameters, [&](auto shape) {
+    split(shape, parameters, count, splitDepth, ws, engine, sink, out);
+  });
+}
+
+template <typename Shape, typename Engine, typename Sink>
+void IRVNode::split(Shape shape, IRVParameters *parameters, unsigned count,
+                    unsigned splitDepth, IRVWorkspace &ws, Engine *engine,
+                    Sink &sink, IRVSplit &out) {
+  unsigned minDepth = parameters->getMinDepth();
+  unsigned maxDepth = parameters->getMaxDepth();
+  double a0 = Shape::prior(parameters, depth);
+
+  std::vector<unsigned> &path = ws.path;
+
+  unsigned nOutcomes = nChildren + (depth >= minDepth);
+
+  IRVNodeBuffers<Shape::MAX_CANDIDATES> buffers(ws, depth);
+  unsigned *mnomCounts = buffers.counts;
+  const double *alphas = outcomeAs(a0, buffers.alphas);
+  rDirichletMultinomial(count, a0, alphas, nOutcomes, mnomCounts,
+                        buffers.probs, engine);
+
+  // Emit terminal node ballots
+  if (depth >= minDepth && mnomCounts[nChildren] > 0)
+    emitIRVBallot(sink, path, depth, mnomCounts[nChildren]);
+
+  // Emit the completed ballots one preference from the maximum depth, since
+  // there are no sub-trees left to split.
+  if (depth == maxDepth - 1) {
+    for (unsigned i = 0; i < nChildren; ++i) {
+      if (mnomCounts[i] == 0) continue;
+      std::swap(path[depth], path[depth + i]);
+      emitIRVBallot(sink, path, depth + 1, mnomCounts[i]);
+      std::swap(path[depth], path[depth + i]);
+    }
+    return;
+  }
+
+  // Record each sub-tree at the split depth as a task. Uninitialized
+  // sub-trees are sampled lazily, so they are not split any further.
+  unsigned slot = 0;
+  for (unsigned i = 0; i < nChildren; ++i) {
+    if (mnomCounts[i] == 0) continue;
+    IRVNode *child = childAt(i, slot);
+    std::swap(path[depth], path[depth + i]);
+    if (depth + 1 >= splitDepth || child == nullptr) {
+      out.add(child, depth + 1, mnomCounts[i], path);
+    } else {
+      child->split(shape, parameters, mnomCounts[i], splitDepth, ws, engine,
+                   sink, out);
+    }
+    std::swap(path[depth], path[depth + i]);
+  }
+}
+
+template <typename Sink>
+void IRVSplit::sample(IRVParameters *params, size_t i, IRVWorkspace &ws,
+                      Sink &sink) const {
+  const Task &task = tasks[i];
+  Philox engine(key, i);
+  std::copy(paths.begin() + i * stride, paths.begin() + (i + 1) * stride,
+            ws.path.begin());
+  dispatchIRVShape(params, [&](auto shape) {
+    if (task.node == nullptr) {
+      lazyIRVBallots(shape, params, task.count, task.depth, ws, &engine,
+                     sink);
+    } else {
+      task.node->sample(shape, params, task.count, ws, &engine, sink);
+    }
+  });
+  // Restore the default path.
+  std::iota(ws.path.begin(), ws.path.end(), 0u);
+}
+
 #endif /* IRV_NODE_H */
@@ -0,0 +1,386 @@
+/******************************************************************************
+ * File:             irv_snapshot.cpp
+ *
+ * Author:           Floyd Everest <me@floydeverest.com>
+ * Created:          10/16/26
+ * Description:      This file implements the IRVSnapshot methods as outlined
+ *                   in `irv_snapshot.h`.
+ *****************************************************************************/
+
+#include "irv_snapshot.h"
+
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+const char MAGIC[8] = {'D', 'T', 'R', 'E', 'E', 'S', 'N', 'P'};
+
+// Rounds a size up to a multiple of 8 bytes.
+uint64_t align8(uint64_t n) { return (n + 7) & ~uint64_t(7); }
+
+// A checksum over 8-byte words. Four independent lanes are mixed with
+// multiplications so that the checksum runs at close to memory bandwidth.
+class Checksum {
+ private:
+  uint64_t lanes[4] = {0x243F6A8885A308D3ull, 0x13198A2E03707344ull,
+                       0xA4093822299F31D0ull, 0x082EFA98EC4E6C89ull};
+  uint64_t nWords = 0;
+
+ public:
+  // Adds n bytes, where n is a multiple of 8.
+  void update(const void *data, uint64_t n) {
+    const unsigned char *p = static_cast<const unsigned char *>(data);
+    for (uint64_t i = 0; i < n; i += 8, ++nWords) {
+      uint64_t w;
+      std::memcpy(&w, p + i, 8);
+      uint64_t &lane = lanes[nWords & 3];
+      lane = (lane ^ w) * 0x9E3779B97F4A7C15ull;
+      lane ^= lane >> 29;
+    }
+  }
+
+  uint64_t digest() const {
+    uint64_t h = nWords;
+    for (uint64_t lane : lanes) {
+      h = (h ^ lane) * 0xBF58476D1CE4E5B9ull;
+      h ^= h >> 31;
+    }
+    return h;
+  }
+};
+
+// Writes bytes to a file, throwing on failure.
+void writeBytes(std::FILE *file, const void *data, uint64_t n,
+                const std::string &path) {
+  if (n > 0 && std::fwrite(data, 1, n, file) != n)
+    throw std::runtime_error("Could not write to snapshot file '" + path +
+                             "'.");
+}
+
+// A section of the file, which is written from memory and padded to 8 bytes.
+struct Section {
+  const void *data;
+  uint64_t size;
+};
+
+}  // namespace
+
+IRVSnapshot::IRVSnapshot(const std::string &path) {
+  load(path);
+  try {
+    validate(path);
+  } catch (...) {
+    // The destructor does not run if the constructor throws.
+    unmap();
+    throw;
+  }
+}
+
+IRVSnapshot::~IRVSnapshot() { unmap(); }
+
+void IRVSnapshot::load(const std::string &path) {
+#ifndef _WIN32
+  // Map the file, so that its' pages are only read as they are sampled.
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd >= 0) {
+    struct stat st;
+    if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+      void *p = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p != MAP_FAILED) {
+        mapping = p;
+        data = static_cast<const unsigned char *>(p);
+        size = st.st_size;
+      }
+    }
+    ::close(fd);
+    if (mapping != nullptr) return;
+  }
+#endif
+
+  // Otherwise, read the whole file into memory.
+  std::FILE *file = std::fopen(path.c_str(), "rb");
+  if (file == nullptr)
+    throw std::runtime_error("Could not open snapshot file '" + path + "'.");
+  std::vector<unsigned char> chunk(1 << 20);
+  size_t n;
+  while ((n = std::fread(chunk.data(), 1, chunk.size(), file)) > 0) {
+    buffer.resize(align8(size + n) / 8);
+    std::memcpy(reinterpret_cast<unsigned char *>(buffer.data()) + size,
+                chunk.data(), n);
+    size += n;
+  }
+  bool failed = std::ferror(file);
+  std::fclose(file);
+  if (failed)
+    throw std::runtime_error("Could not read snapshot file '" + path + "'.");
+  data = reinterpret_cast<const unsigned char *>(buffer.data());
+}
+
+void IRVSnapshot::unmap() {
+#ifndef _WIN32
+  if (mapping != nullptr) ::munmap(mapping, size);
+#endif
+  mapping = nullptr;
+}
+
+void IRVSnapshot::validate(const std::string &path) {
+  auto fail = [&path](const std::string &message) {
+    throw std::runtime_error("Invalid snapshot file '" + path + "': " +
+                             message + ".");
+  };
+
+  if (size < sizeof(IRVSnapshotHeader) ||
+      std::memcmp(data, MAGIC, sizeof(MAGIC)) != 0)
+    fail("not a Dirichlet-tree snapshot");
+  header = reinterpret_cast<const IRVSnapshotHeader *>(data);
+  if (header->byteOrder != ENDIAN_MARK)
+    fail("written on a machine with a different byte order");
+  if (header->version != VERSION)
+    fail("unsupported version " + std::to_string(header->version));
+  if (header->fileSize != size) fail("truncated");
+
+  // The checksum covers the header with its' checksum field zeroed.
+  IRVSnapshotHeader zeroed = *header;
+  zeroed.checksum = 0;
+  Checksum checksum;
+  checksum.update(&zeroed, sizeof(IRVSnapshotHeader));
+  checksum.update(data + sizeof(IRVSnapshotHeader),
+                  (size - sizeof(IRVSnapshotHeader)) & ~size_t(7));
+  if (size % 8 != 0 || checksum.digest() != header->checksum)
+    fail("checksum mismatch");
+
+  unsigned nCandidates = header->nCandidates;
+  if (nCandidates < 2 || nCandidates > IRVBallot::MAX_PREFERENCES ||
+      header->minDepth > header->maxDepth ||
+      header->maxDepth > nCandidates || !(header->a0 >= 0))
+    fail("invalid parameters");
+
+  // Checks that a section of n elements of the given size lies in the file.
+  auto section = [&](uint64_t offset, uint64_t n, uint64_t elementSize) {
+    if (offset % 8 != 0 || offset < sizeof(IRVSnapshotHeader) ||
+        offset > size || n > (size - offset) / elementSize)
+      fail("section out of bounds");
+    return data + offset;
+  };
+  const unsigned char *names =
+      section(header->namesOffset, header->nNameBytes, 1);
+  nodes = reinterpret_cast<const IRVSnapshotNode *>(
+      section(header->nodesOffset, header->nNodes, sizeof(IRVSnapshotNode)));
+  as = reinterpret_cast<const double *>(
+      section(header->asOffset, header->nAs, sizeof(double)));
+  children = reinterpret_cast<const uint32_t *>(
+      section(header->childrenOffset, header->nChildren, sizeof(uint32_t)));
+  const uint32_t *counts = reinterpret_cast<const uint32_t *>(section(
+      header->countsOffset, header->nObservations, sizeof(uint32_t)));
+  const uint8_t *lengths =
+      section(header->lengthsOffset, header->nObservations, 1);
+  const uint8_t *prefs = section(header->prefsOffset, header->nPrefs, 1);
+
+  // Decode the candidate names.
+  uint64_t p = 0;
+  for (unsigned c = 0; c < nCandidates; ++c) {
+    uint32_t length;
+    if (header->nNameBytes - p < sizeof(length)) fail("invalid names");
+    std::memcpy(&length, names + p, sizeof(length));
+    p += sizeof(length);
+    if (header->nNameBytes - p < length) fail("invalid names");
+    candidates.emplace_back(reinterpret_cast<const char *>(names + p), length);
+    p += length;
+  }
+
+  // The nodes are stored in pre-order, so every child follows its' parent.
+  // This is checked while assigning depths, which also ensures that each node
+  // is reachable from the root exactly once.
+  if (header->nNodes == 0 || header->nNodes > UINT32_MAX)
+    fail("invalid number of nodes");
+  const unsigned UNSET = std::numeric_limits<unsigned>::max();
+  std::vector<unsigned> depths(header->nNodes, UNSET);
+  depths[0] = 0;
+  for (uint64_t i = 0; i < header->nNodes; ++i) {
+    if (depths[i] == UNSET) fail("unreachable node");
+    unsigned nChildren = nCandidates - depths[i];
+    const IRVSnapshotNode &node = nodes[i];
+    if (node.as > header->nAs || header->nAs - node.as < nChildren + 1)
+      fail("node out of bounds");
+    for (unsigned k = 0; k <= nChildren; ++k)
+      if (!(as[node.as + k] >= 0)) fail("negative parameter");
+    if (nChildren <= 2) continue;
+    if (node.children > header->nChildren ||
+        header->nChildren - node.children < nChildren)
+      fail("node out of bounds");
+    for (unsigned k = 0; k < nChildren; ++k) {
+      uint32_t child = children[node.children + k];
+      if (child == 0) continue;
+      if (child <= i || child >= header->nNodes || depths[child] != UNSET)
+        fail("invalid child");
+      depths[child] = depths[i] + 1;
+    }
+  }
+
+  // Decode the observations.
+  observations.reserve(header->nObservations);
+  std::vector<bool> seen(nCandidates);
+  p = 0;
+  for (uint64_t i = 0; i < header->nObservations; ++i) {
+    if (lengths[i] > nCandidates || header->nPrefs - p < lengths[i])
+      fail("invalid observation");
+    IRVBallot b;
+    for (unsigned k = 0; k < lengths[i]; ++k) {
+      uint8_t c = prefs[p + k];
+      if (c >= nCandidates || seen[c]) fail("invalid observation");
+      seen[c] = true;
+      b.push_back(c);
+    }
+    for (unsigned k = 0; k < lengths[i]; ++k) seen[prefs[p + k]] = false;
+    p += lengths[i];
+    observations.emplace_back(b, counts[i]);
+  }
+}
+
+void IRVSnapshot::write(const std::string &path,
+                        const std::vector<std::string> &candidates,
+                        IRVParameters *params, const IRVNode *root,
+                        const ObservationStore<IRVBallot> &observed,
+                        uint64_t nObserved) {
+  // Flatten the names.
+  std::vector<char> names;
+  for (const std::string &name : candidates) {
+    uint32_t length = name.size();
+    const char *l = reinterpret_cast<const char *>(&length);
+    names.insert(names.end(), l, l + sizeof(length));
+    names.insert(names.end(), name.begin(), name.end());
+  }
+
+  // Flatten the nodes in pre-order. The root is node zero, so zero can mark
+  // an uninitialized child.
+  std::vector<IRVSnapshotNode> nodes;
+  std::vector<double> as;
+  std::vector<uint32_t> children;
+  auto flatten = [&](const IRVNode *node, auto &self) -> uint32_t {
+    if (nodes.size() == UINT32_MAX)
+      throw std::runtime_error("The tree is too large to save.");
+    uint32_t index = nodes.size();
+    unsigned nChildren = node->getNChildren();
+    nodes.push_back({as.size(), children.size()});
+    for (unsigned i = 0; i <= nChildren; ++i) as.push_back(node->getA(i));
+    if (nChildren <= 2) return index;
+    size_t first = children.size();
+    children.resize(first + nChildren, 0);
+    for (unsigned k = 0; k < node->getNSlots(); ++k) {
+      const IRVNode *child = node->getSlotChild(k);
+      if (child != nullptr) {
+        uint32_t c = self(child, self);
+        children[first + node->getSlotIndex(k)] = c;
+      }
+    }
+    return index;
+  };
+  flatten(root, flatten);
+
+  // A forked store may hold a ballot in more than one layer, so those are
+  // merged first to keep the observations unique.
+  ObservationStore<IRVBallot> merged(params->exactOutcomeKeys());
+  if (observed.isForked()) {
+    merged.reserve(observed.size());
+    for (const auto &[b, count] : observed)
+      merged.add(b, params->outcomeKey(b), count);
+  }
+  const ObservationStore<IRVBallot> &unique =
+      observed.isForked() ? merged : observed;
+
+  // Flatten the observations.
+  std::vector<uint32_t> counts;
+  std::vector<uint8_t> lengths;
+  std::vector<uint8_t> prefs;
+  counts.reserve(unique.size());
+  lengths.reserve(unique.size());
+  for (const auto &[b, count] : unique) {
+    counts.push_back(count);
+    lengths.push_back(b.nPreferences());
+    prefs.insert(prefs.end(), b.begin(), b.end());
+  }
+
+  IRVSnapshotHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version = VERSION;
+  header.byteOrder = ENDIAN_MARK;
+  header.nCandidates = params->getNCandidates();
+  header.minDepth = params->getMinDepth();
+  header.maxDepth = params->getMaxDepth();
+  header.vd = params->getVD();
+  header.a0 = params->getA0();
+  header.nObserved = nObserved;
+  header.nNameBytes = names.size();
+  header.nNodes = nodes.size();
+  header.nAs = as.size();
+  header.nChildren = children.size();
+  header.nObservations = counts.size();
+  header.nPrefs = prefs.size();
+
+  // Lay out the sections after the header.
+  Section sections[] = {
+      {names.data(), names.size()},
+      {nodes.data(), nodes.size() * sizeof(IRVSnapshotNode)},
+      {as.data(), as.size() * sizeof(double)},
+      {children.data(), children.size() * sizeof(uint32_t)},
+      {counts.data(), counts.size() * sizeof(uint32_t)},
+      {lengths.data(), lengths.size()},
+      {prefs.data(), prefs.size()}};
+  uint64_t *offsets[] = {&header.namesOffset,    &header.nodesOffset,
+                         &header.asOffset,       &header.childrenOffset,
+                         &header.countsOffset,   &header.lengthsOffset,
+                         &header.prefsOffset};
+  uint64_t offset = sizeof(IRVSnapshotHeader);
+  const uint64_t zeros = 0;
+  for (size_t s = 0; s < 7; ++s) {
+    *offsets[s] = offset;
+    offset += align8(sections[s].size);
+  }
+  header.fileSize = offset;
+
+  // Checksum the header while its' checksum field is still zero, and then
+  // the sections.
+  Checksum checksum;
+  checksum.update(&header, sizeof(header));
+  for (size_t s = 0; s < 7; ++s) {
+    uint64_t n = sections[s].size & ~uint64_t(7);
+    uint64_t padded = align8(sections[s].size);
+    checksum.update(sections[s].data, n);
+    if (padded > n) {
+      // Checksum the final partial word with its' zero padding.
+      uint64_t last = 0;
+      std::memcpy(&last, static_cast<const char *>(sections[s].data) + n,
+                  sections[s].size - n);
+      checksum.update(&last, 8);
+    }
+  }
+  header.checksum = checksum.digest();
+
+  std::FILE *file = std::fopen(path.c_str(), "wb");
+  if (file == nullptr)
+    throw std::runtime_error("Could not create snapshot file '" + path + "'.");
+  try {
+    writeBytes(file, &header, sizeof(header), path);
+    for (const Section &section : sections) {
+      writeBytes(file, section.data, section.size, path);
+      writeBytes(file, &zeros, align8(section.size) - section.size, path);
+    }
+  } catch (...) {
+    std::fclose(file);
+    throw;
+  }
+  if (std::fclose(file) != 0)
+    throw std::runtime_error("Could not write to snapshot file '" + path +
+                             "'.");
+}
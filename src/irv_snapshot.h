@@ -0,0 +1,284 @@
+/******************************************************************************
+ * File:             irv_snapshot.h
+ *
+ * Author:           Floyd Everest <me@floydeverest.com>
+ * Created:          10/16/26
+ * Description:      This file declares the `IRVSnapshot` class, a read-only
+ *                   view of an IRV Dirichlet-tree which has been saved to a
+ *                   binary file. The file holds the tree parameters, the
+ *                   candidate names, the parameters and child structure of
+ *                   each node in flat arrays, and the observed ballots. It is
+ *                   laid out to be memory-mapped, so that a loaded tree can
+ *                   be sampled from directly without rebuilding its' nodes.
+ *****************************************************************************/
+
+#ifndef IRV_SNAPSHOT_H
+#define IRV_SNAPSHOT_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "distributions.h"
+#include "irv_ballot.h"
+#include "irv_node.h"
+#include "observation_store.h"
+
+/*
+ * A snapshot file starts with an `IRVSnapshotHeader`, followed by these
+ * sections, each of which starts on an 8-byte boundary:
+ *
+ *   names     Each candidate name as a uint32_t length followed by its' bytes.
+ *   nodes     An IRVSnapshotNode for each node, in depth-first pre-order.
+ *   as        The nChildren + 1 parameters of each node, as doubles.
+ *   children  The nChildren child indices of each node with more than two
+ *             children, as uint32_t, where zero marks a child which has not
+ *             been initialized. Nodes with two children never have any.
+ *   counts    The count of each unique observed ballot, as uint32_t.
+ *   lengths   The number of preferences of each observed ballot, as uint8_t.
+ *   prefs     The preferences of every observed ballot, as uint8_t.
+ *
+ * Values are stored in the byte order of the machine which wrote the file,
+ * and the header records it so that foreign files are rejected. The header
+ * also holds a checksum of the whole file, taken with the checksum field set
+ * to zero, so that the parameters in the header are covered as well.
+ */
+
+struct IRVSnapshotHeader {
+  // The file signature, "DTREESNP".
+  char magic[8];
+  // The version of the layout.
+  uint32_t version;
+  // IRVSnapshot::ENDIAN_MARK, as written by the saving machine.
+  uint32_t byteOrder;
+  // The size of the file in bytes.
+  uint64_t fileSize;
+  // The checksum of the header, with this field zeroed, followed by every
+  // byte after the header.
+  uint64_t checksum;
+  // The tree parameters.
+  uint32_t nCandidates;
+  uint32_t minDepth;
+  uint32_t maxDepth;
+  uint32_t vd;
+  double a0;
+  // The number of observed ballots, counting repeats.
+  uint64_t nObserved;
+  // The number of elements in each section.
+  uint64_t nNameBytes;
+  uint64_t nNodes;
+  uint64_t nAs;
+  uint64_t nChildren;
+  uint64_t nObservations;
+  uint64_t nPrefs;
+  // The offset of each section from the start of the file.
+  uint64_t namesOffset;
+  uint64_t nodesOffset;
+  uint64_t asOffset;
+  uint64_t childrenOffset;
+  uint64_t countsOffset;
+  uint64_t lengthsOffset;
+  uint64_t prefsOffset;
+};
+
+// Every section after the header starts on an 8-byte boundary.
+static_assert(sizeof(IRVSnapshotHeader) % 8 == 0,
+              "The snapshot header must be a multiple of 8 bytes.");
+
+struct IRVSnapshotNode {
+  // The index of the first parameter of the node in the `as` section.
+  uint64_t as;
+  // The index of the first child of the node in the `children` section, if
+  // it has more than two children.
+  uint64_t children;
+};
+
+class IRVSnapshot {
+ private:
+  // The contents of the file, which are either mapped or read into `buffer`.
+  const unsigned char *data = nullptr;
+  size_t size = 0;
+
+  // The mapped region, or null if the file was read into `buffer`.
+  void *mapping = nullptr;
+
+  // The contents of the file when it could not be mapped. The elements are
+  // 8 bytes wide so that every section is aligned.
+  std::vector<uint64_t> buffer{};
+
+  // The header and the sections of the file.
+  const IRVSnapshotHeader *header = nullptr;
+  const IRVSnapshotNode *nodes = nullptr;
+  const double *as = nullptr;
+  const uint32_t *children = nullptr;
+
+  // The candidate names and the observed ballots, decoded from the file.
+  std::vector<std::string> candidates{};
+  std::vector<IRVBallotCount> observations{};
+
+  // Maps the file, or reads it into `buffer` if it cannot be mapped.
+  void load(const std::string &path);
+
+  // Releases the mapping, if there is one.
+  void unmap();
+
+  // Checks the header, checksum and structure of the file, and decodes the
+  // candidate names and observations. Throws if the file is invalid.
+  void validate(const std::string &path);
+
+  // Samples ballots from the sub-tree below a node. This mirrors
+  // IRVNode::sample, so that a snapshot gives identical samples to the tree
+  // it was saved from.
+  template <typename Engine, typename Sink>
+  void sampleNode(IRVParameters *params, uint64_t node, unsigned depth,
+                  unsigned count, IRVWorkspace &ws, Engine *engine,
+                  Sink &sink) const;
+
+ public:
+  // The version of the layout written by `write`.
+  static constexpr uint32_t VERSION = 2;
+
+  // A constant which reads differently under each byte order.
+  static constexpr uint32_t ENDIAN_MARK = 0x01020304;
+
+  /*! \brief Opens and validates a snapshot file.
+   *
+   *  The file is memory-mapped where the platform supports it, and read into
+   * memory otherwise.
+   *
+   * \param path The path to the snapshot file.
+   *
+   * \return A snapshot which can be sampled from.
+   */
+  explicit IRVSnapshot(const std::string &path);
+
+  // The snapshot owns its' mapping, so it cannot be copied.
+  IRVSnapshot(const IRVSnapshot &) = delete;
+  IRVSnapshot &operator=(const IRVSnapshot &) = delete;
+
+  /*! \brief Unmaps the file.
+   */
+  ~IRVSnapshot();
+
+  /*! \brief Saves an IRV Dirichlet-tree to a snapshot file.
+   *
+   * \param path The path to the file, which is overwritten if it exists.
+   *
+   * \param candidates The name of each candidate.
+   *
+   * \param params The parameters of the tree.
+   *
+   * \param root The root node of the tree.
+   *
+   * \param observed The unique observed ballots and their counts.
+   *
+   * \param nObserved The number of observed ballots, counting repeats.
+   */
+  static void write(const std::string &path,
+                    const std::vector<std::string> &candidates,
+                    IRVParameters *params, const IRVNode *root,
+                    const ObservationStore<IRVBallot> &observed,
+                    uint64_t nObserved);
+
+  // Getters
+
+  /*! \brief Gets the candidate names.
+   *
+   * \return The name of each candidate, in order of their index.
+   */
+  const std::vector<std::string> &getCandidates() const { return candidates; }
+
+  /*! \brief Gets the observed ballots.
+   *
+   * \return Each unique observed ballot and its' count, in the order they
+   * were first observed.
+   */
+  const std::vector<IRVBallotCount> &getObservations() const {
+    return observations;
+  }
+
+  unsigned getNCandidates() const { return header->nCandidates; }
+  unsigned getMinDepth() const { return header->minDepth; }
+  unsigned getMaxDepth() const { return header->maxDepth; }
+  double getA0() const { return header->a0; }
+  bool getVD() const { return header->vd != 0; }
+  uint64_t getNObserved() const { return header->nObserved; }
+  uint64_t getNNodes() const { return header->nNodes; }
+
+  /*! \brief Indicates whether the file is memory-mapped.
+   *
+   * \return True if the file is mapped, and false if it was read into memory.
+   */
+  bool isMapped() const { return mapping != nullptr; }
+
+  /*! \brief Samples ballots from the posterior predictive distribution.
+   *
+   *  Equivalent to sampling from the root of the saved tree.
+   *
+   * \param params Parameters with the same number of candidates as the
+   * snapshot. The other parameters may differ from those which were saved.
+   *
+   * \param count The number of ballots to sample.
+   *
+   * \param ws The workspace for sampling, whose `path` is the default path.
+   *
+   * \param engine A PRNG for random sampling.
+   *
+   * \param sink A sink for each distinct ballot, as for emitIRVBallot.
+   */
+  template <typename Engine, typename Sink>
+  void sample(IRVParameters *params, unsigned count, IRVWorkspace &ws,
+              Engine *engine, Sink &sink) const {
+    sampleNode(params, 0, 0, count, ws, engine, sink);
+  }
+};
+
+template <typename Engine, typename Sink>
+void IRVSnapshot::sampleNode(IRVParameters *params, uint64_t node,
+                             unsigned depth, unsigned count, IRVWorkspace &ws,
+                             Engine *engine, Sink &sink) const {
+  unsigned minDepth = params->getMinDepth();
+  unsigned maxDepth = params->getMaxDepth();
+  double a0 = params->getA0();
+  if (params->getVD()) a0 = a0 * params->depthFactor(depth);
+
+  std::vector<unsigned> &path = ws.path;
+
+  unsigned nChildren = params->getNCandidates() - depth;
+  unsigned nOutcomes = nChildren + (depth >= minDepth);
+  const double *nodeAs = as + nodes[node].as;
+
+  unsigned *mnomCounts = ws.countsAt(depth);
+  rDirichletMultinomial(count, a0, nodeAs, nOutcomes, mnomCounts,
+                        ws.probs.data(), engine);
+
+  // Emit terminal node ballots
+  if (depth >= minDepth && mnomCounts[nChildren] > 0)
+    emitIRVBallot(sink, path, depth, mnomCounts[nChildren]);
+
+  // Emit the completed ballots one preference from the maximum depth.
+  if (depth == maxDepth - 1) {
+    for (unsigned i = 0; i < nChildren; ++i) {
+      if (mnomCounts[i] == 0) continue;
+      std::swap(path[depth], path[depth + i]);
+      emitIRVBallot(sink, path, depth + 1, mnomCounts[i]);
+      std::swap(path[depth], path[depth + i]);
+    }
+    return;
+  }
+
+  // Otherwise sample from each subtree, lazily if it was never observed.
+  for (unsigned i = 0; i < nChildren; ++i) {
+    if (mnomCounts[i] == 0) continue;
+    std::swap(path[depth], path[depth + i]);
+    uint32_t child = nChildren > 2 ? children[nodes[node].children + i] : 0;
+    if (child == 0) {
+      lazyIRVBallots(params, mnomCounts[i], depth + 1, ws, engine, sink);
+    } else {
+      sampleNode(params, child, depth + 1, mnomCounts[i], ws, engine, sink);
+    }
+    std::swap(path[depth], path[depth + i]);
+  }
+}
+
+#endif /* IRV_SNAPSHOT_H */
@@ -0,0 +1,266 @@
+/******************************************************************************
+ * File:             observation_store.h
+ *
+ * Author:           Floyd Everest <me@floydeverest.com>
+ * Created:          10/16/26
+ * Description:      This file declares the `ObservationStore` class, which
+ *                   counts the unique outcomes observed by a Dirichlet-tree.
+ *                   Outcomes are stored contiguously in order of first
+ *                   observation, and found through an open-addressed hash
+ *                   table of 64-bit keys supplied by the tree parameters.
+ *                   A store can be forked in constant time, in which case
+ *                   the existing observations are frozen into a layer which
+ *                   is shared by both stores.
+ *****************************************************************************/
+
+#ifndef OBSERVATION_STORE_H
+#define OBSERVATION_STORE_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <utility>
+#include <vector>
+
+template <typename Outcome>
+class ObservationStore {
+ public:
+  using Entry = std::pair<Outcome, unsigned>;
+  class const_iterator;
+
+ private:
+  // Marks an unused slot of a hash table.
+  static constexpr uint32_t EMPTY = std::numeric_limits<uint32_t>::max();
+
+  // A set of unique outcomes and their counts, in order of first observation,
+  // along with the key of each entry and a hash table of indices into the
+  // entries. The table size is zero or a power of two, and it is kept at most
+  // half full.
+  struct Layer {
+    std::vector<Entry> entries{};
+    std::vector<uint64_t> keys{};
+    std::vector<uint32_t> slots{};
+  };
+
+  // The observations added since the store was created or last forked.
+  Layer own{};
+
+  // The observations made before the store was forked, from the oldest layer
+  // to the newest. These are shared with other stores, and never modified.
+  std::vector<std::shared_ptr<const Layer>> shared{};
+
+  // Whether equal keys imply equal outcomes, in which case outcomes are never
+  // compared directly.
+  bool exactKeys;
+
+  // Finds the slot of a layer holding the given outcome, or the empty slot
+  // where it would be inserted. The table must not be empty.
+  size_t findSlot(const Layer &layer, const Outcome &o, uint64_t key) const {
+    size_t mask = layer.slots.size() - 1;
+    // Fibonacci hashing spreads sequential keys (such as ranks) over the table.
+    size_t slot = ((key * 0x9E3779B97F4A7C15ull) >> 32) & mask;
+    for (;; slot = (slot + 1) & mask) {
+      uint32_t i = layer.slots[slot];
+      if (i == EMPTY) return slot;
+      if (layer.keys[i] == key && (exactKeys || layer.entries[i].first == o))
+        return slot;
+    }
+  }
+
+  // Gets the count of an outcome in a single layer.
+  unsigned layerCount(const Layer &layer, const Outcome &o,
+                      uint64_t key) const {
+    if (layer.slots.empty()) return 0;
+    uint32_t i = layer.slots[findSlot(layer, o, key)];
+    return i == EMPTY ? 0 : layer.entries[i].second;
+  }
+
+  // Rebuilds the hash table of the own layer with the given number of slots.
+  void rehash(size_t nSlots) {
+    own.slots.assign(nSlots, EMPTY);
+    size_t mask = nSlots - 1;
+    for (uint32_t i = 0; i < own.entries.size(); ++i) {
+      size_t slot = ((own.keys[i] * 0x9E3779B97F4A7C15ull) >> 32) & mask;
+      while (own.slots[slot] != EMPTY) slot = (slot + 1) & mask;
+      own.slots[slot] = i;
+    }
+  }
+
+ public:
+  /*! \brief Constructs an empty store.
+   *
+   * \param exactKeys_ Whether each key identifies a unique outcome. If false,
+   * outcomes with equal keys are also compared with `operator==`.
+   *
+   * \return An empty store.
+   */
+  explicit ObservationStore(bool exactKeys_ = false) : exactKeys(exactKeys_) {}
+
+  /*! \brief Adds a number of observations of an outcome.
+   *
+   *  Each call performs a single hash table lookup.
+   *
+   * \param o The observed outcome.
+   *
+   * \param key The key of the outcome. Equal outcomes must have equal keys.
+   *
+   * \param count The number of times the outcome was observed.
+   */
+  void add(const Outcome &o, uint64_t key, unsigned count) {
+    if (2 * (own.entries.size() + 1) > own.slots.size())
+      rehash(std::max<size_t>(16, 2 * own.slots.size()));
+    size_t slot = findSlot(own, o, key);
+    if (own.slots[slot] == EMPTY) {
+      own.slots[slot] = own.entries.size();
+      own.entries.emplace_back(o, count);
+      own.keys.push_back(key);
+    } else {
+      own.entries[own.slots[slot]].second += count;
+    }
+  }
+
+  /*! \brief Gets the number of times an outcome has been observed.
+   *
+   * \param o The outcome to look up.
+   *
+   * \param key The key of the outcome.
+   *
+   * \return The number of observations of the outcome, or zero.
+   */
+  unsigned count(const Outcome &o, uint64_t key) const {
+    unsigned out = layerCount(own, o, key);
+    for (const auto &layer : shared) out += layerCount(*layer, o, key);
+    return out;
+  }
+
+  /*! \brief Reserves space for a number of unique outcomes.
+   *
+   * \param n The number of unique outcomes to make room for.
+   */
+  void reserve(size_t n) {
+    own.entries.reserve(n);
+    own.keys.reserve(n);
+    size_t nSlots = std::max<size_t>(16, own.slots.size());
+    while (nSlots < 2 * n) nSlots *= 2;
+    if (nSlots > own.slots.size()) rehash(nSlots);
+  }
+
+  /*! \brief Removes every observation.
+   *
+   *  Shared layers are released, and are not modified.
+   */
+  void clear() {
+    own = Layer();
+    shared.clear();
+  }
+
+  /*! \brief Forks the store in constant time.
+   *
+   *  The observations of this store are frozen into a layer which is shared
+   * with the returned store. Both stores then add new observations to their
+   * own layers, so neither sees the other's later observations.
+   *
+   * \return A store with the same observations as this one.
+   */
+  ObservationStore fork() {
+    if (!own.entries.empty()) {
+      shared.push_back(std::make_shared<const Layer>(std::move(own)));
+      own = Layer();
+    }
+    ObservationStore out(exactKeys);
+    out.shared = shared;
+    return out;
+  }
+
+  /*! \brief Indicates whether any observations are shared with another store.
+   *
+   * \return True if the store has been forked since it was last cleared.
+   */
+  bool isForked() const { return !shared.empty(); }
+
+  /*! \brief Gets the number of (outcome, count) entries.
+   *
+   *  This is the number of unique outcomes, unless an outcome was observed
+   * both before and after the store was forked, in which case it has an entry
+   * in each layer.
+   *
+   * \return The number of entries iterated over by the store.
+   */
+  size_t size() const {
+    size_t out = own.entries.size();
+    for (const auto &layer : shared) out += layer->entries.size();
+    return out;
+  }
+
+  // Iterators over the (outcome, count) entries, from the oldest layer to the
+  // newest, each in order of first observation.
+  const_iterator begin() const { return const_iterator(this, 0, 0); }
+  const_iterator end() const {
+    return const_iterator(this, shared.size() + 1, 0);
+  }
+};
+
+template <typename Outcome>
+class ObservationStore<Outcome>::const_iterator {
+ public:
+  using iterator_category = std::forward_iterator_tag;
+  using value_type = Entry;
+  using difference_type = std::ptrdiff_t;
+  using pointer = const Entry *;
+  using reference = const Entry &;
+
+ private:
+  const ObservationStore *store = nullptr;
+  // The index of the current layer, where the own layer follows the shared
+  // layers, and the index of the entry within it.
+  size_t layer = 0;
+  size_t index = 0;
+
+  const Layer &currentLayer() const {
+    return layer < store->shared.size() ? *store->shared[layer] : store->own;
+  }
+
+  // Moves past any exhausted layers.
+  void settle() {
+    while (layer <= store->shared.size() &&
+           index == currentLayer().entries.size()) {
+      ++layer;
+      index = 0;
+    }
+  }
+
+ public:
+  const_iterator() = default;
+
+  const_iterator(const ObservationStore *store_, size_t layer_, size_t index_)
+      : store(store_), layer(layer_), index(index_) {
+    settle();
+  }
+
+  reference operator*() const { return currentLayer().entries[index]; }
+  pointer operator->() const { return &currentLayer().entries[index]; }
+
+  const_iterator &operator++() {
+    ++index;
+    settle();
+    return *this;
+  }
+
+  const_iterator operator++(int) {
+    const_iterator out = *this;
+    ++*this;
+    return out;
+  }
+
+  bool operator==(const const_iterator &other) const {
+    return layer == other.layer && index == other.index;
+  }
+  bool operator!=(const const_iterator &other) const {
+    return !(*this == other);
+  }
+};
+
+#endif /* OBSERVATION_STORE_H */
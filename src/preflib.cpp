@@ -0,0 +1,274 @@
+/******************************************************************************
+ * File:             preflib.cpp
+ *
+ * Author:           Floyd Everest <me@floydeverest.com>
+ * Created:          10/16/26
+ * Description:      This file implements the PrefLibReader and PrefLibWriter
+ *                   methods as outlined in `preflib.h`.
+ *****************************************************************************/
+
+#include "preflib.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+// Skips spaces and tabs.
+const char *skipBlanks(const char *p, const char *end) {
+  while (p < end && (*p == ' ' || *p == '\t')) ++p;
+  return p;
+}
+
+// Parses an unsigned integer, returning the position after it, or null if
+// there is no integer at p.
+const char *parseUnsigned(const char *p, const char *end, uint64_t &value) {
+  const char *start = p;
+  value = 0;
+  while (p < end && *p >= '0' && *p <= '9') {
+    value = value * 10 + (*p - '0');
+    if (value > UINT32_MAX) return nullptr;
+    ++p;
+  }
+  return p == start ? nullptr : p;
+}
+
+// Whether the line starts with the given header key.
+bool startsWith(const char *line, size_t length, const char *key) {
+  size_t n = std::strlen(key);
+  return length >= n && std::strncmp(line, key, n) == 0;
+}
+
+}  // namespace
+
+PrefLibReader::PrefLibReader(const std::string &path_)
+    : path(path_), buffer(BUFFER_SIZE) {
+  file = std::fopen(path.c_str(), "rb");
+  if (file == nullptr)
+    throw std::runtime_error("Could not open PrefLib file '" + path + "'.");
+
+  // Parse the header, stopping at the first order. The destructor does not
+  // run if the constructor throws, so the file is closed here on failure.
+  try {
+    while (nextLine()) {
+      if (lineLength == 0) continue;
+      if (line[0] != '#') {
+        pending = true;
+        break;
+      }
+      parseHeaderLine();
+    }
+    if (dataType != "soi" && dataType != "soc")
+      throw std::runtime_error(
+          "PrefLib file '" + path + "' has DATA TYPE '" + dataType +
+          "', but only 'soi' and 'soc' files are supported.");
+    for (size_t i = 0; i < alternativeNames.size(); ++i) {
+      if (alternativeNames[i].empty())
+        throw std::runtime_error("PrefLib file '" + path +
+                                 "' does not name alternative " +
+                                 std::to_string(i + 1) + ".");
+    }
+  } catch (...) {
+    std::fclose(file);
+    throw;
+  }
+  preferences.resize(alternativeNames.size());
+  seen.resize(alternativeNames.size());
+}
+
+PrefLibReader::~PrefLibReader() {
+  if (file != nullptr) std::fclose(file);
+}
+
+bool PrefLibReader::nextLine() {
+  for (;;) {
+    const char *start = buffer.data() + begin;
+    const char *newline =
+        static_cast<const char *>(std::memchr(start, '\n', end - begin));
+    if (newline != nullptr || (eof && begin < end)) {
+      size_t length = newline != nullptr ? newline - start : end - begin;
+      begin += length + (newline != nullptr);
+      // Drop any carriage return from Windows line endings.
+      if (length > 0 && start[length - 1] == '\r') --length;
+      line = start;
+      lineLength = length;
+      ++lineNumber;
+      return true;
+    }
+    if (eof) return false;
+
+    // Move the partial line to the front of the buffer and refill the rest.
+    if (begin == 0 && end == buffer.size())
+      fail("Line is longer than the maximum of " +
+           std::to_string(BUFFER_SIZE) + " bytes");
+    std::memmove(buffer.data(), buffer.data() + begin, end - begin);
+    end -= begin;
+    begin = 0;
+    size_t nRead =
+        std::fread(buffer.data() + end, 1, buffer.size() - end, file);
+    end += nRead;
+    if (nRead == 0) {
+      if (std::ferror(file)) fail("Could not read the file");
+      eof = true;
+    }
+  }
+}
+
+void PrefLibReader::parseHeaderLine() {
+  const char *p = line + 1, *lineEnd = line + lineLength;
+  p = skipBlanks(p, lineEnd);
+  const char *colon =
+      static_cast<const char *>(std::memchr(p, ':', lineEnd - p));
+  if (colon == nullptr) return;
+  std::string key(p, colon);
+  const char *value = skipBlanks(colon + 1, lineEnd);
+  const char *valueEnd = lineEnd;
+  while (valueEnd > value && (valueEnd[-1] == ' ' || valueEnd[-1] == '\t'))
+    --valueEnd;
+
+  uint64_t n;
+  if (key == "DATA TYPE") {
+    dataType.assign(value, valueEnd);
+  } else if (key == "NUMBER ALTERNATIVES") {
+    if (parseUnsigned(value, valueEnd, n) == nullptr)
+      fail("Invalid NUMBER ALTERNATIVES");
+    alternativeNames.resize(n);
+  } else if (key == "NUMBER VOTERS") {
+    if (parseUnsigned(value, valueEnd, n) != nullptr) nVoters = n;
+  } else if (key == "NUMBER UNIQUE ORDERS") {
+    if (parseUnsigned(value, valueEnd, n) != nullptr) nUniqueOrders = n;
+  } else if (startsWith(key.c_str(), key.size(), "ALTERNATIVE NAME ")) {
+    const char *index = key.c_str() + std::strlen("ALTERNATIVE NAME ");
+    const char *indexEnd = key.c_str() + key.size();
+    if (parseUnsigned(index, indexEnd, n) != indexEnd || n == 0 ||
+        n > alternativeNames.size())
+      fail("Invalid alternative index");
+    alternativeNames[n - 1].assign(value, valueEnd);
+  }
+}
+
+unsigned PrefLibReader::parseOrder(unsigned &count) {
+  const char *p = line, *lineEnd = line + lineLength;
+  uint64_t value;
+  p = parseUnsigned(skipBlanks(p, lineEnd), lineEnd, value);
+  if (p == nullptr) fail("Expected the count of an order");
+  count = value;
+  p = skipBlanks(p, lineEnd);
+  if (p == lineEnd || *p != ':') fail("Expected ':' after the count");
+  p = skipBlanks(p + 1, lineEnd);
+
+  unsigned n = 0;
+  while (p < lineEnd) {
+    if (*p == '{') fail("Ties are not supported");
+    p = parseUnsigned(p, lineEnd, value);
+    if (p == nullptr || value == 0 || value > alternativeNames.size())
+      fail("Invalid alternative");
+    if (seen[value - 1]) fail("Alternative appears more than once");
+    seen[value - 1] = true;
+    preferences[n++] = value - 1;
+    p = skipBlanks(p, lineEnd);
+    if (p < lineEnd) {
+      if (*p != ',') fail("Expected ',' between alternatives");
+      p = skipBlanks(p + 1, lineEnd);
+      if (p == lineEnd) fail("Expected an alternative after ','");
+    }
+  }
+  for (unsigned i = 0; i < n; ++i) seen[preferences[i]] = false;
+  return n;
+}
+
+void PrefLibReader::fail(const std::string &message) const {
+  throw std::runtime_error(message + " on line " + std::to_string(lineNumber) +
+                           " of PrefLib file '" + path + "'.");
+}
+
+PrefLibWriter::PrefLibWriter(const std::string &path_,
+                             const std::vector<std::string> &alternativeNames)
+    : path(path_), buffer(BUFFER_SIZE), nAlternatives(alternativeNames.size()) {
+  file = std::fopen(path.c_str(), "wb");
+  if (file == nullptr)
+    throw std::runtime_error("Could not create PrefLib file '" + path + "'.");
+
+  std::string fileName = path.substr(path.find_last_of("/\\") + 1);
+  write("# FILE NAME: " + fileName + "\n");
+  write("# TITLE: \n# DESCRIPTION: \n# DATA TYPE: soi\n");
+  write("# MODIFICATION TYPE: synthetic\n# RELATES TO: \n# RELATED FILES: \n");
+  write("# PUBLICATION DATE: \n# MODIFICATION DATE: \n");
+  write("# NUMBER ALTERNATIVES: " + std::to_string(nAlternatives) + "\n");
+  // The totals are padded with spaces, and overwritten by `close`.
+  const std::string blank(TOTAL_WIDTH, ' ');
+  write("# NUMBER VOTERS: ");
+  nVotersOffset = written + used;
+  write(blank + "\n");
+  write("# NUMBER UNIQUE ORDERS: ");
+  nUniqueOrdersOffset = written + used;
+  write(blank + "\n");
+  for (unsigned i = 0; i < nAlternatives; ++i)
+    write("# ALTERNATIVE NAME " + std::to_string(i + 1) + ": " +
+          alternativeNames[i] + "\n");
+}
+
+PrefLibWriter::~PrefLibWriter() {
+  if (file != nullptr) std::fclose(file);
+}
+
+void PrefLibWriter::write(const char *data, size_t n) {
+  while (n > 0) {
+    if (used == buffer.size()) flush();
+    size_t m = std::min(n, buffer.size() - used);
+    std::memcpy(buffer.data() + used, data, m);
+    used += m;
+    data += m;
+    n -= m;
+  }
+}
+
+void PrefLibWriter::writeUnsigned(uint64_t value) {
+  char digits[20];
+  unsigned n = 0;
+  do {
+    digits[19 - n++] = '0' + value % 10;
+    value /= 10;
+  } while (value > 0);
+  write(digits + 20 - n, n);
+}
+
+void PrefLibWriter::flush() {
+  if (std::fwrite(buffer.data(), 1, used, file) != used)
+    throw std::runtime_error("Could not write to PrefLib file '" + path +
+                             "'.");
+  written += used;
+  used = 0;
+}
+
+void PrefLibWriter::writeOrder(const unsigned *prefs, unsigned n,
+                               unsigned count) {
+  writeUnsigned(count);
+  write(": ", 2);
+  for (unsigned i = 0; i < n; ++i) {
+    if (prefs[i] >= nAlternatives)
+      throw std::runtime_error("Invalid alternative written to PrefLib file.");
+    if (i > 0) write(",", 1);
+    writeUnsigned(prefs[i] + 1);
+  }
+  write("\n", 1);
+  nVoters += count;
+  ++nUniqueOrders;
+}
+
+void PrefLibWriter::close() {
+  flush();
+  std::string voters = std::to_string(nVoters);
+  std::string orders = std::to_string(nUniqueOrders);
+  bool ok = std::fseek(file, nVotersOffset, SEEK_SET) == 0 &&
+            std::fwrite(voters.data(), 1, voters.size(), file) ==
+                voters.size() &&
+            std::fseek(file, nUniqueOrdersOffset, SEEK_SET) == 0 &&
+            std::fwrite(orders.data(), 1, orders.size(), file) ==
+                orders.size();
+  ok = std::fclose(file) == 0 && ok;
+  file = nullptr;
+  if (!ok)
+    throw std::runtime_error("Could not write to PrefLib file '" + path +
+                             "'.");
+}
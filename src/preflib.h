@@ -0,0 +1,230 @@
+/******************************************************************************
+ * File:             preflib.h
+ *
+ * Author:           Floyd Everest <me@floydeverest.com>
+ * Created:          10/16/26
+ * Description:      This file declares the `PrefLibReader` class, which
+ *                   streams the orders from a PrefLib `.soi` or `.soc` file
+ *                   through a fixed-size buffer. The header is parsed when the
+ *                   file is opened, and each `count: prefs` line is then
+ *                   passed to a sink without any per-line allocations. The
+ *                   `PrefLibWriter` class streams orders to a `.soi` file in
+ *                   the same way.
+ *****************************************************************************/
+
+#ifndef PREFLIB_H
+#define PREFLIB_H
+
+#include <cstdint>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+class PrefLibReader {
+ private:
+  // The open file.
+  std::FILE *file = nullptr;
+
+  // The path to the file, for error messages.
+  std::string path;
+
+  // The buffer holding the unread part of the file, and the range [begin,
+  // end) of it which has not been consumed yet.
+  std::vector<char> buffer;
+  size_t begin = 0;
+  size_t end = 0;
+
+  // Whether the whole file has been read into the buffer.
+  bool eof = false;
+
+  // The current line, which is valid until the next call to `nextLine`.
+  const char *line = nullptr;
+  size_t lineLength = 0;
+  size_t lineNumber = 0;
+
+  // Whether the current line is an order which has not been read yet. The
+  // first order is read while parsing the header.
+  bool pending = false;
+
+  // The header fields.
+  std::string dataType{};
+  std::vector<std::string> alternativeNames{};
+  size_t nVoters = 0;
+  size_t nUniqueOrders = 0;
+
+  // Scratch memory for parsing each order, allocated once the number of
+  // alternatives is known.
+  std::vector<unsigned> preferences{};
+  std::vector<uint8_t> seen{};
+
+  // Advances to the next line, refilling the buffer as needed. Returns false
+  // at the end of the file.
+  bool nextLine();
+
+  // Parses a `# KEY: value` header line.
+  void parseHeaderLine();
+
+  // Parses the current line as a `count: a,b,c` order, filling `preferences`
+  // with the zero-indexed alternatives. Returns the number of preferences.
+  unsigned parseOrder(unsigned &count);
+
+  // Throws an error which mentions the current line.
+  [[noreturn]] void fail(const std::string &message) const;
+
+ public:
+  // The number of bytes read from the file at a time. This is also the
+  // maximum length of a line.
+  static constexpr size_t BUFFER_SIZE = 1 << 20;
+
+  /*! \brief Opens a PrefLib file and parses its' header.
+   *
+   *  Only the strict order formats (`soi` and `soc`) are supported, since
+   * Dirichlet-trees do not model ties.
+   *
+   * \param path_ The path to the file.
+   *
+   * \return A reader positioned at the first order.
+   */
+  explicit PrefLibReader(const std::string &path_);
+
+  // The reader owns its' file, so it cannot be copied.
+  PrefLibReader(const PrefLibReader &) = delete;
+  PrefLibReader &operator=(const PrefLibReader &) = delete;
+
+  /*! \brief Closes the file.
+   */
+  ~PrefLibReader();
+
+  /*! \brief Gets the names of the alternatives.
+   *
+   * \return The name of each alternative, in order of their PrefLib index.
+   */
+  const std::vector<std::string> &getAlternativeNames() const {
+    return alternativeNames;
+  }
+
+  /*! \brief Gets the data type given in the header.
+   *
+   * \return Either "soi" or "soc".
+   */
+  const std::string &getDataType() const { return dataType; }
+
+  /*! \brief Gets the number of voters given in the header.
+   *
+   * \return The number of voters, or zero if the header omits it.
+   */
+  size_t getNVoters() const { return nVoters; }
+
+  /*! \brief Gets the number of unique orders given in the header.
+   *
+   * \return The number of unique orders, or zero if the header omits it.
+   */
+  size_t getNUniqueOrders() const { return nUniqueOrders; }
+
+  /*! \brief Reads every remaining order in the file.
+   *
+   * \param sink A callable invoked as `sink(prefs, n, count)` for each order,
+   * where `prefs` points to the n zero-indexed alternatives in order of
+   * preference, and is only valid for the duration of the call.
+   */
+  template <typename Sink>
+  void readOrders(Sink &sink);
+};
+
+template <typename Sink>
+void PrefLibReader::readOrders(Sink &sink) {
+  while (pending || nextLine()) {
+    pending = false;
+    if (lineLength == 0 || line[0] == '#') continue;
+    unsigned count;
+    unsigned n = parseOrder(count);
+    sink(static_cast<const unsigned *>(preferences.data()), n, count);
+  }
+}
+
+class PrefLibWriter {
+ private:
+  // The open file, or null once it has been closed.
+  std::FILE *file = nullptr;
+
+  // The path to the file, for error messages.
+  std::string path;
+
+  // The buffer of output which has not been written yet.
+  std::vector<char> buffer;
+  size_t used = 0;
+
+  // The number of bytes written to the file so far.
+  size_t written = 0;
+
+  // The offsets of the header values which are only known once every order
+  // has been written. Space for them is reserved in the header.
+  size_t nVotersOffset = 0;
+  size_t nUniqueOrdersOffset = 0;
+
+  // The totals for the header.
+  size_t nVoters = 0;
+  size_t nUniqueOrders = 0;
+
+  // The number of alternatives, for validating orders.
+  unsigned nAlternatives;
+
+  // Appends bytes to the buffer, flushing it when it is full.
+  void write(const char *data, size_t n);
+  void write(const std::string &s) { write(s.data(), s.size()); }
+
+  // Appends an unsigned integer in decimal.
+  void writeUnsigned(uint64_t value);
+
+  // Writes the buffer to the file.
+  void flush();
+
+ public:
+  // The number of bytes written to the file at a time.
+  static constexpr size_t BUFFER_SIZE = 1 << 20;
+
+  // The width reserved for each header total.
+  static constexpr size_t TOTAL_WIDTH = 20;
+
+  /*! \brief Creates a PrefLib `.soi` file and writes its' header.
+   *
+   * \param path_ The path to the file, which is overwritten if it exists.
+   *
+   * \param alternativeNames The name of each alternative.
+   *
+   * \return A writer ready to write orders.
+   */
+  PrefLibWriter(const std::string &path_,
+                const std::vector<std::string> &alternativeNames);
+
+  // The writer owns its' file, so it cannot be copied.
+  PrefLibWriter(const PrefLibWriter &) = delete;
+  PrefLibWriter &operator=(const PrefLibWriter &) = delete;
+
+  /*! \brief Closes the file if `close` was not called.
+   *
+   *  Errors are ignored, and the header totals are not filled in.
+   */
+  ~PrefLibWriter();
+
+  /*! \brief Writes an order with its' count.
+   *
+   *  Each order should only be written once, since the number of unique
+   * orders in the header counts the calls to this method.
+   *
+   * \param prefs The n zero-indexed alternatives in order of preference.
+   *
+   * \param n The number of preferences.
+   *
+   * \param count The number of voters who cast the order.
+   */
+  void writeOrder(const unsigned *prefs, unsigned n, unsigned count);
+
+  /*! \brief Flushes the remaining output, fills in the header totals, and
+   * closes the file.
+   */
+  void close();
+};
+
+#endif /* PREFLIB_H */
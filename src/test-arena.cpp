@@ -0,0 +1,75 @@
+/*
+ * This file tests the slab arena which owns the nodes of a Dirichlet-tree.
+ */
+
+#include <testthat.h>
+
+#include <cstdint>
+#include <cstring>
+
+#include "arena.h"
+
+context("Test allocating from an arena.") {
+  Arena arena(256);
+
+  // Dirty the first slab, then rewind and allocate arrays over it.
+  unsigned char *dirty = static_cast<unsigned char *>(arena.allocate(200));
+  std::memset(dirty, 0xff, 200);
+  size_t capacity = arena.capacity();
+  arena.reset();
+  double *doubles = arena.allocateArray<double>(10);
+  uint32_t *ints = arena.allocateArray<uint32_t>(20);
+  bool zeroed = true;
+  for (unsigned i = 0; i < 10; ++i) zeroed = zeroed && doubles[i] == 0.;
+  for (unsigned i = 0; i < 20; ++i) zeroed = zeroed && ints[i] == 0;
+
+  // An allocation which does not fit in the slab gets a slab of its' own.
+  void *large = arena.allocate(1000);
+
+  test_that("Arrays are zero-initialized, even in reused memory.") {
+    expect_true(zeroed);
+  }
+
+  test_that("Resetting reuses the slabs without requesting more memory.") {
+    expect_true(static_cast<void *>(doubles) == dirty);
+    expect_true(capacity == 256);
+    expect_true(arena.capacity() == 256 + 1000);
+    expect_true(large != nullptr);
+  }
+}
+
+context("Test adopting the slabs of another arena.") {
+  Arena tree(64);
+  Arena worker(64, &tree);
+
+  // Fill most of a slab in each arena, and mark the worker's allocation.
+  unsigned char *treeFirst = static_cast<unsigned char *>(tree.allocate(48));
+  unsigned char *workerFirst =
+      static_cast<unsigned char *>(worker.allocate(48));
+  std::memset(workerFirst, 7, 48);
+  tree.adopt(worker);
+
+  // The adopted slab is placed before the tree's current slab, so the tree
+  // keeps carving its' own slab, and the adopted slab is reused first after a
+  // reset.
+  unsigned char *next = static_cast<unsigned char *>(tree.allocate(8));
+  bool kept = workerFirst[0] == 7 && workerFirst[47] == 7;
+  tree.reset();
+  void *reused = tree.allocate(48);
+
+  test_that("Allocations are tagged with the owning arena.") {
+    expect_true(tree.getOwner() == &tree);
+    expect_true(worker.getOwner() == &tree);
+  }
+
+  test_that("Adopting moves the slabs without invalidating them.") {
+    expect_true(kept);
+    expect_true(worker.capacity() == 0);
+    expect_true(tree.capacity() == 128);
+  }
+
+  test_that("Adopted slabs precede the current slab.") {
+    expect_true(next == treeFirst + 48);
+    expect_true(reused == workerFirst);
+  }
+}
@@ -4,6 +4,7 @@
 
 #include <testthat.h>
 
+#include <cmath>
 #include <vector>
 
 #include "distributions.h"
@@ -66,3 +67,137 @@ context("Test dirichlet marginal distributions.") {
                 0.9 * static_cast<double>(n_trials) / static_cast<double>(n));
   }
 }
+
+context("Test dirichlet marginals with small shape parameters.") {
+  std::mt19937 mte;
+  mte.seed(time(NULL));
+
+  // Shapes below 1 use the boosted gamma sampler.
+  unsigned n_trials = 20000;
+  double a0 = 0.2;
+  std::vector<double> as = {0., 0.5, 1.3};
+  std::vector<double> p(as.size());
+
+  double sum_p_0 = 0.;
+  double sum_p_sym = 0.;
+  for (unsigned i = 0; i < n_trials; ++i) {
+    rDirichlet(a0, as.data(), as.size(), p.data(), &mte);
+    sum_p_0 += p[0];
+    rDirichlet(a0, nullptr, as.size(), p.data(), &mte);
+    sum_p_sym += p[as.size() - 1];
+  }
+
+  // The expected marginal means are a0 / (3a0 + 1.8) and 1/3 respectively.
+  double mean_0 = a0 / (3. * a0 + 1.8);
+  double mean_sym = 1. / 3.;
+
+  test_that("First Dirichlet probability has mean approximately a_1/sum(a).") {
+    expect_true(sum_p_0 < 1.1 * n_trials * mean_0);
+    expect_true(sum_p_0 > 0.9 * n_trials * mean_0);
+  }
+
+  test_that("Symmetric Dirichlet probabilities have mean approximately 1/d.") {
+    expect_true(sum_p_sym < 1.1 * n_trials * mean_sym);
+    expect_true(sum_p_sym > 0.9 * n_trials * mean_sym);
+  }
+}
+
+context("Test binomial sampler moments.") {
+  std::mt19937 mte;
+  mte.seed(time(NULL));
+
+  // The first case uses inversion, the others use BTPE (directly and
+  // reflected).
+  std::vector<std::pair<unsigned, double>> cases = {
+      {20, 0.3}, {5000000, 0.13}, {1000, 0.9}};
+  unsigned n_trials = 20000;
+
+  bool means_close = true;
+  bool variances_close = true;
+  for (auto [n, p] : cases) {
+    double sum = 0., sum_sq = 0.;
+    for (unsigned i = 0; i < n_trials; ++i) {
+      double x = rBinomial(n, p, &mte);
+      sum += x;
+      sum_sq += x * x;
+    }
+    double mean = sum / n_trials;
+    double var = sum_sq / n_trials - mean * mean;
+    double expected_var = n * p * (1. - p);
+    // Allow five standard errors for the mean.
+    means_close = means_close && std::abs(mean - n * p) <
+                                     5. * std::sqrt(expected_var / n_trials);
+    variances_close = variances_close && var < 1.1 * expected_var &&
+                      var > 0.9 * expected_var;
+  }
+
+  test_that("Binomial samples have approximately the right mean.") {
+    expect_true(means_close);
+  }
+
+  test_that("Binomial samples have approximately the right variance.") {
+    expect_true(variances_close);
+  }
+}
+
+context("Test Dirichlet-Multinomial sampling methods agree.") {
+  std::mt19937 mte;
+  mte.seed(time(NULL));
+
+  unsigned N = 6;
+  double a0 = 0.5;
+  std::vector<double> as = {0., 1., 2.5};
+  unsigned d = as.size();
+  unsigned n_trials = 50000;
+
+  // The marginal count of the first category is
+  // BetaBinomial(N, a_1, sum(a) - a_1).
+  double alpha = a0 + as[0];
+  double beta = 2. * a0 + as[1] + as[2];
+  std::vector<double> pmf(N + 1);
+  for (unsigned k = 0; k <= N; ++k)
+    pmf[k] = std::exp(std::lgamma(N + 1.) - std::lgamma(k + 1.) -
+                      std::lgamma(N - k + 1.) + std::lgamma(k + alpha) +
+                      std::lgamma(N - k + beta) -
+                      std::lgamma(N + alpha + beta) +
+                      std::lgamma(alpha + beta) - std::lgamma(alpha) -
+                      std::lgamma(beta));
+
+  std::vector<unsigned> out(d);
+  std::vector<double> scratch(d);
+  std::vector<double> urn(N + 1), full(N + 1);
+  bool always_sums_to_count = true;
+  for (unsigned i = 0; i < n_trials; ++i) {
+    rDirichletMultinomialUrn(N, a0, as.data(), d, out.data(), scratch.data(),
+                             &mte);
+    always_sums_to_count =
+        always_sums_to_count && out[0] + out[1] + out[2] == N;
+    ++urn[out[0]];
+    rDirichletMultinomialFull(N, a0, as.data(), d, out.data(), scratch.data(),
+                              &mte);
+    always_sums_to_count =
+        always_sums_to_count && out[0] + out[1] + out[2] == N;
+    ++full[out[0]];
+  }
+
+  // Pearson's chi-squared statistic against the exact marginal. The 99.99%
+  // quantile with N degrees of freedom is below 30.
+  double chisq_urn = 0., chisq_full = 0.;
+  for (unsigned k = 0; k <= N; ++k) {
+    double expected = n_trials * pmf[k];
+    chisq_urn += (urn[k] - expected) * (urn[k] - expected) / expected;
+    chisq_full += (full[k] - expected) * (full[k] - expected) / expected;
+  }
+
+  test_that("Both methods produce samples which sum to count.") {
+    expect_true(always_sums_to_count);
+  }
+
+  test_that("Polya urn samples have the Dirichlet-Multinomial marginals.") {
+    expect_true(chisq_urn < 30.);
+  }
+
+  test_that("Dirichlet then Multinomial samples have the same marginals.") {
+    expect_true(chisq_full < 30.);
+  }
+}
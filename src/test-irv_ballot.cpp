@@ -0,0 +1,181 @@
+/*
+ * This file tests the IRV ballot table and social choice function.
+ */
+
+#include <testthat.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "irv_ballot.h"
+
+context("Test socialChoiceIRV on a ballot table.") {
+  std::mt19937 mte;
+  mte.seed(time(NULL));
+
+  // Candidates 0..3 start with tallies 7, 4, 3 and 0. Candidate 3 is
+  // eliminated first, then candidate 2, whose ballots transfer to 1 (skipping
+  // the eliminated 3) or are exhausted. Then 1 (6 votes) loses to 0 (7).
+  IRVBallotTable table;
+  table.add(IRVBallot({0}), 7);
+  table.add(IRVBallot({1}), 4);
+  table.add(IRVBallot({2, 3, 1}), 2);
+  table.add(IRVBallot({2}), 1);
+  table.add(IRVBallot(), 9);
+
+  std::vector<unsigned> expected = {3, 2, 1, 0};
+  std::vector<unsigned> result = socialChoiceIRV(table, 4, &mte);
+
+  // Evaluating twice with the same workspace gives the same result, since the
+  // table is not modified.
+  IRVTallyWorkspace ws;
+  std::vector<unsigned> first(4), second(4);
+  socialChoiceIRV(table, 4, &mte, ws, first.data());
+  socialChoiceIRV(table, 4, &mte, ws, second.data());
+
+  test_that("The elimination order is correct.") {
+    expect_true(result == expected);
+  }
+
+  test_that("Reusing a workspace and table gives the same result.") {
+    expect_true(first == expected);
+    expect_true(second == expected);
+  }
+}
+
+context("Test socialChoiceIRV with ballots split into a trie and a table.") {
+  // Random ballots over 6 candidates, with counts chosen to make ties likely.
+  std::mt19937 e(2022);
+  std::vector<unsigned> perm = {0, 1, 2, 3, 4, 5};
+  std::vector<IRVBallotCount> base;
+  IRVBallotTable rest, combined;
+  for (unsigned i = 0; i < 40; ++i) {
+    std::shuffle(perm.begin(), perm.end(), e);
+    IRVBallot b(perm.begin(), perm.begin() + e() % 7);
+    unsigned count = 1 + e() % 3;
+    if (i % 2 == 0) {
+      base.emplace_back(b, count);
+    } else {
+      rest.add(b, count);
+    }
+  }
+  // Remove any repeated ballots from the base, which must be unique.
+  std::sort(base.begin(), base.end(),
+            [](const IRVBallotCount &a, const IRVBallotCount &b) {
+              return a.first < b.first;
+            });
+  base.erase(std::unique(base.begin(), base.end(),
+                         [](const IRVBallotCount &a, const IRVBallotCount &b) {
+                           return a.first == b.first;
+                         }),
+             base.end());
+  for (const auto &bc : base) combined.add(bc.first, bc.second);
+  for (size_t i = 0; i < rest.size(); ++i)
+    combined.add(rest.ballot(i), rest.length(i), rest.count(i));
+  IRVBallotTrie trie(base.begin(), base.end());
+
+  // The two evaluations use identical engines, so they break ties alike.
+  IRVTallyWorkspace wsSplit, wsCombined;
+  bool allEqual = true;
+  for (unsigned i = 0; i < 50; ++i) {
+    std::mt19937 e1(i), e2(i);
+    std::vector<unsigned> split(6), joint(6);
+    socialChoiceIRV(trie, rest, 6, &e1, wsSplit, split.data());
+    socialChoiceIRV(combined, 6, &e2, wsCombined, joint.data());
+    allEqual = allEqual && split == joint;
+  }
+
+  test_that("The split and combined elections have the same outcome.") {
+    expect_true(allEqual);
+  }
+}
+
+context("Test the rank encoding of ballots.") {
+  // With 4 candidates there are 1 + 4 + 12 + 24 + 24 = 65 ballots.
+  bool bijective = true;
+  std::vector<bool> seen(65, false);
+  for (uint64_t r = 0; r < 65; ++r) {
+    IRVBallot b = IRVBallot::unrank(r, 4);
+    uint64_t rank = b.rank(4);
+    bijective = bijective && rank == r && !seen[rank];
+    seen[rank] = true;
+  }
+
+  // Round trip a full ballot at the largest supported number of candidates.
+  unsigned n = IRVBallot::MAX_RANKED_CANDIDATES;
+  IRVBallot last;
+  for (unsigned c = n; c-- > 0;) last.push_back(c);
+  uint64_t lastRank = last.rank(n);
+
+  test_that("Ranks are ordered by length, then lexicographically.") {
+    expect_true(IRVBallot().rank(4) == 0);
+    expect_true(IRVBallot({0}).rank(4) == 1);
+    expect_true(IRVBallot({3}).rank(4) == 4);
+    expect_true(IRVBallot({0, 1}).rank(4) == 5);
+    expect_true(IRVBallot({3, 2, 1, 0}).rank(4) == 64);
+  }
+
+  test_that("rank and unrank are inverse bijections.") {
+    expect_true(bijective);
+    expect_true(IRVBallot::unrank(lastRank, n) == last);
+  }
+}
+
+context("Test the ordering and hashing of ballots.") {
+  // Sort random ballots over 5 candidates, and compare the order with a
+  // lexicographic comparison of their preferences.
+  std::mt19937 e(2022);
+  std::vector<unsigned> perm = {0, 1, 2, 3, 4};
+  std::vector<IRVBallot> ballots;
+  for (unsigned i = 0; i < 200; ++i) {
+    std::shuffle(perm.begin(), perm.end(), e);
+    ballots.emplace_back(perm.begin(), perm.begin() + e() % 6);
+  }
+  std::sort(ballots.begin(), ballots.end());
+  auto prefs = [](const IRVBallot &b) {
+    std::vector<unsigned> v;
+    for (unsigned i = 0; i < b.nPreferences(); ++i) v.push_back(b[i]);
+    return v;
+  };
+  bool lexicographic = true;
+  for (size_t i = 1; i < ballots.size(); ++i)
+    lexicographic = lexicographic && prefs(ballots[i - 1]) <= prefs(ballots[i]);
+
+  // The same ballot built in different ways, including by eliminating a
+  // preference, which leaves stale bytes past the end of the ballot.
+  IRVBallot listed({1, 2});
+  IRVBallot pushed;
+  pushed.push_back(1);
+  pushed.push_back(2);
+  IRVBallot eliminated({3, 1, 2});
+  eliminated.eliminateFirstPref();
+  std::hash<IRVBallot> hash;
+
+  test_that("A prefix sorts before its' extensions.") {
+    expect_true(IRVBallot() < IRVBallot({0}));
+    expect_true(IRVBallot({1, 2}) < IRVBallot({1, 2, 0}));
+    expect_false(IRVBallot({1, 2, 0}) < IRVBallot({1, 2}));
+    expect_false(IRVBallot({1, 2}) < IRVBallot({1, 2}));
+  }
+
+  test_that("Ballots sort by their first differing preference.") {
+    expect_true(IRVBallot({0, 4, 3}) < IRVBallot({1}));
+    expect_true(IRVBallot({1, 0}) < IRVBallot({1, 2}));
+    expect_true(lexicographic);
+  }
+
+  test_that("Equal ballots are equal and hash equally.") {
+    expect_true(listed == pushed);
+    expect_true(listed == eliminated);
+    expect_true(hash(listed) == hash(pushed));
+    expect_true(hash(listed) == hash(eliminated));
+    expect_true(IRVBallot() == IRVBallot());
+  }
+
+  test_that("Ballots of different lengths are not equal.") {
+    expect_false(IRVBallot({1, 2}) == IRVBallot({1, 2, 0}));
+    expect_false(IRVBallot({1, 2}) == IRVBallot({1}));
+    expect_false(IRVBallot() == IRVBallot({0}));
+    expect_false(eliminated == IRVBallot({1, 2, 2}));
+  }
+}
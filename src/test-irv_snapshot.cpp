@@ -0,0 +1,188 @@
+/*
+ * This file tests saving and loading IRV Dirichlet-tree snapshots.
+ */
+
+#include <testthat.h>
+
+#include <cstddef>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+
+#include "R_tree.h"
+#include "irv_snapshot.h"
+
+context("Test sampling from a saved IRV Dirichlet-tree.") {
+  // Update a tree with random ballots over 8 candidates.
+  IRVParameters params(8, 0, 8, 1.5, false);
+  DirichletTree<IRVNode, IRVBallot, IRVParameters> tree(&params);
+  std::mt19937 e(2022);
+  std::vector<unsigned> perm = {0, 1, 2, 3, 4, 5, 6, 7};
+  for (unsigned i = 0; i < 500; ++i) {
+    std::shuffle(perm.begin(), perm.end(), e);
+    tree.update({IRVBallot(perm.begin(), perm.begin() + e() % 9), 1 + e() % 3});
+  }
+
+  std::string path = "test-irv_snapshot.dtree";
+  std::vector<std::string> names = {"A", "B", "C", "D", "E", "F", "G", "H"};
+  IRVSnapshot::write(path, names, &params, tree.getRoot(), tree.getObserved(),
+                     tree.getNObserved());
+  IRVSnapshot snapshot(path);
+
+  // Sampling from the snapshot and the tree with identical engines gives
+  // identical ballots.
+  IRVWorkspace wsTree(&params), wsSnapshot(&params);
+  IRVBallotTable fromTree, fromSnapshot;
+  std::mt19937 e1(1), e2(1);
+  tree.sample(10000, wsTree, &e1, fromTree);
+  snapshot.sample(&params, 10000, wsSnapshot, &e2, fromSnapshot);
+  bool samplesEqual = fromTree.size() == fromSnapshot.size();
+  for (size_t i = 0; samplesEqual && i < fromTree.size(); ++i)
+    samplesEqual =
+        fromTree.count(i) == fromSnapshot.count(i) &&
+        fromTree.length(i) == fromSnapshot.length(i) &&
+        std::equal(fromTree.ballot(i), fromTree.ballot(i) + fromTree.length(i),
+                   fromSnapshot.ballot(i));
+
+  // The observations are restored in the order they were first observed.
+  bool observationsEqual =
+      snapshot.getObservations().size() == tree.getObserved().size() &&
+      std::equal(tree.getObserved().begin(), tree.getObserved().end(),
+                 snapshot.getObservations().begin());
+
+  test_that("The header is restored.") {
+    expect_true(snapshot.getNCandidates() == 8);
+    expect_true(snapshot.getMaxDepth() == 8);
+    expect_true(snapshot.getA0() == 1.5);
+    expect_true(snapshot.getNObserved() == tree.getNObserved());
+    expect_true(snapshot.getCandidates() == names);
+  }
+
+  test_that("The snapshot samples the same ballots as the tree.") {
+    expect_true(samplesEqual);
+  }
+
+  test_that("The observations are restored.") {
+    expect_true(observationsEqual);
+  }
+
+  // Flips the lowest bit of a byte of the file, which still leaves valid
+  // parameters in the header.
+  auto flip = [&path](std::streamoff offset, std::ios::seekdir dir) {
+    std::fstream f(path, std::ios::in | std::ios::out | std::ios::binary);
+    f.seekg(offset, dir);
+    char c = f.get();
+    f.seekp(offset, dir);
+    f.put(c ^ 1);
+  };
+
+  // Flip one byte of a0 in the header, and then one byte in the body of the
+  // file instead. Both fail the checksum.
+  std::streamoff a0Offset = offsetof(IRVSnapshotHeader, a0);
+  flip(a0Offset, std::ios::beg);
+  bool headerRejected = false;
+  try {
+    IRVSnapshot corrupt{path};
+  } catch (const std::runtime_error &) {
+    headerRejected = true;
+  }
+  flip(a0Offset, std::ios::beg);
+  flip(-1, std::ios::end);
+
+  test_that("Corrupt and missing files are rejected.") {
+    expect_true(headerRejected);
+    CATCH_CHECK_THROWS(IRVSnapshot{path});
+    CATCH_CHECK_THROWS(IRVSnapshot{"test-irv_snapshot-missing.dtree"});
+  }
+
+  std::remove(path.c_str());
+}
+
+context("Test saving a tree with sparse nodes.") {
+  // Nodes with many children only store those they have observed, but the
+  // snapshot stores every child.
+  IRVParameters params(30, 0, 30, 1., false);
+  DirichletTree<IRVNode, IRVBallot, IRVParameters> tree(&params);
+  std::mt19937 e(2022);
+  std::vector<unsigned> perm = params.defaultPath();
+  std::vector<std::string> names;
+  for (unsigned i = 0; i < 30; ++i) names.push_back(std::to_string(i));
+  for (unsigned i = 0; i < 200; ++i) {
+    std::shuffle(perm.begin(), perm.end(), e);
+    tree.update({IRVBallot(perm.begin(), perm.begin() + 1 + e() % 6), 1});
+  }
+
+  std::string path = "test-irv_snapshot-sparse.dtree";
+  IRVSnapshot::write(path, names, &params, tree.getRoot(), tree.getObserved(),
+                     tree.getNObserved());
+  IRVSnapshot snapshot(path);
+
+  IRVWorkspace wsTree(&params), wsSnapshot(&params);
+  IRVBallotTable fromTree, fromSnapshot;
+  std::mt19937 e1(1), e2(1);
+  tree.sample(10000, wsTree, &e1, fromTree);
+  snapshot.sample(&params, 10000, wsSnapshot, &e2, fromSnapshot);
+  bool samplesEqual = fromTree.size() == fromSnapshot.size();
+  for (size_t i = 0; samplesEqual && i < fromTree.size(); ++i)
+    samplesEqual =
+        fromTree.count(i) == fromSnapshot.count(i) &&
+        fromTree.length(i) == fromSnapshot.length(i) &&
+        std::equal(fromTree.ballot(i), fromTree.ballot(i) + fromTree.length(i),
+                   fromSnapshot.ballot(i));
+
+  test_that("The snapshot samples the same ballots as the sparse tree.") {
+    expect_true(tree.getRoot()->getChild(perm[0])->isSparse());
+    expect_true(samplesEqual);
+  }
+
+  std::remove(path.c_str());
+}
+
+context("Test saving and loading an RDirichletTree.") {
+  Rcpp::CharacterVector candidates{"A", "B", "C", "D"};
+  Rcpp::List ballots;
+  ballots.push_back(Rcpp::CharacterVector{"A", "B"});
+  ballots.push_back(Rcpp::CharacterVector{"C", "A", "D", "B"});
+  ballots.push_back(Rcpp::CharacterVector{"B"});
+  Rcpp::List more;
+  more.push_back(Rcpp::CharacterVector{"D", "C"});
+
+  std::string path = "test-irv_snapshot-rtree.dtree";
+  RDirichletTree saved(candidates, 1, 4, 2., false, "123");
+  saved.update(ballots);
+  saved.save(path);
+
+  // The loaded tree starts with different candidates and parameters, which
+  // are all replaced.
+  RDirichletTree loaded(Rcpp::CharacterVector{"X", "Y"}, 0, 2, 1., true, "1");
+  loaded.load(path);
+  std::remove(path.c_str());
+
+  Rcpp::NumericVector fromSaved =
+      saved.samplePosterior(200, 10, 1, false, 1, "seed");
+  Rcpp::NumericVector fromLoaded =
+      loaded.samplePosterior(200, 10, 1, false, 1, "seed");
+
+  // Updating the loaded tree rebuilds its' nodes first.
+  saved.update(more);
+  loaded.update(more);
+  Rcpp::NumericVector afterSaved =
+      saved.samplePosterior(200, 10, 1, false, 1, "seed");
+  Rcpp::NumericVector afterLoaded =
+      loaded.samplePosterior(200, 10, 1, false, 1, "seed");
+
+  test_that("The parameters are restored.") {
+    expect_true(loaded.getNCandidates() == 4);
+    expect_true(loaded.getMinDepth() == 1);
+    expect_true(loaded.getA0() == 2.);
+    expect_false(loaded.getVD());
+  }
+
+  test_that("The loaded tree has the same posterior.") {
+    for (int i = 0; i < 4; ++i) {
+      expect_true(fromSaved[i] == fromLoaded[i]);
+      expect_true(afterSaved[i] == afterLoaded[i]);
+    }
+  }
+}
@@ -0,0 +1,87 @@
+/*
+ * This file tests the ObservationStore used by Dirichlet-trees.
+ */
+
+#include <testthat.h>
+
+#include <vector>
+
+#include "irv_ballot.h"
+#include "observation_store.h"
+
+context("Test the observation store.") {
+  // Use a constant key for every ballot, so that every lookup collides and
+  // must fall back to comparing ballots.
+  ObservationStore<IRVBallot> colliding(false);
+  ObservationStore<IRVBallot> ranked(true);
+  std::vector<IRVBallot> ballots = {IRVBallot({0}), IRVBallot({1, 0}),
+                                    IRVBallot({2, 1, 0}), IRVBallot()};
+  for (unsigned rep = 1; rep <= 3; ++rep) {
+    for (const IRVBallot &b : ballots) {
+      colliding.add(b, 0, rep);
+      ranked.add(b, b.rank(3), rep);
+    }
+  }
+  // Grow the ranked store past its' initial table size.
+  for (uint64_t r = 0; r < 16; ++r)
+    ranked.add(IRVBallot::unrank(r, 3), r, 1);
+
+  test_that("Repeated outcomes are counted together.") {
+    expect_true(colliding.size() == 4);
+    for (const IRVBallot &b : ballots) expect_true(colliding.count(b, 0) == 6);
+  }
+
+  test_that("Outcomes are found after the table grows.") {
+    expect_true(ranked.size() == 16);
+    for (const IRVBallot &b : ballots)
+      expect_true(ranked.count(b, b.rank(3)) == 7);
+    expect_true(ranked.count(IRVBallot({2, 0, 1}), 14) == 1);
+  }
+
+  test_that("Outcomes are iterated in order of first observation.") {
+    auto it = colliding.begin();
+    for (const IRVBallot &b : ballots) expect_true((it++)->first == b);
+  }
+}
+
+context("Test forking the observation store.") {
+  ObservationStore<IRVBallot> parent(true);
+  IRVBallot a({0}), b({1, 0}), c({2, 1, 0});
+  parent.add(a, a.rank(3), 1);
+  parent.add(b, b.rank(3), 2);
+  ObservationStore<IRVBallot> child = parent.fork();
+  parent.add(a, a.rank(3), 4);
+  child.add(c, c.rank(3), 8);
+  child.add(b, b.rank(3), 16);
+
+  std::vector<std::pair<IRVBallot, unsigned>> entries(child.begin(),
+                                                      child.end());
+
+  test_that("Both stores keep the observations made before the fork.") {
+    expect_true(parent.isForked() && child.isForked());
+    expect_true(parent.count(a, a.rank(3)) == 5);
+    expect_true(parent.count(b, b.rank(3)) == 2);
+    expect_true(child.count(a, a.rank(3)) == 1);
+    expect_true(child.count(b, b.rank(3)) == 18);
+  }
+
+  test_that("Observations after the fork are not shared.") {
+    expect_true(parent.count(c, c.rank(3)) == 0);
+    expect_true(child.count(c, c.rank(3)) == 8);
+  }
+
+  test_that("The shared layer is iterated before the own layer.") {
+    expect_true(child.size() == 4);
+    expect_true(entries.size() == 4);
+    expect_true(entries[0].first == a && entries[0].second == 1);
+    expect_true(entries[1].first == b && entries[1].second == 2);
+    expect_true(entries[2].first == c && entries[2].second == 8);
+    expect_true(entries[3].first == b && entries[3].second == 16);
+  }
+
+  test_that("Clearing a store does not affect its' forks.") {
+    parent.clear();
+    expect_true(parent.size() == 0 && parent.begin() == parent.end());
+    expect_true(child.count(a, a.rank(3)) == 1);
+  }
+}
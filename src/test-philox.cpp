@@ -0,0 +1,50 @@
+/*
+ * This file tests the Philox counter-based PRNG.
+ */
+
+#include <testthat.h>
+
+#include "philox.h"
+
+context("Test Philox known-answer vectors.") {
+  // The Philox4x32-10 known-answer tests from the Random123 distribution.
+  uint32_t key_zero[2] = {0, 0};
+  uint32_t ctr_zero[4] = {0, 0, 0, 0};
+  uint32_t key_pi[2] = {0xa4093822, 0x299f31d0};
+  uint32_t ctr_pi[4] = {0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344};
+
+  Philox zero(key_zero, ctr_zero);
+  Philox pi(key_pi, ctr_pi);
+
+  test_that("Philox matches the zero key and counter vector.") {
+    expect_true(zero() == 0x6627e8d5);
+    expect_true(zero() == 0xe169c58d);
+    expect_true(zero() == 0xbc57ac4c);
+    expect_true(zero() == 0x9b00dbd8);
+  }
+
+  test_that("Philox matches the digits of pi vector.") {
+    expect_true(pi() == 0xd16cfe09);
+    expect_true(pi() == 0x94fdcceb);
+    expect_true(pi() == 0x5001e420);
+    expect_true(pi() == 0x24126ea1);
+  }
+}
+
+context("Test Philox streams.") {
+  Philox a(123, 4);
+  Philox b(123, 4);
+  Philox c(123, 5);
+
+  // Skip an uneven number of outputs so that discard crosses a block.
+  for (unsigned i = 0; i < 11; ++i) a();
+  b.discard(11);
+
+  test_that("Discarding outputs is equivalent to generating them.") {
+    expect_true(a() == b());
+  }
+
+  test_that("Different streams produce different outputs.") {
+    expect_true(Philox(123, 4)() != c());
+  }
+}
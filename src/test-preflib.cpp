@@ -0,0 +1,78 @@
+/*
+ * This file tests the PrefLib reader.
+ */
+
+#include <testthat.h>
+
+#include <cstdio>
+#include <vector>
+
+#include "preflib.h"
+
+context("Test reading a PrefLib file.") {
+  // The tests are run from `tests/testthat`.
+  PrefLibReader reader("../data/wakehurst2023.soi");
+
+  size_t nVoters = 0, nOrders = 0;
+  std::vector<unsigned> first{};
+  unsigned firstCount = 0;
+  auto sink = [&](const unsigned *prefs, unsigned n, unsigned count) {
+    if (nOrders++ == 0) {
+      first.assign(prefs, prefs + n);
+      firstCount = count;
+    }
+    nVoters += count;
+  };
+  reader.readOrders(sink);
+
+  test_that("The header is parsed.") {
+    expect_true(reader.getDataType() == "soi");
+    expect_true(reader.getAlternativeNames().size() == 6);
+    expect_true(reader.getAlternativeNames()[0] == "HRNJAK Ethan");
+    expect_true(reader.getAlternativeNames()[5] == "WRIGHT Sue");
+  }
+
+  test_that("Every order is read.") {
+    expect_true(nVoters == reader.getNVoters());
+    expect_true(nOrders == reader.getNUniqueOrders());
+    expect_true(first == std::vector<unsigned>{4});
+    expect_true(firstCount == 14115);
+  }
+
+  test_that("Missing files are rejected.") {
+    CATCH_CHECK_THROWS(PrefLibReader("../data/missing.soi"));
+  }
+}
+
+context("Test writing and re-reading a PrefLib file.") {
+  const char *path = "test-preflib-output.soi";
+  std::vector<std::vector<unsigned>> orders = {{2, 0}, {1}, {}, {0, 1, 2}};
+  std::vector<unsigned> counts = {5, 3, 1, 12};
+  {
+    PrefLibWriter writer(path, {"A", "B", "C"});
+    for (size_t i = 0; i < orders.size(); ++i)
+      writer.writeOrder(orders[i].data(), orders[i].size(), counts[i]);
+    writer.close();
+  }
+
+  PrefLibReader reader(path);
+  std::vector<std::vector<unsigned>> readOrders{};
+  std::vector<unsigned> readCounts{};
+  auto sink = [&](const unsigned *prefs, unsigned n, unsigned count) {
+    readOrders.emplace_back(prefs, prefs + n);
+    readCounts.push_back(count);
+  };
+  reader.readOrders(sink);
+  std::remove(path);
+
+  test_that("The header totals are filled in.") {
+    expect_true(reader.getNVoters() == 21);
+    expect_true(reader.getNUniqueOrders() == 4);
+    expect_true(reader.getAlternativeNames()[2] == "C");
+  }
+
+  test_that("The orders are read back unchanged.") {
+    expect_true(readOrders == orders);
+    expect_true(readCounts == counts);
+  }
+}
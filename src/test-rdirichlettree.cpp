@@ -4,6 +4,11 @@
 
 #include <testthat.h>
 
+#include <algorithm>
+#include <list>
+#include <random>
+#include <vector>
+
 #include "R_tree.h"
 
 void createAndDeleteTree(Rcpp::CharacterVector candidates, unsigned minDepth,
@@ -28,3 +33,637 @@ context("Test RDirichletTree constructor and destructor.") {
         createAndDeleteTree(candidates, minDepth, maxDepth, a0, vd, seed));
   }
 }
+
+context("Test RDirichletTree updates from a ranking matrix.") {
+  Rcpp::CharacterVector candidates{"A", "B", "C", "D"};
+
+  // The ballots {A, B}, {C, A, D, B} x2, {B} and {} as a list and as a
+  // ranking matrix with aggregated counts. The matrix columns are in a
+  // different order to the candidates, and the empty ballot is included.
+  Rcpp::List ballots;
+  ballots.push_back(Rcpp::CharacterVector{"A", "B"});
+  ballots.push_back(Rcpp::CharacterVector{"C", "A", "D", "B"});
+  ballots.push_back(Rcpp::CharacterVector{"C", "A", "D", "B"});
+  ballots.push_back(Rcpp::CharacterVector{"B"});
+  ballots.push_back(Rcpp::CharacterVector{});
+
+  Rcpp::IntegerMatrix rankings(4, 4);
+  Rcpp::colnames(rankings) = Rcpp::CharacterVector{"D", "C", "B", "A"};
+  int values[4][4] = {{NA_INTEGER, NA_INTEGER, 2, 1},
+                      {3, 1, 4, 2},
+                      {NA_INTEGER, NA_INTEGER, 1, NA_INTEGER},
+                      {NA_INTEGER, NA_INTEGER, NA_INTEGER, NA_INTEGER}};
+  for (int i = 0; i < 4; ++i)
+    for (int j = 0; j < 4; ++j) rankings(i, j) = values[i][j];
+  Rcpp::IntegerVector counts{1, 2, 1, 1};
+
+  RDirichletTree listTree(candidates, 0, 4, 1., false, "123");
+  RDirichletTree matrixTree(candidates, 0, 4, 1., false, "123");
+  listTree.update(ballots);
+  matrixTree.updateRankings(rankings, counts, 1);
+
+  Rcpp::NumericVector fromList = listTree.samplePosterior(200, 10, 1, false,
+                                                          1, "456");
+  Rcpp::NumericVector fromMatrix = matrixTree.samplePosterior(200, 10, 1,
+                                                              false, 1, "456");
+  bool equal = true;
+  for (unsigned c = 0; c < 4; ++c)
+    equal = equal && fromList[c] == fromMatrix[c];
+
+  // A tie between candidates is rejected.
+  Rcpp::IntegerMatrix tied(1, 4);
+  Rcpp::colnames(tied) = candidates;
+  for (int j = 0; j < 4; ++j) tied(0, j) = 1;
+
+  // A zero or negative rank is rejected rather than treated as unranked.
+  Rcpp::IntegerMatrix zeroRank(1, 4), negativeRank(1, 4);
+  Rcpp::colnames(zeroRank) = candidates;
+  Rcpp::colnames(negativeRank) = candidates;
+  for (int j = 0; j < 4; ++j) {
+    zeroRank(0, j) = j;
+    negativeRank(0, j) = j == 0 ? -1 : j;
+  }
+
+  test_that("The list and matrix updates give the same posterior.") {
+    expect_true(equal);
+  }
+
+  test_that("Tied rankings are rejected.") {
+    CATCH_CHECK_THROWS(
+        matrixTree.updateRankings(tied, Rcpp::IntegerVector{1}, 1));
+  }
+
+  test_that("Non-positive ranks are rejected.") {
+    CATCH_CHECK_THROWS(
+        matrixTree.updateRankings(zeroRank, Rcpp::IntegerVector{1}, 1));
+    CATCH_CHECK_THROWS(
+        matrixTree.updateRankings(negativeRank, Rcpp::IntegerVector{1}, 1));
+  }
+}
+
+context("Test copy-on-write clones of a Dirichlet-tree.") {
+  IRVParameters params(6, 0, 6, 1., false);
+  IRVParameters cloneParams(6, 0, 6, 1., false);
+  DirichletTree<IRVNode, IRVBallot, IRVParameters> tree(&params);
+  std::mt19937 e(2022);
+  std::vector<unsigned> perm = {0, 1, 2, 3, 4, 5};
+  for (unsigned i = 0; i < 200; ++i) {
+    std::shuffle(perm.begin(), perm.end(), e);
+    tree.update({IRVBallot(perm.begin(), perm.begin() + e() % 7), 1});
+  }
+
+  std::mt19937 before(1);
+  std::list<IRVBallotCount> sampledBefore = tree.sample(1000, &before);
+
+  // Update the clone with a ballot starting with candidate 0.
+  DirichletTree<IRVNode, IRVBallot, IRVParameters> *clone =
+      tree.clone(&cloneParams);
+  clone->update({IRVBallot({0, 1, 2}), 5});
+
+  std::mt19937 after(1);
+  std::list<IRVBallotCount> sampledAfter = tree.sample(1000, &after);
+
+  const IRVNode *root = tree.getRoot();
+  const IRVNode *cloneRoot = clone->getRoot();
+
+  test_that("The clone copies the nodes on the updated path.") {
+    expect_true(cloneRoot != root);
+    expect_true(cloneRoot->getChild(0) != root->getChild(0));
+    expect_true(cloneRoot->getA(0) == root->getA(0) + 5);
+  }
+
+  test_that("The clone shares the other nodes.") {
+    for (unsigned i = 1; i < 6; ++i)
+      expect_true(cloneRoot->getChild(i) == root->getChild(i));
+    for (unsigned i = 0; i < 5; ++i)
+      if (i != 0)
+        expect_true(cloneRoot->getChild(0)->getChild(i) ==
+                    root->getChild(0)->getChild(i));
+  }
+
+  test_that("The original tree is unaffected.") {
+    expect_true(sampledBefore == sampledAfter);
+    expect_true(tree.getNObserved() + 5 == clone->getNObserved());
+    IRVBallot b({0, 1, 2});
+    uint64_t key = params.outcomeKey(b);
+    expect_true(tree.getObserved().count(b, key) + 5 ==
+                clone->getObserved().count(b, key));
+  }
+
+  delete clone;
+}
+
+context("Test cloning an RDirichletTree.") {
+  Rcpp::CharacterVector candidates{"A", "B", "C", "D"};
+  Rcpp::List ballots;
+  ballots.push_back(Rcpp::CharacterVector{"A", "B"});
+  ballots.push_back(Rcpp::CharacterVector{"C", "A", "D", "B"});
+  ballots.push_back(Rcpp::CharacterVector{"B"});
+  Rcpp::List more;
+  more.push_back(Rcpp::CharacterVector{"D", "C"});
+  more.push_back(Rcpp::CharacterVector{"C", "A", "D", "B"});
+
+  RDirichletTree parent(candidates, 0, 3, 1., false, "123");
+  parent.update(ballots);
+  Rcpp::NumericVector parentBefore =
+      parent.samplePosterior(200, 10, 1, false, 1, "456");
+
+  // The clone is updated with more ballots, and should match a tree which
+  // observed every ballot.
+  RDirichletTree *clone = parent.clone();
+  clone->update(more);
+  clone->setA0(2.);
+  RDirichletTree expected(candidates, 0, 3, 2., false, "123");
+  expected.update(ballots);
+  expected.update(more);
+
+  Rcpp::NumericVector parentAfter =
+      parent.samplePosterior(200, 10, 1, false, 1, "456");
+  Rcpp::NumericVector fromClone =
+      clone->samplePosterior(200, 10, 1, false, 1, "456");
+  Rcpp::NumericVector fromExpected =
+      expected.samplePosterior(200, 10, 1, false, 1, "456");
+
+  test_that("The clone has the posterior of every observed ballot.") {
+    for (int i = 0; i < 4; ++i) expect_true(fromClone[i] == fromExpected[i]);
+  }
+
+  test_that("The parent tree is unaffected.") {
+    expect_true(parent.getA0() == 1.);
+    for (int i = 0; i < 4; ++i) expect_true(parentBefore[i] == parentAfter[i]);
+  }
+
+  delete clone;
+}
+
+context("Test merging Dirichlet-trees.") {
+  IRVParameters params(6, 0, 6, 1., false);
+  IRVParameters shardParams(6, 0, 6, 1., false);
+  IRVParameters otherParams(6, 1, 6, 1., false);
+  DirichletTree<IRVNode, IRVBallot, IRVParameters> whole(&params);
+  DirichletTree<IRVNode, IRVBallot, IRVParameters> merged(&params);
+  DirichletTree<IRVNode, IRVBallot, IRVParameters> shard(&shardParams);
+  DirichletTree<IRVNode, IRVBallot, IRVParameters> incompatible(&otherParams);
+
+  // Split random ballots between the two shards.
+  std::mt19937 e(2022);
+  std::vector<unsigned> perm = {0, 1, 2, 3, 4, 5};
+  for (unsigned i = 0; i < 300; ++i) {
+    std::shuffle(perm.begin(), perm.end(), e);
+    IRVBallotCount bc(IRVBallot(perm.begin(), perm.begin() + e() % 7), 1);
+    whole.update(bc);
+    if (i % 3 == 0) {
+      merged.update(bc);
+    } else {
+      shard.update(bc);
+    }
+  }
+
+  std::mt19937 shardBefore(1);
+  std::list<IRVBallotCount> sampledShardBefore =
+      shard.sample(1000, &shardBefore);
+  merged.merge(shard);
+
+  // Updating either tree afterwards does not affect the other.
+  IRVBallotCount extra(IRVBallot({5, 4, 3}), 3);
+  whole.update(extra);
+  merged.update(extra);
+
+  std::mt19937 e1(1), e2(1), shardAfter(1);
+  std::list<IRVBallotCount> fromWhole = whole.sample(1000, &e1);
+  std::list<IRVBallotCount> fromMerged = merged.sample(1000, &e2);
+  std::list<IRVBallotCount> sampledShardAfter =
+      shard.sample(1000, &shardAfter);
+
+  bool observedEqual =
+      whole.getObserved().size() == merged.getObserved().size();
+  for (const auto &[b, c] : whole.getObserved())
+    observedEqual = observedEqual &&
+                    merged.getObserved().count(b, params.outcomeKey(b)) == c;
+
+  test_that("The merged tree is the posterior of every ballot.") {
+    expect_true(merged.getNObserved() == whole.getNObserved());
+    expect_true(observedEqual);
+    expect_true(fromMerged == fromWhole);
+  }
+
+  test_that("The other tree is unaffected.") {
+    expect_true(sampledShardBefore == sampledShardAfter);
+  }
+
+  test_that("Incompatible trees are not merged.") {
+    CATCH_CHECK_THROWS(merged.merge(incompatible));
+    CATCH_CHECK_THROWS(merged.merge(merged));
+  }
+}
+
+context("Test merging RDirichletTrees.") {
+  Rcpp::CharacterVector candidates{"A", "B", "C", "D"};
+  Rcpp::List ballots;
+  ballots.push_back(Rcpp::CharacterVector{"A", "B"});
+  ballots.push_back(Rcpp::CharacterVector{"C", "A", "D", "B"});
+  Rcpp::List more;
+  more.push_back(Rcpp::CharacterVector{"B"});
+  more.push_back(Rcpp::CharacterVector{"C", "A", "D", "B"});
+
+  RDirichletTree merged(candidates, 0, 3, 1., false, "123");
+  RDirichletTree shard(candidates, 0, 3, 1., false, "123");
+  RDirichletTree expected(candidates, 0, 3, 1., false, "123");
+  RDirichletTree reordered(Rcpp::CharacterVector{"D", "C", "B", "A"}, 0, 3, 1.,
+                           false, "123");
+  merged.update(ballots);
+  shard.update(more);
+  expected.update(ballots);
+  expected.update(more);
+  merged.merge(shard);
+
+  Rcpp::NumericVector fromMerged =
+      merged.samplePosterior(200, 10, 1, false, 1, "456");
+  Rcpp::NumericVector fromExpected =
+      expected.samplePosterior(200, 10, 1, false, 1, "456");
+
+  test_that("The merged tree has the posterior of every ballot.") {
+    for (int i = 0; i < 4; ++i) expect_true(fromMerged[i] == fromExpected[i]);
+  }
+
+  test_that("Trees with different candidates are not merged.") {
+    CATCH_CHECK_THROWS(merged.merge(reordered));
+  }
+}
+
+// Checks that two sub-trees have the same structure and parameters.
+bool sameTree(const IRVNode *a, const IRVNode *b) {
+  if ((a == nullptr) != (b == nullptr)) return false;
+  if (a == nullptr) return true;
+  if (a->getNChildren() != b->getNChildren()) return false;
+  for (unsigned i = 0; i <= a->getNChildren(); ++i)
+    if (a->getA(i) != b->getA(i)) return false;
+  for (unsigned i = 0; i < a->getNChildren(); ++i)
+    if (!sameTree(a->getChild(i), b->getChild(i))) return false;
+  return true;
+}
+
+// Checks that two tables hold the same ballots in the same order.
+bool sameTables(const IRVBallotTable &a, const IRVBallotTable &b) {
+  bool same = a.size() == b.size();
+  for (size_t i = 0; same && i < a.size(); ++i)
+    same = a.count(i) == b.count(i) && a.length(i) == b.length(i) &&
+           std::equal(a.ballot(i), a.ballot(i) + a.length(i), b.ballot(i));
+  return same;
+}
+
+context("Test parallel batch updates.") {
+  IRVParameters params(8, 0, 8, 1., false);
+  DirichletTree<IRVNode, IRVBallot, IRVParameters> sequential(&params);
+  DirichletTree<IRVNode, IRVBallot, IRVParameters> parallel(&params);
+
+  // Most ballots start with the same candidate, so that its' branch has to be
+  // split again below the root.
+  std::mt19937 e(2022);
+  std::vector<unsigned> perm = {0, 1, 2, 3, 4, 5, 6, 7};
+  std::vector<IRVBallotCount> batch;
+  for (unsigned i = 0; i < 20000; ++i) {
+    std::shuffle(perm.begin(), perm.end(), e);
+    if (i % 4 != 0) std::swap(perm[0], *std::find(perm.begin(), perm.end(), 0));
+    batch.emplace_back(IRVBallot(perm.begin(), perm.begin() + e() % 9),
+                       1 + e() % 5);
+  }
+
+  sequential.update(batch.begin(), batch.end());
+  parallel.update(batch.begin(), batch.end(), 4);
+  bool equalAfterUpdate = sameTree(sequential.getRoot(), parallel.getRoot());
+
+  // A clone copies the shared nodes on each thread.
+  IRVParameters cloneParams(8, 0, 8, 1., false);
+  DirichletTree<IRVNode, IRVBallot, IRVParameters> *clone =
+      parallel.clone(&cloneParams);
+  sequential.update(batch.begin(), batch.end());
+  clone->update(batch.begin(), batch.end(), 3);
+  bool equalAfterClone = sameTree(sequential.getRoot(), clone->getRoot());
+
+  std::mt19937 e1(1), e2(1);
+  std::list<IRVBallotCount> fromSequential = sequential.sample(1000, &e1);
+  std::list<IRVBallotCount> fromClone = clone->sample(1000, &e2);
+
+  test_that("A parallel update gives the same tree as a sequential one.") {
+    expect_true(equalAfterUpdate);
+    expect_true(equalAfterClone);
+    expect_true(fromSequential == fromClone);
+    expect_true(parallel.getNObserved() * 2 == sequential.getNObserved());
+  }
+
+  delete clone;
+}
+
+context("Test splitting samples into independent tasks.") {
+  IRVParameters params(6, 0, 6, 1., false);
+  DirichletTree<IRVNode, IRVBallot, IRVParameters> tree(&params);
+  std::mt19937 e(2022);
+  std::vector<unsigned> perm = {0, 1, 2, 3, 4, 5};
+  std::vector<IRVBallotCount> batch;
+  for (unsigned i = 0; i < 50; ++i) {
+    std::shuffle(perm.begin(), perm.end(), e);
+    batch.emplace_back(IRVBallot(perm.begin(), perm.begin() + e() % 7), 1);
+  }
+  tree.update(batch.begin(), batch.end());
+
+  // Sample the tasks in order, and again in reverse order on a fresh
+  // workspace, as a different thread would.
+  IRVWorkspace ws(&params);
+  IRVSplit split(&params);
+  IRVBallotTable above{};
+  Philox engine(7, 0);
+  tree.split(10000, 2, ws, &engine, above, split);
+
+  unsigned total = 0;
+  for (size_t i = 0; i < above.size(); ++i) total += above.count(i);
+  std::vector<IRVBallotTable> forward(split.size()), backward(split.size());
+  for (size_t t = 0; t < split.size(); ++t) {
+    split.sample(&params, t, ws, forward[t]);
+    for (size_t i = 0; i < forward[t].size(); ++i)
+      total += forward[t].count(i);
+  }
+  IRVWorkspace otherWs(&params);
+  for (size_t t = split.size(); t-- > 0;)
+    split.sample(&params, t, otherWs, backward[t]);
+
+  bool sameTasks = true;
+  for (size_t t = 0; t < split.size(); ++t) {
+    sameTasks = sameTasks && forward[t].size() == backward[t].size();
+    for (size_t i = 0; sameTasks && i < forward[t].size(); ++i)
+      sameTasks = forward[t].count(i) == backward[t].count(i) &&
+                  std::equal(forward[t].ballot(i),
+                             forward[t].ballot(i) + forward[t].length(i),
+                             backward[t].ballot(i));
+  }
+
+  // Elections large enough to be split give the same results on any number
+  // of threads.
+  Rcpp::CharacterVector candidates{"A", "B", "C", "D", "E"};
+  RDirichletTree rtree(candidates, 0, 5, 1., false, "123");
+  Rcpp::List ballots;
+  ballots.push_back(Rcpp::CharacterVector{"A", "B"});
+  ballots.push_back(Rcpp::CharacterVector{"C", "A", "D"});
+  rtree.update(ballots);
+  Rcpp::NumericVector ps1 = rtree.samplePosterior(3, 100000, 1, false, 1,
+                                                  "456");
+  Rcpp::NumericVector ps4 = rtree.samplePosterior(3, 100000, 1, false, 4,
+                                                  "456");
+  bool sameResults = true;
+  for (unsigned c = 0; c < 5; ++c)
+    sameResults = sameResults && ps1[c] == ps4[c];
+
+  test_that("Every ballot is sampled by the split or a task.") {
+    expect_true(split.size() > 1);
+    expect_true(total == 10000);
+  }
+
+  test_that("Tasks sample the same ballots in any order.") {
+    expect_true(sameTasks);
+    expect_true(ws.path == params.defaultPath());
+  }
+
+  test_that("Split elections do not depend on the number of threads.") {
+    expect_true(sameResults);
+  }
+}
+
+context("Test sampling several elections in one traversal.") {
+  IRVParameters params(6, 0, 6, 1., false);
+  DirichletTree<IRVNode, IRVBallot, IRVParameters> tree(&params);
+  std::mt19937 e(2022);
+  std::vector<unsigned> perm = {0, 1, 2, 3, 4, 5};
+  std::vector<IRVBallotCount> batch;
+  for (unsigned i = 0; i < 200; ++i) {
+    std::shuffle(perm.begin(), perm.end(), e);
+    batch.emplace_back(IRVBallot(perm.begin(), perm.begin() + e() % 7), 1);
+  }
+  tree.update(batch.begin(), batch.end());
+
+  // Sample each lane in a block, and then each lane on its' own with a copy
+  // of the same engine.
+  const unsigned lanes = 5;
+  std::vector<unsigned> counts = {1, 20, 300, 4000, 50000};
+  std::vector<Philox> engines, copies;
+  std::vector<Philox *> enginePtrs;
+  std::vector<IRVBallotTable> blocked(lanes), single(lanes);
+  std::vector<IRVBallotTable *> sinkPtrs;
+  for (unsigned k = 0; k < lanes; ++k) {
+    engines.emplace_back(11, k);
+    copies.emplace_back(11, k);
+  }
+  for (unsigned k = 0; k < lanes; ++k) {
+    enginePtrs.push_back(&engines[k]);
+    sinkPtrs.push_back(&blocked[k]);
+  }
+  IRVLaneWorkspace laneWs(&params, lanes);
+  tree.sampleLanes(lanes, counts.data(), laneWs, enginePtrs.data(),
+                   sinkPtrs.data());
+
+  IRVWorkspace ws(&params);
+  for (unsigned k = 0; k < lanes; ++k)
+    tree.sample(counts[k], ws, &copies[k], single[k]);
+
+  bool same = true;
+  for (unsigned k = 0; k < lanes; ++k) {
+    same = same && blocked[k].size() == single[k].size();
+    for (size_t i = 0; same && i < blocked[k].size(); ++i)
+      same = blocked[k].count(i) == single[k].count(i) &&
+             blocked[k].length(i) == single[k].length(i) &&
+             std::equal(blocked[k].ballot(i),
+                        blocked[k].ballot(i) + blocked[k].length(i),
+                        single[k].ballot(i));
+    // Both engines are left in the same state.
+    same = same && engines[k]() == copies[k]();
+  }
+
+  test_that("Each lane samples the same ballots as it would on its' own.") {
+    expect_true(same);
+    expect_true(laneWs.ws.path == params.defaultPath());
+  }
+}
+
+context("Test sampling from a frozen tree.") {
+  IRVParameters params(6, 2, 5, 1.5, true);
+  DirichletTree<IRVNode, IRVBallot, IRVParameters> tree(&params);
+  std::mt19937 e(2022);
+  std::vector<unsigned> perm = {0, 1, 2, 3, 4, 5};
+  std::vector<IRVBallotCount> batch;
+  for (unsigned i = 0; i < 200; ++i) {
+    std::shuffle(perm.begin(), perm.end(), e);
+    batch.emplace_back(IRVBallot(perm.begin(), perm.begin() + 2 + e() % 4), 1);
+  }
+  tree.update(batch.begin(), batch.end());
+
+  // Sample from the nodes, and then from the image with the same streams.
+  IRVWorkspace ws(&params);
+  IRVLaneWorkspace laneWs(&params, 3);
+  IRVSplit split(&params);
+  std::vector<unsigned> counts = {5, 400, 20000};
+  IRVBallotTable live[3], frozen[3], liveAbove{}, frozenAbove{};
+  std::vector<IRVBallotTable> liveTasks, frozenTasks;
+  for (bool freeze : {false, true}) {
+    if (freeze) tree.freeze();
+    IRVBallotTable *tables = freeze ? frozen : live;
+    Philox engines[3] = {Philox(3, 0), Philox(3, 1), Philox(3, 2)};
+    Philox *enginePtrs[3] = {&engines[0], &engines[1], &engines[2]};
+    IRVBallotTable *sinkPtrs[3] = {&tables[0], &tables[1], &tables[2]};
+    tree.sampleLanes(3, counts.data(), laneWs, enginePtrs, sinkPtrs);
+    Philox engine(5, 0);
+    tree.sample(1000, ws, &engine, tables[0]);
+
+    IRVBallotTable &above = freeze ? frozenAbove : liveAbove;
+    std::vector<IRVBallotTable> &tasks = freeze ? frozenTasks : liveTasks;
+    tree.split(10000, 2, ws, &engine, above, split);
+    tasks.resize(split.size());
+    for (size_t t = 0; t < split.size(); ++t)
+      tree.sampleTask(split, t, ws, tasks[t]);
+  }
+  bool isFrozen = tree.isFrozen() && split.frozen;
+
+  bool sameSamples = sameTables(liveAbove, frozenAbove) &&
+                     liveTasks.size() == frozenTasks.size();
+  for (unsigned k = 0; k < 3; ++k)
+    sameSamples = sameSamples && sameTables(live[k], frozen[k]);
+  for (size_t t = 0; sameSamples && t < liveTasks.size(); ++t)
+    sameSamples = sameTables(liveTasks[t], frozenTasks[t]);
+
+  // Changing the parameters or updating the tree discards the image.
+  params.setA0(2.);
+  bool staleParams = !tree.isFrozen();
+  params.setA0(1.5);
+  bool restored = tree.isFrozen();
+  tree.update(batch[0]);
+  bool staleUpdate = !tree.isFrozen();
+
+  test_that("The image samples the same ballots as the nodes.") {
+    expect_true(isFrozen);
+    expect_true(sameSamples);
+    expect_true(ws.path == params.defaultPath());
+  }
+
+  test_that("The image is discarded when the tree changes.") {
+    expect_true(staleParams);
+    expect_true(restored);
+    expect_true(staleUpdate);
+  }
+}
+
+context("Test storing only the observed children of large nodes.") {
+  // Observe ballots over 30 candidates, so that the deeper nodes only observe
+  // a few of their children.
+  IRVParameters params(30, 0, 30, 1., false);
+  DirichletTree<IRVNode, IRVBallot, IRVParameters> tree(&params);
+  DirichletTree<IRVNode, IRVBallot, IRVParameters> odd(&params), even(&params);
+  std::mt19937 e(2022);
+  std::vector<unsigned> perm = params.defaultPath();
+  std::vector<IRVBallotCount> batch;
+  for (unsigned i = 0; i < 300; ++i) {
+    std::shuffle(perm.begin(), perm.end(), e);
+    batch.emplace_back(IRVBallot(perm.begin(), perm.begin() + 1 + e() % 6),
+                       1 + e() % 3);
+  }
+  tree.update(batch.begin(), batch.end());
+
+  // Observe every other ballot one at a time in two trees, and merge them.
+  for (size_t i = 0; i < batch.size(); ++i)
+    (i % 2 == 0 ? even : odd).update(batch[i]);
+  even.merge(odd);
+
+  // The parameters of the root are the number of ballots with each first
+  // preference.
+  std::vector<double> firstPrefs(31, 0.);
+  for (const auto &[b, count] : batch) firstPrefs[b[0]] += count;
+  const IRVNode *root = tree.getRoot();
+  bool rootCounts = true;
+  for (unsigned i = 0; i <= 30; ++i)
+    rootCounts = rootCounts && root->getA(i) == firstPrefs[i];
+
+  // Sparse nodes only double while they have room for at most an eighth of
+  // their children, so they store at most a quarter of them, in order.
+  unsigned nSparse = 0;
+  bool sparseValid = true;
+  auto visit = [&](const IRVNode *node, auto &self) -> void {
+    if (node == nullptr) return;
+    if (node->isSparse()) {
+      ++nSparse;
+      sparseValid =
+          sparseValid && 4 * node->getNSlots() <= node->getNChildren();
+      for (unsigned k = 1; k < node->getNSlots(); ++k)
+        sparseValid = sparseValid &&
+                      node->getSlotIndex(k - 1) < node->getSlotIndex(k);
+    }
+    for (unsigned k = 0; k < node->getNSlots(); ++k)
+      self(node->getSlotChild(k), self);
+  };
+  visit(root, visit);
+
+  // The frozen image keeps the sparse nodes, and samples the same ballots.
+  IRVWorkspace ws(&params);
+  IRVBallotTable live{}, frozen{};
+  Philox e1(9, 0), e2(9, 0);
+  tree.sample(5000, ws, &e1, live);
+  tree.freeze();
+  tree.sample(5000, ws, &e2, frozen);
+
+  test_that("Sparse nodes have the same parameters as dense nodes.") {
+    expect_true(rootCounts);
+    expect_true(nSparse > 0);
+    expect_true(sparseValid);
+  }
+
+  test_that("Merging sparse nodes gives the same tree as updating them.") {
+    expect_true(sameTree(tree.getRoot(), even.getRoot()));
+  }
+
+  test_that("A frozen image of sparse nodes samples the same ballots.") {
+    expect_true(sameTables(live, frozen));
+  }
+}
+
+context("Test the sampling kernels specialised for the shape of a tree.") {
+  // Sample the same streams with the kernels bounded by 8 candidates, which
+  // are dispatched for 6 candidates, and with the unbounded kernels.
+  bool sameSamples = true;
+  for (bool vd : {false, true}) {
+    IRVParameters params(6, 2, 5, 1.5, vd);
+    Arena arena;
+    IRVNode root(0, &params, &arena);
+    std::mt19937 e(2022);
+    std::vector<unsigned> perm = params.defaultPath();
+    for (unsigned i = 0; i < 100; ++i) {
+      std::shuffle(perm.begin(), perm.end(), e);
+      root.update(&params, IRVBallot(perm.begin(), perm.begin() + 2 + e() % 4),
+                  params.defaultPath(), 1, &arena);
+    }
+
+    IRVWorkspace ws(&params);
+    IRVLaneWorkspace laneWs(&params, 2);
+    auto sampleWith = [&](auto shape, IRVBallotTable *tables) {
+      Philox engine(7, 0);
+      root.sample(shape, &params, 3000, ws, &engine, tables[0]);
+      lazyIRVBallots(shape, &params, 3000, 1, ws, &engine, tables[1]);
+      Philox engines[2] = {Philox(7, 1), Philox(7, 2)};
+      Philox *enginePtrs[2] = {&engines[0], &engines[1]};
+      IRVBallotTable *sinkPtrs[2] = {&tables[2], &tables[3]};
+      unsigned counts[2] = {50, 5000};
+      root.sampleLanes(shape, &params, 2, counts, laneWs, enginePtrs,
+                       sinkPtrs);
+    };
+    IRVBallotTable bounded[4], unbounded[4];
+    if (vd) {
+      sampleWith(IRVShape<8, true>{}, bounded);
+      sampleWith(IRVShape<0, true>{}, unbounded);
+    } else {
+      sampleWith(IRVShape<8, false>{}, bounded);
+      sampleWith(IRVShape<0, false>{}, unbounded);
+    }
+    for (unsigned k = 0; k < 4; ++k)
+      sameSamples = sameSamples && bounded[k].size() > 0 &&
+                    sameTables(bounded[k], unbounded[k]);
+  }
+
+  test_that("The bounded kernels sample the same ballots.") {
+    expect_true(sameSamples);
+  }
+}
@@ -0,0 +1,93 @@
+/*
+ * This file tests the persistent work-stealing thread pool.
+ */
+
+#include <testthat.h>
+
+#include <algorithm>
+#include <atomic>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+#include "thread_pool.h"
+
+context("Test parallelFor visits every index once.") {
+  ThreadPool &pool = ThreadPool::global();
+
+  // Make the work uneven, so that some threads must steal from others.
+  size_t n = 10007;
+  std::vector<std::atomic<unsigned>> visits(n);
+  std::atomic<bool> validParticipants{true};
+  unsigned nThreads = 4;
+  pool.parallelFor(n, nThreads, 3, [&](unsigned w, size_t begin, size_t end) {
+    if (w >= nThreads) validParticipants = false;
+    for (size_t i = begin; i < end; ++i) {
+      volatile unsigned spin = (i % 97 == 0) ? 20000 : 10;
+      while (spin) spin = spin - 1;
+      ++visits[i];
+    }
+  });
+
+  bool allOnce = true;
+  for (auto &v : visits) allOnce = allOnce && v == 1;
+
+  // A second loop with fewer threads reuses the existing workers.
+  unsigned nWorkers = pool.nWorkers();
+  std::atomic<size_t> sum{0};
+  pool.parallelFor(100, 2, 1, [&](unsigned, size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) sum += i;
+  });
+
+  test_that("Every index is visited exactly once.") { expect_true(allOnce); }
+
+  test_that("Participant indices are less than nThreads.") {
+    expect_true(validParticipants);
+  }
+
+  test_that("Workers persist between loops.") {
+    expect_true(pool.nWorkers() == nWorkers);
+    expect_true(sum == 4950);
+  }
+}
+
+context("Test parallelFor propagates exceptions.") {
+  ThreadPool &pool = ThreadPool::global();
+
+  auto throwing = [&]() {
+    pool.parallelFor(1000, 4, 1, [](unsigned, size_t begin, size_t) {
+      if (begin == 777) throw std::runtime_error("failed");
+    });
+  };
+
+  test_that("An exception in a job is rethrown on the calling thread.") {
+    CATCH_CHECK_THROWS_AS(throwing(), std::runtime_error);
+  }
+
+  // The pool is still usable after a failed loop.
+  std::atomic<unsigned> count{0};
+  pool.parallelFor(50, 4, 1, [&](unsigned, size_t begin, size_t end) {
+    count += end - begin;
+  });
+
+  test_that("The pool can be reused after an exception.") {
+    expect_true(count == 50);
+  }
+}
+
+context("Test parallelSort.") {
+  ThreadPool &pool = ThreadPool::global();
+
+  // Sort with a number of threads which is not a power of two, so that some
+  // runs are merged with nothing.
+  std::mt19937 e(1);
+  std::vector<unsigned> values(10007);
+  for (unsigned &v : values) v = e() % 1000;
+  std::vector<unsigned> expected = values;
+  std::sort(expected.begin(), expected.end());
+  std::vector<unsigned> sorted = values;
+  pool.parallelSort(sorted.begin(), sorted.end(), 5,
+                    [](unsigned a, unsigned b) { return a < b; });
+
+  test_that("The range is sorted.") { expect_true(sorted == expected); }
+}
@@ -0,0 +1,149 @@
+/******************************************************************************
+ * File:             thread_pool.cpp
+ *
+ * Author:           Floyd Everest <me@floydeverest.com>
+ * Created:          10/16/26
+ * Description:      This file implements the ThreadPool methods as outlined
+ *                   in `thread_pool.h`.
+ *****************************************************************************/
+
+#include "thread_pool.h"
+
+#ifdef _WIN32
+#include <process.h>
+#define getProcessId _getpid
+#else
+#include <unistd.h>
+#define getProcessId getpid
+#endif
+
+thread_local bool ThreadPool::inTask = false;
+
+namespace {
+
+// The process-wide pool, and the process which created it.
+std::unique_ptr<ThreadPool> globalPool{};
+long globalPoolOwner = 0;
+std::mutex globalPoolMutex{};
+
+}  // namespace
+
+ThreadPool &ThreadPool::global() {
+  std::lock_guard<std::mutex> lock(globalPoolMutex);
+  long pid = static_cast<long>(getProcessId());
+  if (globalPool && globalPoolOwner != pid) {
+    // The process was forked, so the workers (and possibly the state of the
+    // mutexes) belong to the parent. The old pool is leaked rather than
+    // destroyed, since its' threads cannot be joined.
+    globalPool.release();
+  }
+  if (!globalPool) {
+    globalPool.reset(new ThreadPool());
+    globalPoolOwner = pid;
+  }
+  return *globalPool;
+}
+
+void ThreadPool::shutdown() {
+  std::lock_guard<std::mutex> lock(globalPoolMutex);
+  if (globalPool && globalPoolOwner != static_cast<long>(getProcessId()))
+    globalPool.release();
+  globalPool.reset();
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  wake.notify_all();
+  for (auto &t : workers) t.join();
+}
+
+unsigned ThreadPool::nWorkers() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return workers.size();
+}
+
+void ThreadPool::workerLoop(unsigned participant) {
+  uint64_t seen = 0;
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      wake.wait(lock, [&]() {
+        return stopping || (generation != seen && participant <= nActive);
+      });
+      if (stopping) return;
+      seen = generation;
+    }
+    inTask = true;
+    task(participant);
+    inTask = false;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (--nRunning == 0) done.notify_one();
+    }
+  }
+}
+
+void ThreadPool::run(unsigned nThreads, std::function<void(unsigned)> fn) {
+  std::lock_guard<std::mutex> call(callMutex);
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    // Spawn any missing workers. These persist until the pool is destroyed.
+    while (workers.size() < nThreads - 1) {
+      unsigned participant = workers.size() + 1;
+      workers.emplace_back([this, participant]() { workerLoop(participant); });
+    }
+    task = std::move(fn);
+    nActive = nThreads - 1;
+    nRunning = nActive;
+    ++generation;
+  }
+  wake.notify_all();
+
+  // The calling thread is participant 0.
+  inTask = true;
+  task(0);
+  inTask = false;
+
+  std::unique_lock<std::mutex> lock(mutex);
+  done.wait(lock, [this]() { return nRunning == 0; });
+  task = nullptr;
+}
+
+bool ThreadPool::take(Range &r, size_t chunk, size_t &begin, size_t &end) {
+  uint64_t current = r.range.load();
+  for (;;) {
+    size_t l = lo(current), h = hi(current);
+    if (l >= h) return false;
+    size_t next = std::min(l + chunk, h);
+    if (r.range.compare_exchange_weak(current, pack(next, h))) {
+      begin = l;
+      end = next;
+      return true;
+    }
+  }
+}
+
+bool ThreadPool::steal(std::vector<Range> &ranges, unsigned w) {
+  unsigned n = ranges.size();
+  for (unsigned k = 1; k < n; ++k) {
+    Range &victim = ranges[(w + k) % n];
+    uint64_t current = victim.range.load();
+    for (;;) {
+      size_t l = lo(current), h = hi(current);
+      if (l >= h) break;
+      // Leave the front half to the owner, and take the back half. A single
+      // remaining index is taken whole.
+      size_t mid = l + (h - l) / 2;
+      if (victim.range.compare_exchange_weak(current, pack(l, mid))) {
+        // Only the owner takes from its' own range, and it is empty, so no
+        // other thread can be updating it except to fail a steal.
+        ranges[w].range.store(pack(mid, h));
+        return true;
+      }
+    }
+  }
+  return false;
+}
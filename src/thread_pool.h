@@ -0,0 +1,253 @@
+/******************************************************************************
+ * File:             thread_pool.h
+ *
+ * Author:           Floyd Everest <me@floydeverest.com>
+ * Created:          10/16/26
+ * Description:      This file declares the `ThreadPool` class, a process-wide
+ *                   pool of worker threads which persists between calls from
+ *                   R. Loops are split into one range of indices per thread,
+ *                   each thread takes small chunks from the front of its' own
+ *                   range, and threads which run out of work steal the back
+ *                   half of another thread's range.
+ *****************************************************************************/
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+class ThreadPool {
+ private:
+  // Guards the fields below, which are shared with the workers.
+  std::mutex mutex{};
+
+  // Signals the workers that a new task is available, or that they should
+  // stop.
+  std::condition_variable wake{};
+
+  // Signals the calling thread that every worker has finished the task.
+  std::condition_variable done{};
+
+  // The worker threads. Worker i participates in a task as participant i + 1,
+  // since the calling thread is always participant 0.
+  std::vector<std::thread> workers{};
+
+  // The task for the current generation, called with the participant index.
+  std::function<void(unsigned)> task{};
+
+  // Incremented each time a new task is dispatched.
+  uint64_t generation = 0;
+
+  // The number of workers participating in the current task, and the number
+  // which have yet to finish it.
+  unsigned nActive = 0;
+  unsigned nRunning = 0;
+
+  // Set when the pool is being destroyed.
+  bool stopping = false;
+
+  // Serialises calls to `run`, since the pool executes one task at a time.
+  std::mutex callMutex{};
+
+  // The main loop for each worker thread.
+  void workerLoop(unsigned participant);
+
+  /*! \brief Runs a task on the calling thread and nThreads - 1 workers.
+   *
+   *  Spawns any workers which do not exist yet, then blocks until every
+   * participant has returned from the task. The task must not throw.
+   *
+   * \param nThreads The number of participants, including the calling thread.
+   *
+   * \param fn The task, called once by each participant with its' index.
+   */
+  void run(unsigned nThreads, std::function<void(unsigned)> fn);
+
+  // Packs a range of indices [lo, hi) into a single word, so that owners and
+  // thieves can update it atomically.
+  static uint64_t pack(uint64_t lo, uint64_t hi) { return lo << 32 | hi; }
+  static size_t lo(uint64_t range) { return range >> 32; }
+  static size_t hi(uint64_t range) { return range & 0xffffffff; }
+
+  // The range of indices owned by each participant, padded to avoid false
+  // sharing.
+  struct alignas(64) Range {
+    std::atomic<uint64_t> range{0};
+  };
+
+  // Takes up to `chunk` indices from the front of a range. Returns false if
+  // the range is empty.
+  static bool take(Range &r, size_t chunk, size_t &begin, size_t &end);
+
+  // Steals the back half of another participant's range into the range of
+  // participant w. Returns false if every range is empty.
+  static bool steal(std::vector<Range> &ranges, unsigned w);
+
+  // True while the current thread is executing a task for the pool.
+  static thread_local bool inTask;
+
+ public:
+  ThreadPool() = default;
+
+  // The pool owns its' threads, so it cannot be copied.
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  /*! \brief Stops and joins every worker thread.
+   */
+  ~ThreadPool();
+
+  /*! \brief Gets the process-wide thread pool.
+   *
+   *  The pool is created on first use. If the process has been forked since
+   * then, the child gets a fresh pool, since the parent's threads do not exist
+   * in the child.
+   *
+   * \return A reference to the pool.
+   */
+  static ThreadPool &global();
+
+  /*! \brief Destroys the process-wide thread pool, joining its' workers.
+   *
+   *  This must be called before the code for the workers is unloaded.
+   */
+  static void shutdown();
+
+  /*! \brief Gets the number of worker threads which have been spawned.
+   *
+   * \return The number of workers, not including the calling thread.
+   */
+  unsigned nWorkers();
+
+  /*! \brief Applies a job to every index in [0, n) in parallel.
+   *
+   *  The indices are initially split evenly between the participants. Each
+   * participant repeatedly takes `chunk` indices from its' own range, and once
+   * that is empty it steals half of the remaining indices of another
+   * participant. The first exception thrown by the job stops the loop, and is
+   * rethrown on the calling thread once every participant has stopped.
+   * Calling parallelFor from inside a job runs the nested loop serially.
+   *
+   * \param n The number of indices, which must be less than 2^32.
+   *
+   * \param nThreads The number of participating threads, including the
+   * calling thread.
+   *
+   * \param chunk The number of indices to take from the front of a range at a
+   * time.
+   *
+   * \param job A callable invoked as `job(participant, begin, end)` for each
+   * chunk [begin, end). The participant index is less than nThreads, and no
+   * two threads have the same participant index at the same time, so it can
+   * be used to index per-thread scratch memory.
+   */
+  template <typename Job>
+  void parallelFor(size_t n, unsigned nThreads, size_t chunk, Job &&job);
+
+  /*! \brief Sorts a range in parallel.
+   *
+   *  The range is split into one part per thread, the parts are sorted in
+   * parallel, and then neighbouring parts are merged in parallel until the
+   * whole range is sorted. The sort is not stable.
+   *
+   * \param first An iterator to the first element.
+   *
+   * \param last An iterator past the last element.
+   *
+   * \param nThreads The number of participating threads, including the
+   * calling thread.
+   *
+   * \param comp The comparison to sort by, as for std::sort.
+   */
+  template <typename RandomIt, typename Compare>
+  void parallelSort(RandomIt first, RandomIt last, unsigned nThreads,
+                    Compare comp);
+};
+
+template <typename Job>
+void ThreadPool::parallelFor(size_t n, unsigned nThreads, size_t chunk,
+                             Job &&job) {
+  if (n == 0) return;
+  if (n > 0xffffffff)
+    throw std::length_error("parallelFor supports fewer than 2^32 indices.");
+  chunk = std::max<size_t>(chunk, 1);
+
+  // Run serially if there is nothing to share, or if this is a nested loop
+  // (which would otherwise wait on itself).
+  if (nThreads <= 1 || n == 1 || inTask) {
+    job(0u, size_t(0), n);
+    return;
+  }
+
+  std::vector<Range> ranges(nThreads);
+  for (unsigned w = 0; w < nThreads; ++w)
+    ranges[w].range.store(pack(n * w / nThreads, n * (w + 1) / nThreads));
+
+  std::atomic<bool> failed{false};
+  std::exception_ptr error = nullptr;
+  std::mutex errorMutex;
+
+  run(nThreads, [&](unsigned w) {
+    try {
+      size_t begin, end;
+      while (!failed.load(std::memory_order_relaxed)) {
+        if (!take(ranges[w], chunk, begin, end)) {
+          if (!steal(ranges, w)) break;
+          continue;
+        }
+        job(w, begin, end);
+      }
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(errorMutex);
+      if (!error) error = std::current_exception();
+      failed = true;
+    }
+  });
+
+  if (error) std::rethrow_exception(error);
+}
+
+template <typename RandomIt, typename Compare>
+void ThreadPool::parallelSort(RandomIt first, RandomIt last, unsigned nThreads,
+                              Compare comp) {
+  size_t n = last - first;
+  if (nThreads <= 1 || n < 2 * size_t(nThreads)) {
+    std::sort(first, last, comp);
+    return;
+  }
+
+  std::vector<size_t> bounds(nThreads + 1);
+  for (unsigned p = 0; p <= nThreads; ++p) bounds[p] = n * p / nThreads;
+
+  parallelFor(nThreads, nThreads, 1, [&](unsigned, size_t begin, size_t end) {
+    for (size_t p = begin; p < end; ++p)
+      std::sort(first + bounds[p], first + bounds[p + 1], comp);
+  });
+
+  // Merge pairs of sorted runs, doubling their width each pass.
+  for (size_t width = 1; width < nThreads; width *= 2) {
+    size_t nMerges = (nThreads + 2 * width - 1) / (2 * width);
+    parallelFor(nMerges, nThreads, 1, [&](unsigned, size_t begin, size_t end) {
+      for (size_t m = begin; m < end; ++m) {
+        size_t lo = 2 * width * m;
+        size_t mid = std::min<size_t>(lo + width, nThreads);
+        size_t hi = std::min<size_t>(lo + 2 * width, nThreads);
+        if (mid < hi)
+          std::inplace_merge(first + bounds[lo], first + bounds[mid],
+                             first + bounds[hi], comp);
+      }
+    });
+  }
+}
+
+#endif /* THREAD_POOL_H */
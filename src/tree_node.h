@@ -18,9 +18,12 @@
 #ifndef NODE_H
 #define NODE_H
 
+#include <cstdint>
 #include <list>
 #include <random>
 
+#include "arena.h"
+
 class Parameters {
  public:
   /*! \brief Returns the default path for traversing a tree described by these
@@ -29,38 +32,76 @@ class Parameters {
    * \return A vector representing the default path.
    */
   std::vector<unsigned> defaultPath();
+
+  /*! \brief Checks whether trees with these parameters can be merged.
+   *
+   * \param other The parameters of another tree.
+   *
+   * \return True if both trees describe the same outcomes with the same
+   * prior.
+   */
+  bool compatible(Parameters *other);
 };
 
 template <typename Outcome, typename ChildNode, class Parameters>
 class TreeNode {
  protected:
-  // The distribution parameters for the tree.
-  Parameters *parameters;
-
-  // The depth of the node in the tree.
-  unsigned depth;
-
-  // The number of child nodes below. For example, in IRV this can represent the
-  // selection of a candidate for next preference. The leaves in a tree will
-  // have 2 children, representing one of two remaining candidates. If
-  // partial ballots are allowed, then the number of children is still the same
-  // as a ballot termination does require a child node.
-  unsigned nChildren;
+  // The Arena which owns the node (see Arena::getOwner). Nodes are shared
+  // between a tree and its' clones, so a node may only be modified by the tree
+  // which owns its' arena. The distribution parameters are not stored in the
+  // node, since the trees sharing it may have different parameters.
+  const Arena *owner;
 
   // The a parameters for the dirichlet distribution on the possible
   // next-preferences. Considering the case of IRV ballots allowing for partial
-  // specification, then it has size nCandidates+1.
+  // specification, then it has size nCandidates+1. Implementations may store
+  // only the parameters of observed children, since the rest are zero.
   double *as;
 
   // An array of ChildNode pointers corresponding to each of the child states.
   // These will be null pointers if the corresponding child has not yet been
-  // initialized.
+  // initialized. Implementations which store `as` sparsely store the children
+  // in the same way.
   ChildNode **children;
 
+  // The depth of the node in the tree. This and `nChildren` are stored last
+  // and narrow, so that implementations can pack small fields of their own
+  // into the padding at the end of the node.
+  uint16_t depth;
+
+  // The number of child nodes below. For example, in IRV this can represent the
+  // selection of a candidate for next preference. The leaves in a tree will
+  // have 2 children, representing one of two remaining candidates. If
+  // partial ballots are allowed, then the number of children is still the same
+  // as a ballot termination does require a child node.
+  uint16_t nChildren;
+
  public:
-  // Destructor.
+  // Destructor. Nodes, along with their `as` and `children` arrays, are owned
+  // by the Arena of the tree they belong to, so the destructor is never called
+  // on a node in a tree.
   virtual ~TreeNode(){};
 
+  // Getters, for serialising the tree.
+
+  /*! \brief Gets the depth of the node in the tree.
+   *
+   * \return The depth of the node.
+   */
+  unsigned getDepth() const { return depth; }
+
+  /*! \brief Gets the number of child states of the node.
+   *
+   * \return The number of children.
+   */
+  unsigned getNChildren() const { return nChildren; }
+
+  /*! \brief Gets the Arena which owns the node.
+   *
+   * \return A pointer to the owning arena.
+   */
+  const Arena *getOwner() const { return owner; }
+
   /*! \brief Samples count data from the sub-tree.
    *
    *  A TreeNode represents a non-terminal state of a stochastic process.
@@ -68,6 +109,8 @@ class TreeNode {
    * the underlying stochastic process for which this node represents an
    * internal state.
    *
+   * \param parameters The distribution parameters of the tree.
+   *
    * \param count The number of outcomes to sample starting from the current
    * node.
    *
@@ -81,9 +124,17 @@ class TreeNode {
    * \return A list of (outcome, count) pairs corresponding to realizations of
    * the underlying stochastic process possible from the starting point that
    * this node represents.
+   *
+   * Implementations should also provide a `Workspace` type holding the path
+   * and any scratch memory for sampling, along with a non-virtual template
+   * overload `sample(parameters, count, workspace, engine, sink)` which
+   * passes each (outcome, count) pair to the callable `sink` instead of
+   * returning a list.
+   * DirichletTree uses that overload to stream samples to its' callers.
    */
   virtual std::list<std::pair<Outcome, unsigned>> sample(
-      unsigned count, std::vector<unsigned> path, std::mt19937 *engine) = 0;
+      Parameters *parameters, unsigned count, std::vector<unsigned> path,
+      std::mt19937 *engine) = 0;
 
   /*! \brief Updates sub-tree parameters to obtain a posterior.
    *
@@ -91,14 +142,46 @@ class TreeNode {
    * method updates the parameters along the path to the outome in order to
    * obtain the posterior Dirichlet-tree having observed the outcome.
    *
+   *  The node must be owned by the arena. Children owned by another arena are
+   * copied into it before they are modified, so that trees sharing the
+   * children are unaffected.
+   *
+   * \param parameters The distribution parameters of the tree.
+   *
    * \param o The outcome to observe.
    *
    * \param path The path to the current node.
    *
    * \param count The number of times to observe o.
+   *
+   * \param arena The Arena from which any new nodes are allocated.
+   *
+   * Implementations should also provide a non-virtual overload
+   * `update(parameters, first, last, path, arena)` taking a sorted range of
+   * pointers to (outcome, count) pairs, which DirichletTree uses for batch
+   * updates.
+   */
+  virtual void update(Parameters *parameters, const Outcome &o,
+                      std::vector<unsigned> path, unsigned count,
+                      Arena *arena) = 0;
+
+  /*! \brief Adds the parameters of another sub-tree to this one.
+   *
+   *  The sub-trees must represent the same state in trees with compatible
+   * parameters. Afterwards, this sub-tree is the posterior having observed
+   * the outcomes of both. The nodes of the other sub-tree are shared rather
+   * than copied where this one has not been initialized, so the arenas
+   * which own them must outlive this tree and must not be modified.
+   *
+   * \param parameters The distribution parameters of the tree.
+   *
+   * \param other The root of the sub-tree to merge into this one.
+   *
+   * \param arena The Arena which owns this node, from which any copied nodes
+   * are allocated.
    */
-  virtual void update(const Outcome &o, std::vector<unsigned> path,
-                      unsigned count) = 0;
+  virtual void merge(Parameters *parameters, const ChildNode &other,
+                     Arena *arena) = 0;
 };
 
 #endif /* NODE_H */